@@ -0,0 +1,82 @@
+# Host simulation build
+#
+# Compiles the application for linux against stubbed nrf drivers found
+# in ${hostdir}, see host/sim.h.
+
+hostdir = host
+hostbuilddir = ${builddir}/host
+HOSTCC = gcc
+
+HOST_CFLAGS  = $(FLAGS) -DHOST_SIM -Wall -Werror -O2 -g3
+HOST_CFLAGS += -fno-builtin -fno-strict-aliasing
+# flash addresses are real nrf52 addresses, mapped low on the host
+HOST_CFLAGS += -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast
+# application sources get src/ libc overrides, as on target
+HOST_APP_CFLAGS = $(HOST_CFLAGS) -I./${sourcedir} -I./${hostdir}
+# simulator sources get the host libc
+HOST_SIM_CFLAGS = $(HOST_CFLAGS) -I./${hostdir} -iquote ./${sourcedir}
+# fixed addresses, so logdec finds strings logged by pointer
+HOST_LFLAGS = -no-pie
+
+HOST_APP_CFILES = app.c tnv.c bitmanio_impl.c miniutils.c ws2812b.c anim.c pvm.c cmd.c stream.c connpol.c flashq.c commitpol.c log.c prof.c
+HOST_SIM_CFILES = sim.c
+
+HOST_APP_OBJFILES = $(HOST_APP_CFILES:%.c=${hostbuilddir}/app/%.o)
+HOST_SIM_OBJFILES = $(HOST_SIM_CFILES:%.c=${hostbuilddir}/%.o)
+HOST_OBJFILES = $(HOST_APP_OBJFILES) $(HOST_SIM_OBJFILES)
+
+HOST_BENCHES = bench_ws2812b bench_pvm bench_tnv bench_bitmanio bench_rand
+HOST_FUZZES = fuzz_tnv
+HOST_TOOLS = logdec
+
+HOST_DEPFILES = $(HOST_OBJFILES:%.o=%.d) ${hostbuilddir}/sim_main.d
+HOST_DEPFILES += $(HOST_BENCHES:%=${hostbuilddir}/%.d)
+HOST_DEPFILES += $(HOST_FUZZES:%=${hostbuilddir}/%.d)
+HOST_DEPFILES += $(HOST_TOOLS:%=${hostbuilddir}/%.d)
+
+$(HOST_APP_OBJFILES) : ${hostbuilddir}/app/%.o:${sourcedir}/%.c
+		@echo "... host compile $@"
+		@${MKDIR} $(@D);
+		@${HOSTCC} $(HOST_APP_CFLAGS) -MMD -MP -c -o $@ $<
+
+${hostbuilddir}/%.o: ${hostdir}/%.c
+		@echo "... host compile $@"
+		@${MKDIR} $(@D);
+		@${HOSTCC} $(HOST_SIM_CFLAGS) -MMD -MP -c -o $@ $<
+
+${hostbuilddir}/$(BINARY)-sim: $(HOST_OBJFILES) ${hostbuilddir}/sim_main.o
+		@echo "... host linking $@"
+		@${HOSTCC} -o $@ $^ $(HOST_LFLAGS)
+
+${hostbuilddir}/bench_ws2812b: ${hostbuilddir}/app/ws2812b.o ${hostbuilddir}/app/bitmanio_impl.o
+${hostbuilddir}/bench_pvm: ${hostbuilddir}/app/pvm.o
+# boots the whole lamp
+${hostbuilddir}/bench_tnv: $(HOST_OBJFILES)
+${hostbuilddir}/bench_rand: ${hostbuilddir}/app/miniutils.o
+${hostbuilddir}/fuzz_tnv: ${hostbuilddir}/app/tnv.o ${hostbuilddir}/app/bitmanio_impl.o ${hostbuilddir}/app/miniutils.o ${hostbuilddir}/app/log.o ${hostbuilddir}/app/prof.o
+
+$(HOST_BENCHES:%=${hostbuilddir}/%) $(HOST_FUZZES:%=${hostbuilddir}/%) $(HOST_TOOLS:%=${hostbuilddir}/%): ${hostbuilddir}/%: ${hostbuilddir}/%.o
+		@echo "... host linking $@"
+		@${HOSTCC} -o $@ $^ $(HOST_LFLAGS)
+
+# builds the host simulator, run it with -h for usage
+host-sim: ${hostbuilddir}/$(BINARY)-sim
+
+# builds and runs all host benchmarks
+host-bench: $(HOST_BENCHES:%=${hostbuilddir}/%)
+	@for b in $^; do $$b || exit 1; done
+
+# builds and runs all host fuzzers
+host-fuzz: $(HOST_FUZZES:%=${hostbuilddir}/%)
+	@for f in $^; do $$f || exit 1; done
+
+# builds host tools, see host/logdec.c
+host-tools: $(HOST_TOOLS:%=${hostbuilddir}/%)
+
+host-clean:
+	@echo ... host clean
+	@rm -rf ${hostbuilddir}
+
+-include $(HOST_DEPFILES)
+
+.PHONY: host-sim host-bench host-fuzz host-tools host-clean
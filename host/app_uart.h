@@ -0,0 +1,16 @@
+/*
+ * app_uart.h - host simulation stub
+ *
+ * Characters put are handed to the simulator, see sim.h.
+ */
+
+#ifndef APP_UART_H__
+#define APP_UART_H__
+
+#include "nordic_common.h"
+#include "nrf_error.h"
+
+uint32_t app_uart_put(uint8_t byte);
+uint32_t app_uart_get(uint8_t * p_byte);
+
+#endif // APP_UART_H__
@@ -0,0 +1,15 @@
+/*
+ * app_util_platform.h - host simulation stub
+ *
+ * The simulation is single threaded, critical regions are no-ops.
+ */
+
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+#include "nordic_common.h"
+
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT()  }
+
+#endif // APP_UTIL_PLATFORM_H__
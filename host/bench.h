@@ -0,0 +1,47 @@
+/*
+ * bench.h
+ *
+ * Timing helpers for host benchmarks. Cycles are read from the time
+ * stamp counter where available, otherwise nanoseconds are used.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycles"
+static inline uint64_t bench_now(void) {
+  return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+// runs fn given number of rounds, returns best of runs in cycles per round
+#define BENCH_BEST(_best, _runs, _rounds, _fn) \
+  do { \
+    int __r; \
+    (_best) = ~0ULL; \
+    for (__r = 0; __r < (_runs); __r++) { \
+      uint64_t __t0 = bench_now(); \
+      int __i; \
+      for (__i = 0; __i < (_rounds); __i++) { _fn; } \
+      uint64_t __d = (bench_now() - __t0) / (_rounds); \
+      if (__d < (_best)) (_best) = __d; \
+    } \
+  } while (0)
+
+// keeps the compiler from optimizing away benchmarked work
+static inline void bench_clobber(void *p) {
+  __asm__ __volatile__("" : : "g"(p) : "memory");
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,177 @@
+/*
+ * bench_bitmanio.c
+ *
+ * Compares the 8, 16, 32 and 64 bit memory variants of bitmanio streams
+ * and arrays, the wide stream fields against reading them a memory unit
+ * at a time, and bulk reads and writes against one call per field.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "system.h"
+
+#define BITMANIO_H_WHEREABOUTS "bitmanio.h"
+#define BITMANIO_STORAGE_BITS 8
+#include "bitmanio.h"
+#define BITMANIO_STORAGE_BITS 16
+#include "bitmanio.h"
+#define BITMANIO_STORAGE_BITS 32
+#include "bitmanio.h"
+#define BITMANIO_STORAGE_BITS 64
+#include "bitmanio.h"
+
+#define FIELDS      4096
+#define N_BITS      5
+#define ROUNDS      50
+
+enum { T_WRITE, T_READ, T_WRITEW, T_READW, T_WRITE_N, T_READ_N, T_SET, T_GET, TESTS };
+static const char *NAMES[TESTS] = {
+  "write", "read", "writew", "readw", "write_n", "read_n", "set", "get"
+};
+
+// narrow fields fit all variants, wide fields are up to 32 bits
+static uint8_t narrow[FIELDS];
+static uint8_t wide[FIELDS];
+static uint32_t values[FIELDS];
+static uint64_t mem[FIELDS / 2 + 2];
+static double res[4][TESTS];
+
+static uint32_t mask(uint32_t v, uint8_t bits) {
+  return bits == 32 ? v : v & ((1 << bits) - 1);
+}
+
+#define BENCH_VARIANT(_bits, _type) \
+static int bench##_bits(double *r) { \
+  bitmanio_stream##_bits##_t bs; \
+  bitmanio_array##_bits##_t ba; \
+  _type vals[FIELDS]; \
+  uint32_t i, sum = 0, err = 0; \
+  uint64_t t; \
+  for (i = 0; i < FIELDS; i++) vals[i] = values[i]; \
+  BENCH_BEST(t, 10, ROUNDS, \
+      memset(mem, 0, sizeof(mem)); bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      for (i = 0; i < FIELDS; i++) bitmanio_write##_bits(&bs, values[i], narrow[i]); \
+      bench_clobber(mem)); \
+  r[T_WRITE] = (double)t / FIELDS; \
+  BENCH_BEST(t, 10, ROUNDS, \
+      bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      for (i = 0; i < FIELDS; i++) sum += bitmanio_read##_bits(&bs, narrow[i]); \
+      bench_clobber(&sum)); \
+  r[T_READ] = (double)t / FIELDS; \
+  bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+  for (i = 0; i < FIELDS; i++) err |= bitmanio_read##_bits(&bs, narrow[i]) != mask(values[i], narrow[i]); \
+  BENCH_BEST(t, 10, ROUNDS, \
+      memset(mem, 0, sizeof(mem)); bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      for (i = 0; i < FIELDS; i++) bitmanio_writew##_bits(&bs, values[i], wide[i]); \
+      bench_clobber(mem)); \
+  r[T_WRITEW] = (double)t / FIELDS; \
+  BENCH_BEST(t, 10, ROUNDS, \
+      bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      for (i = 0; i < FIELDS; i++) sum += bitmanio_readw##_bits(&bs, wide[i]); \
+      bench_clobber(&sum)); \
+  r[T_READW] = (double)t / FIELDS; \
+  bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+  for (i = 0; i < FIELDS; i++) err |= bitmanio_readw##_bits(&bs, wide[i]) != mask(values[i], wide[i]); \
+  BENCH_BEST(t, 10, ROUNDS, \
+      memset(mem, 0, sizeof(mem)); bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      bitmanio_write_n##_bits(&bs, vals, FIELDS, N_BITS); \
+      bench_clobber(mem)); \
+  r[T_WRITE_N] = (double)t / FIELDS; \
+  BENCH_BEST(t, 10, ROUNDS, \
+      bitmanio_init_stream##_bits(&bs, (_type *)mem); \
+      bitmanio_read_n##_bits(&bs, vals, FIELDS, N_BITS); \
+      bench_clobber(vals)); \
+  r[T_READ_N] = (double)t / FIELDS; \
+  bitmanio_init_array##_bits(&ba, (_type *)mem, N_BITS); \
+  for (i = 0; i < FIELDS; i++) err |= bitmanio_get##_bits(&ba, i) != mask(values[i], N_BITS); \
+  for (i = 0; i < FIELDS; i++) err |= vals[i] != mask(values[i], N_BITS); \
+  BENCH_BEST(t, 10, ROUNDS, \
+      for (i = 0; i < FIELDS; i++) bitmanio_set##_bits(&ba, i, values[i]); \
+      bench_clobber(mem)); \
+  r[T_SET] = (double)t / FIELDS; \
+  BENCH_BEST(t, 10, ROUNDS, \
+      for (i = 0; i < FIELDS; i++) sum += bitmanio_get##_bits(&ba, i); \
+      bench_clobber(&sum)); \
+  r[T_GET] = (double)t / FIELDS; \
+  return err; \
+}
+
+BENCH_VARIANT(8, uint8_t)
+BENCH_VARIANT(16, uint16_t)
+BENCH_VARIANT(32, uint32_t)
+BENCH_VARIANT(64, uint64_t)
+
+// wide fields a byte at a time, as tnv did before bitmanio_readw8 and
+// bitmanio_writew8
+static void write_bytes(bitmanio_stream8_t *bs, uint32_t v, uint8_t bits) {
+  while (bits > 8) {
+    bits -= 8;
+    bitmanio_write8(bs, v >> bits, 8);
+  }
+  bitmanio_write8(bs, v, bits);
+}
+
+static uint32_t read_bytes(bitmanio_stream8_t *bs, uint8_t bits) {
+  uint32_t v = 0;
+  while (bits > 8) {
+    bits -= 8;
+    v |= bitmanio_read8(bs, 8) << bits;
+  }
+  return v | bitmanio_read8(bs, bits);
+}
+
+int main(void) {
+  uint32_t i, sum = 0;
+  uint32_t seed = 0x12312312;
+  for (i = 0; i < FIELDS; i++) {
+    seed = seed * 1664525 + 1013904223;
+    values[i] = seed;
+    narrow[i] = 1 + (seed >> 8) % 8;
+    wide[i] = 1 + (seed >> 16) % 32;
+  }
+  if (bench8(res[0]) | bench16(res[1]) | bench32(res[2]) | bench64(res[3])) {
+    printf("bitmanio: read back differs\n");
+    return 1;
+  }
+
+  bitmanio_stream8_t bs;
+  uint64_t t_wr_bytes, t_wr_w, t_bytes, t_w;
+  BENCH_BEST(t_wr_bytes, 10, ROUNDS,
+      memset(mem, 0, sizeof(mem)); bitmanio_init_stream8(&bs, (uint8_t *)mem);
+      for (i = 0; i < FIELDS; i++) write_bytes(&bs, values[i], wide[i]);
+      bench_clobber(mem));
+  BENCH_BEST(t_wr_w, 10, ROUNDS,
+      memset(mem, 0, sizeof(mem)); bitmanio_init_stream8(&bs, (uint8_t *)mem);
+      for (i = 0; i < FIELDS; i++) bitmanio_writew8(&bs, values[i], wide[i]);
+      bench_clobber(mem));
+  BENCH_BEST(t_bytes, 10, ROUNDS,
+      bitmanio_init_stream8(&bs, (uint8_t *)mem);
+      for (i = 0; i < FIELDS; i++) sum += read_bytes(&bs, wide[i]);
+      bench_clobber(&sum));
+  BENCH_BEST(t_w, 10, ROUNDS,
+      bitmanio_init_stream8(&bs, (uint8_t *)mem);
+      for (i = 0; i < FIELDS; i++) sum += bitmanio_readw8(&bs, wide[i]);
+      bench_clobber(&sum));
+
+  printf("bitmanio, %u fields, %s per field\n", FIELDS, BENCH_UNIT);
+  printf("  narrow fields 1-8 bits, wide 1-32 bits, bulk and arrays %u bits\n", N_BITS);
+  printf("  memory");
+  for (i = 0; i < TESTS; i++) printf("  %7s", NAMES[i]);
+  printf("\n");
+  for (i = 0; i < 4; i++) {
+    int j;
+    printf("  %4u  ", 8 << i);
+    for (j = 0; j < TESTS; j++) printf("  %7.2f", res[i][j]);
+    printf("\n");
+  }
+  printf("  wide fields in 8 bit memory, byte at a time against one call\n");
+  printf("    write  %7.2f  writew8  %7.2f  (%.1fx)\n",
+      (double)t_wr_bytes / FIELDS, (double)t_wr_w / FIELDS,
+      (double)t_wr_bytes / (t_wr_w ? t_wr_w : 1));
+  printf("    read   %7.2f  readw8   %7.2f  (%.1fx)\n",
+      (double)t_bytes / FIELDS, (double)t_w / FIELDS,
+      (double)t_bytes / (t_w ? t_w : 1));
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * bench_pvm.c
+ *
+ * Measures pixel program cost: instructions per frame, time per frame
+ * and how many animation steps a frame needs under the app budget.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "system.h"
+#include "app.h"
+#include "pvm.h"
+
+#define MAX_LEDS    300
+
+typedef struct {
+  const char *name;
+  const uint8_t *prog;
+  uint16_t len;
+} prog_t;
+
+static const uint8_t PROG_SOLID[] = { PVM_MAGIC, 20,
+  PVM_LIT24, 0x22, 0xaa, 0xff,
+  PVM_END };
+
+// sine wave per channel, phase shifted a third
+static const uint8_t PROG_RAINBOW[] = { PVM_MAGIC, 20,
+  PVM_T, PVM_LIT8, 4, PVM_MUL, PVM_I, PVM_LIT8, 16, PVM_MUL, PVM_ADD,
+  PVM_DUP, PVM_DUP, PVM_SIN,
+  PVM_SWAP, PVM_LIT8, 85, PVM_ADD, PVM_SIN,
+  PVM_ROT, PVM_LIT8, 170, PVM_ADD, PVM_SIN,
+  PVM_RGB,
+  PVM_END };
+
+// travelling wave of one colour
+static const uint8_t PROG_WAVE[] = { PVM_MAGIC, 20,
+  PVM_LIT24, 0x88, 0x00, 0xff,
+  PVM_I, PVM_LIT8, 16, PVM_MUL, PVM_T, PVM_LIT8, 8, PVM_MUL, PVM_SUB, PVM_SIN,
+  PVM_SCALE,
+  PVM_END };
+
+// odd and even pixels in different colours
+static const uint8_t PROG_BRANCH[] = { PVM_MAGIC, 20,
+  PVM_I, PVM_LIT8, 1, PVM_AND, PVM_JZ, 6,
+  PVM_LIT24, 0x00, 0x00, 0xff, PVM_JMP, 4,
+  PVM_LIT24, 0xff, 0x00, 0x00,
+  PVM_END };
+
+// slow fade in 8.8, red rising 1/256 per frame, green and blue a quarter of that
+static const uint8_t PROG_FADE16[] = { PVM_MAGIC, 20,
+  PVM_T, PVM_DUP, PVM_LIT8, 2, PVM_SHR, PVM_DUP,
+  PVM_END16 };
+
+// INT32_MIN / -1 and % -1, which trap on the host if not guarded
+static const uint8_t PROG_WRAP[] = { PVM_MAGIC, 20,
+  PVM_LIT8, 1, PVM_LIT8, 31, PVM_SHL, PVM_DUP, PVM_LIT8, 0, PVM_LIT8, 1, PVM_SUB,
+  PVM_DUP, PVM_ROT, PVM_SWAP, PVM_MOD, PVM_ROT, PVM_ROT, PVM_DIV, PVM_ADD,
+  PVM_I, PVM_MUL,
+  PVM_END };
+
+static const prog_t PROGS[] = {
+  { "solid", PROG_SOLID, sizeof(PROG_SOLID) },
+  { "rainbow", PROG_RAINBOW, sizeof(PROG_RAINBOW) },
+  { "wave", PROG_WAVE, sizeof(PROG_WAVE) },
+  { "branch", PROG_BRANCH, sizeof(PROG_BRANCH) },
+  { "fade16", PROG_FADE16, sizeof(PROG_FADE16) },
+  { "wrap", PROG_WRAP, sizeof(PROG_WRAP) },
+};
+
+static px_t rgb[MAX_LEDS];
+static px_t rgb_ref[MAX_LEDS];
+
+static int run_frame(pvm_t *vm, uint32_t budget, uint32_t *steps) {
+  int res;
+  *steps = 0;
+  do {
+    res = pvm_frame(vm, budget);
+    (*steps)++;
+  } while (res == 0);
+  return res;
+}
+
+int main(void) {
+  static const uint16_t LEDS[] = { 16, 60, MAX_LEDS };
+  uint32_t p, l;
+  printf("pvm, budget %u instructions per step, %s per frame\n", PROG_BUDGET, BENCH_UNIT);
+  printf("  %-8s %4s %5s %8s %8s %6s %5s\n",
+         "program", "len", "leds", "instr", BENCH_UNIT, "/instr", "steps");
+  for (p = 0; p < sizeof(PROGS) / sizeof(PROGS[0]); p++) {
+    const prog_t *pr = &PROGS[p];
+    for (l = 0; l < sizeof(LEDS) / sizeof(LEDS[0]); l++) {
+      pvm_t vm, vm_ref;
+      uint32_t steps;
+      uint64_t t;
+      int res = pvm_load(&vm, pr->prog, pr->len, rgb, LEDS[l]);
+      if (res != PVM_OK) {
+        printf("pvm: %s load error %i\n", pr->name, res);
+        return 1;
+      }
+      // frames split over steps must come out as single pass frames
+      pvm_load(&vm_ref, pr->prog, pr->len, rgb_ref, LEDS[l]);
+      res = run_frame(&vm_ref, ~0, &steps);
+      res |= run_frame(&vm, PROG_BUDGET, &steps);
+      if (res < 0 || memcmp(rgb, rgb_ref, LEDS[l] * sizeof(px_t))) {
+        printf("pvm: %s budgeted frame differs\n", pr->name);
+        return 1;
+      }
+      BENCH_BEST(t, 10, 200, pvm_frame(&vm, ~0); bench_clobber(rgb));
+      printf("  %-8s %4u %5u %8u %8llu %6.1f %5u\n",
+             pr->name, pr->len - PVM_HDR_LEN, LEDS[l], vm.last_icount,
+             (unsigned long long)t, (double)t / vm.last_icount, steps);
+    }
+  }
+  return 0;
+}
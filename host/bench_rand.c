@@ -0,0 +1,122 @@
+/*
+ * bench_rand.c
+ *
+ * Compares the pseudo random generator of miniutils.c against the
+ * Galois LFSR it replaced, in throughput per 32 bit value and in some
+ * quick statistics: share of one bits, chi square of byte values and
+ * correlation of consecutive values. Fails if the generator is off, or
+ * if rand_fill and rand_next disagree.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "system.h"
+
+// of miniutils.h, which clashes with the host libc
+void rand_seed(unsigned int seed);
+unsigned int rand_next();
+void rand_fill(void *buf, unsigned int n);
+
+#define WORDS       (1 << 20)
+#define FILL_LEN    4096
+// chi square of 255 degrees of freedom, 99.9% bounds
+#define CHI2_LO     190.0
+#define CHI2_HI     330.0
+
+// the replaced generator, one new bit per call, not inlined like rand_next
+#define TAPMASK     0x80000062U
+static uint32_t lfsr_state = 0x12312312;
+__attribute__((noinline)) static uint32_t lfsr_next(void) {
+  if (lfsr_state & 1) {
+    lfsr_state = (1U << 31) | ((lfsr_state ^ TAPMASK) >> 1);
+  } else {
+    lfsr_state >>= 1;
+  }
+  return lfsr_state;
+}
+
+void app_uart_put(uint8_t c) {
+}
+
+static uint32_t words[WORDS];
+static uint8_t fill[FILL_LEN + 1];
+
+typedef struct {
+  double ones;
+  double chi2;
+  double corr;
+} rand_stats_t;
+
+static void stats(const uint32_t *w, uint32_t n, rand_stats_t *st) {
+  uint64_t ones = 0;
+  uint32_t hist[256];
+  double sx = 0, sxx = 0, sxy = 0;
+  uint32_t i, b;
+  memset(hist, 0, sizeof(hist));
+  for (i = 0; i < n; i++) {
+    ones += __builtin_popcount(w[i]);
+    for (b = 0; b < 4; b++) hist[(w[i] >> (8 * b)) & 0xff]++;
+    double x = w[i];
+    sx += x;
+    sxx += x * x;
+    if (i + 1 < n) sxy += x * w[i + 1];
+  }
+  double expect = n * 4.0 / 256;
+  st->chi2 = 0;
+  for (i = 0; i < 256; i++) st->chi2 += (hist[i] - expect) * (hist[i] - expect) / expect;
+  st->ones = (double)ones / (32.0 * n);
+  double mean = sx / n;
+  st->corr = (sxy / (n - 1) - mean * mean) / (sxx / n - mean * mean);
+}
+
+static void row(const char *name, uint64_t t, const rand_stats_t *st) {
+  printf("  %-10s %8.2f  %8.5f  %8.1f  %+8.5f\n", name, (double)t / (WORDS / 64),
+      st->ones, st->chi2, st->corr);
+}
+
+int main(void) {
+  uint32_t i;
+  rand_stats_t st_lfsr, st;
+  uint64_t t_lfsr, t_next, t_fill;
+
+  // rand_fill gives the rand_next stream, aligned or not
+  rand_seed(0x12312312);
+  for (i = 0; i < FILL_LEN / 4; i++) words[i] = rand_next();
+  rand_seed(0x12312312);
+  rand_fill(fill, FILL_LEN);
+  if (memcmp(fill, words, FILL_LEN)) {
+    printf("rand: aligned rand_fill differs from rand_next\n");
+    return 1;
+  }
+  rand_seed(0x12312312);
+  rand_fill(fill + 1, FILL_LEN - 1);
+  if (memcmp(fill + 1, words, FILL_LEN - 1)) {
+    printf("rand: unaligned rand_fill differs from rand_next\n");
+    return 1;
+  }
+
+  for (i = 0; i < WORDS; i++) words[i] = lfsr_next();
+  stats(words, WORDS, &st_lfsr);
+  rand_seed(0x12312312);
+  for (i = 0; i < WORDS; i++) words[i] = rand_next();
+  stats(words, WORDS, &st);
+
+  BENCH_BEST(t_lfsr, 20, 1, for (i = 0; i < WORDS / 64; i++) words[i] = lfsr_next(); bench_clobber(words));
+  BENCH_BEST(t_next, 20, 1, for (i = 0; i < WORDS / 64; i++) words[i] = rand_next(); bench_clobber(words));
+  BENCH_BEST(t_fill, 20, 1, rand_fill(words, WORDS / 64 * 4); bench_clobber(words));
+
+  printf("pseudo random generators, %s per 32 bit value, %u values\n", BENCH_UNIT, WORDS);
+  printf("                 time      ones      chi2      corr\n");
+  row("lfsr", t_lfsr, &st_lfsr);
+  row("rand_next", t_next, &st);
+  printf("  %-10s %8.2f\n", "rand_fill", (double)t_fill / (WORDS / 64));
+  printf("  ones 0.5, chi2 of bytes within %.0f..%.0f, corr 0 expected\n", CHI2_LO, CHI2_HI);
+  if (ABS(st.ones - 0.5) > 0.001 || st.chi2 < CHI2_LO || st.chi2 > CHI2_HI ||
+      ABS(st.corr) > 0.01) {
+    printf("rand: statistics off\n");
+    return 1;
+  }
+  return 0;
+}
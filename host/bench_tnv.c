@@ -0,0 +1,143 @@
+/*
+ * bench_tnv.c
+ *
+ * Measures boot to light, from app_init to the first spi transfer to
+ * the strips, in the host simulation against fill level of the tnv
+ * page, replaying the whole page and replaying from the latest
+ * checkpoint. Simulated time is mostly the startup delay, the host
+ * time spent getting there grows with what tnv_init replays.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "sim.h"
+#include "app.h"
+#include "tnv.h"
+
+#define LEVELS      5
+#define RUNS        20
+
+typedef struct {
+  uint64_t cycles;
+  uint64_t light_ns;
+} boot_t;
+
+static uint8_t *pages(void) {
+  return sim_flash_page(BLE_FLASH_PAGE_END - TNV_PAGES);
+}
+
+static uint32_t bench_write(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src) {
+  uint32_t i;
+  for (i = 0; i < len; i++) buf[offs + i] &= src[i];
+  return 0;
+}
+
+static uint32_t bench_erase(uint8_t *buf) {
+  memset(buf, 0xff, BLE_FLASH_PAGE_SIZE);
+  return 0;
+}
+
+// commits settings like the app does until first page is filled to
+// given percentage, returns number of commits
+static uint32_t fill(uint8_t checkpoint, uint32_t percent) {
+  tnv_t tnv;
+  uint32_t commits = 0;
+  uint32_t seed = 0x12312312;
+  memset(pages(), 0xff, BLE_FLASH_PAGE_SIZE * TNV_PAGES);
+  tnv_init(&tnv, pages(), BLE_FLASH_PAGE_SIZE, TNV_PAGES, bench_write, bench_erase);
+  tnv.checkpoint = checkpoint;
+  tnv_set(&tnv, 1, 0xffaa22);
+  tnv_set(&tnv, 2, 5);
+  tnv_set(&tnv, 3, 0xffffff);
+  tnv_set(&tnv, 4, 0);
+  tnv_set(&tnv, 5, 0);
+  tnv_set(&tnv, 15, 0);
+  tnv_commit(&tnv);
+  commits++;
+  uint32_t bits = (BLE_FLASH_PAGE_SIZE - TNV_DATA_OFFS) * 8 * percent / 100;
+  while (tnv.page == 0 && bitmanio_getpos8(&tnv.str) < bits) {
+    seed = seed * 1664525 + 1013904223;
+    // mostly colour changes, some intensity
+    if (seed & 0x100) tnv_set(&tnv, 1, seed >> 8);
+    else tnv_set(&tnv, 2, (seed >> 16) & 7);
+    tnv_commit(&tnv);
+    commits++;
+  }
+  return tnv.page == 0 ? commits : 0;
+}
+
+// Boots a fresh lamp in a child, the simulation boots once per process.
+static bool boot(boot_t *b) {
+  int fd[2];
+  pid_t pid;
+  int status;
+  if (pipe(fd)) return FALSE;
+  pid = fork();
+  if (pid < 0) return FALSE;
+  if (pid == 0) {
+    boot_t r;
+    uint64_t t0 = bench_now();
+    sim_boot();
+    while (sim_frame_count() == 0 && sim_time_ns() < 1000000000ULL) sim_run_ms(1);
+    r.cycles = bench_now() - t0;
+    r.light_ns = sim_frame_count() ? sim_frame(0)->t_start_ns : 0;
+    _exit(write(fd[1], &r, sizeof(r)) == sizeof(r) && r.light_ns ? 0 : 1);
+  }
+  close(fd[1]);
+  bool ok = read(fd[0], b, sizeof(*b)) == sizeof(*b);
+  close(fd[0]);
+  waitpid(pid, &status, 0);
+  return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// best of runs
+static bool boot_best(boot_t *best) {
+  boot_t b;
+  int r;
+  best->cycles = ~0ULL;
+  for (r = 0; r < RUNS; r++) {
+    if (!boot(&b)) return FALSE;
+    if (b.cycles < best->cycles) *best = b;
+  }
+  return TRUE;
+}
+
+int main(void) {
+  const uint8_t checkpoints[] = { 0, TNV_CHECKPOINT };
+  boot_t t[2][LEVELS];
+  uint32_t commits[2][LEVELS], tail[2][LEVELS];
+  uint32_t c, l;
+  tnv_t tnv;
+  for (c = 0; c < 2; c++) {
+    for (l = 0; l < LEVELS; l++) {
+      commits[c][l] = fill(checkpoints[c], l == 0 ? 0 : l * 100 / (LEVELS - 1) - 1);
+      tnv_init(&tnv, pages(), BLE_FLASH_PAGE_SIZE, TNV_PAGES, bench_write, bench_erase);
+      tail[c][l] = tnv.tail;
+      if (commits[c][l] == 0 || tnv_get(&tnv, 1, 0) == 0 || tnv.page != 0) {
+        printf("tnv: bad fill, checkpoint %u, level %u, commits %u\n", checkpoints[c], l, commits[c][l]);
+        return 1;
+      }
+      if (!boot_best(&t[c][l])) {
+        printf("tnv: no light, checkpoint %u, level %u\n", checkpoints[c], l);
+        return 1;
+      }
+    }
+  }
+  printf("boot to light, app_init to first spi transfer, %u byte page, sim ms and host %s\n",
+      BLE_FLASH_PAGE_SIZE, BENCH_UNIT);
+  printf("  fill  full replay: commits  replayed  sim ms      host"
+         "   checkpoint %u: commits  replayed  sim ms      host\n", TNV_CHECKPOINT);
+  for (l = 0; l < LEVELS; l++) {
+    printf("  %3u%%  %21u  %8u  %6.1f  %8llu  %23u  %8u  %6.1f  %8llu  (%.1fx)\n",
+        l * 100 / (LEVELS - 1),
+        commits[0][l], tail[0][l], t[0][l].light_ns / 1e6, (unsigned long long)t[0][l].cycles,
+        commits[1][l], tail[1][l], t[1][l].light_ns / 1e6, (unsigned long long)t[1][l].cycles,
+        (double)t[0][l].cycles / (t[1][l].cycles ? t[1][l].cycles : 1));
+  }
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * bench_ws2812b.c
+ *
+ * Compares the table driven ws2812b encoder with the previous encoder,
+ * which inserted every coded bit with bitmanio_set8.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "system.h"
+#include "ws2812b.h"
+
+#define BITMANIO_STORAGE_BITS 8
+#define BITMANIO_H_WHEREABOUTS "bitmanio.h"
+#define BITMANIO_HEADER
+#include BITMANIO_H_WHEREABOUTS
+
+#define LEDS    16
+#define CODE0   0b10000
+#define CODE1   0b11110
+
+static uint32_t rgb[LEDS];
+static uint8_t buf_ref[WS2812B_CODED_LEN(LEDS)];
+static uint8_t buf[WS2812B_CODED_LEN(LEDS)];
+
+static void encode_bitmanio(uint8_t *dst, const uint32_t *src, uint32_t leds) {
+  bitmanio_array8_t bio_arr;
+  bitmanio_init_array8(&bio_arr, dst, WS2812B_CODED_BYTES_PER_RGB_BYTE);
+  uint32_t bix = 0;
+  uint32_t i;
+  int j;
+  for (i = 0; i < leds; i++) {
+    uint32_t d = *src++;
+    d = ((d & 0x00ff00) << 8) | ((d & 0xff0000) >> 8) | (d & 0xff);
+    for (j = 8*3-1; j >= 0; j--) {
+      bitmanio_set8(&bio_arr, bix++, (d >> j) & 1 ? CODE1 : CODE0);
+    }
+  }
+}
+
+int main(void) {
+  uint32_t i;
+  uint32_t seed = 0x12312312;
+  for (i = 0; i < LEDS; i++) {
+    seed = seed * 1664525 + 1013904223;
+    rgb[i] = seed >> 8;
+  }
+
+  encode_bitmanio(buf_ref, rgb, LEDS);
+  ws2812b_encode(buf, rgb, LEDS);
+  if (memcmp(buf, buf_ref, sizeof(buf))) {
+    printf("ws2812b: encoders differ\n");
+    return 1;
+  }
+
+  uint64_t t_ref, t;
+  BENCH_BEST(t_ref, 20, 10000, encode_bitmanio(buf_ref, rgb, LEDS); bench_clobber(buf_ref));
+  BENCH_BEST(t, 20, 10000, ws2812b_encode(buf, rgb, LEDS); bench_clobber(buf));
+  printf("ws2812b encode, %u leds, %s per frame\n", LEDS, BENCH_UNIT);
+  printf("  bitmanio_set8  %8llu\n", (unsigned long long)t_ref);
+  printf("  nibble table   %8llu  (%.1fx)\n", (unsigned long long)t,
+         (double)t_ref / (t ? t : 1));
+  return 0;
+}
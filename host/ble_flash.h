@@ -0,0 +1,23 @@
+/*
+ * ble_flash.h - host simulation stub
+ *
+ * The simulated flash is mapped at its real nrf52832 address, so flash
+ * pointers computed by the application are valid on the host too.
+ * Like the real thing, writes can only clear bits and the softdevice
+ * must be disabled while writing or erasing.
+ */
+
+#ifndef BLE_FLASH_H__
+#define BLE_FLASH_H__
+
+#include "nordic_common.h"
+#include "nrf_error.h"
+
+#define BLE_FLASH_PAGE_SIZE     4096
+#define BLE_FLASH_PAGE_END      128
+#define BLE_FLASH_MAGIC_NUMBER  0x45DE0000
+
+uint32_t ble_flash_page_erase(uint8_t page_num);
+uint32_t ble_flash_block_write(uint32_t * p_address, uint32_t * p_in_array, uint16_t word_count);
+
+#endif // BLE_FLASH_H__
@@ -0,0 +1,71 @@
+/*
+ * fstorage.h - host simulation stub
+ *
+ * Operations are queued and run in order on simulated time with the
+ * softdevice enabled, the cpu stalls while flash is busy, see sim.h.
+ */
+
+#ifndef FSTORAGE_H__
+#define FSTORAGE_H__
+
+#include <stdint.h>
+#include "nordic_common.h"
+
+typedef enum {
+  FS_SUCCESS,
+  FS_ERR_NOT_INITIALIZED,
+  FS_ERR_INVALID_CFG,
+  FS_ERR_NULL_ARG,
+  FS_ERR_INVALID_ARG,
+  FS_ERR_INVALID_ADDR,
+  FS_ERR_UNALIGNED_ADDR,
+  FS_ERR_QUEUE_FULL,
+  FS_ERR_OPERATION_TIMEOUT,
+  FS_ERR_INTERNAL,
+} fs_ret_t;
+
+typedef enum {
+  FS_EVT_STORE,
+  FS_EVT_ERASE,
+} fs_evt_id_t;
+
+typedef struct {
+  fs_evt_id_t id;
+  void * p_context;
+  union {
+    struct {
+      uint32_t const * p_data;
+      uint16_t length_words;
+    } store;
+    struct {
+      uint16_t first_page;
+      uint16_t last_page;
+    } erase;
+  };
+} fs_evt_t;
+
+typedef void (*fs_cb_t)(fs_evt_t const * const evt, fs_ret_t result);
+
+typedef struct {
+  uint32_t const * p_start_addr;
+  uint32_t const * p_end_addr;
+  fs_cb_t const callback;
+  uint8_t const num_pages;
+  uint8_t const priority;
+} fs_config_t;
+
+// no section magic on the host, configurations are passed with each call
+#define FS_REGISTER_CFG(cfg_var) cfg_var
+
+fs_ret_t fs_init(void);
+fs_ret_t fs_store(fs_config_t const * p_config,
+                  uint32_t const * p_dest,
+                  uint32_t const * p_src,
+                  uint16_t length_words,
+                  void * p_context);
+fs_ret_t fs_erase(fs_config_t const * p_config,
+                  uint32_t const * p_page_addr,
+                  uint16_t num_pages,
+                  void * p_context);
+
+#endif // FSTORAGE_H__
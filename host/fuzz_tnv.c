@@ -0,0 +1,379 @@
+/*
+ * fuzz_tnv.c
+ *
+ * Cuts power at every byte of every flash operation of a random sequence
+ * of tnv commits, of short and extended values and blobs, and checks that
+ * the store then loads either the values before or after the cut commit,
+ * and keeps on committing. Then fails random flash operations the way a
+ * full flash queue does, and checks that failed commits are undone and
+ * stored by the next one. Last, drops random flash operations after the
+ * commit went through, the way a failed queued operation does, and checks
+ * that tnv_recover gets the values in ram stored again.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "system.h"
+#include "tnv.h"
+#include "nrf_error.h"
+
+#define PAGE_SIZE   512
+#define PAGES       3
+#define COMMITS     200
+#define MAX_OPS     (COMMITS * 8)
+// short ids, extended values and blobs
+#define IDS         (TNV_ID_ESC + 12)
+#define BLOB_IDS    3
+#define BLOB_MAX    40
+
+typedef struct {
+  // commit this operation belongs to
+  uint32_t commit;
+  uint32_t addr;
+  // 0 for erase
+  uint32_t len;
+  uint8_t data[PAGE_SIZE];
+} op_t;
+
+typedef struct {
+  bool defined[IDS];
+  // blobs have hash of data as value
+  uint32_t value[IDS];
+} state_t;
+
+static uint8_t flash[PAGE_SIZE * PAGES];
+static op_t ops[MAX_OPS];
+static uint32_t op_count;
+static uint32_t cur_commit;
+static bool recording;
+// fail one in this many flash operations, 0 for none
+static uint32_t fail_rate;
+// drop one in this many, reporting success, and count dropped ones
+static uint32_t drop_rate;
+static uint32_t dropped;
+// last random commit was a blob
+static bool last_blob;
+static state_t states[COMMITS + 1];
+static uint32_t rnd_state;
+
+void app_uart_put(uint8_t c) {
+  if (getenv("V")) putchar(c);
+}
+
+static uint32_t rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static void flash_write(uint32_t addr, uint32_t len, const uint8_t *src) {
+  uint32_t i;
+  for (i = 0; i < len; i++) flash[addr + i] &= src[i];
+}
+
+static void flash_erase(uint32_t addr) {
+  memset(&flash[addr], 0xff, PAGE_SIZE);
+}
+
+static uint32_t fuzz_write(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src) {
+  uint32_t addr = buf - flash + offs;
+  if (fail_rate && rnd() % fail_rate == 0) return NRF_ERROR_NO_MEM;
+  if (drop_rate && rnd() % drop_rate == 0) {
+    dropped++;
+    return 0;
+  }
+  if (recording) {
+    if (op_count >= MAX_OPS) {
+      printf("fuzz: too many ops\n");
+      exit(1);
+    }
+    ops[op_count].commit = cur_commit;
+    ops[op_count].addr = addr;
+    ops[op_count].len = len;
+    memcpy(ops[op_count].data, src, len);
+    op_count++;
+  }
+  flash_write(addr, len, src);
+  return 0;
+}
+
+static uint32_t fuzz_erase(uint8_t *buf) {
+  uint32_t addr = buf - flash;
+  if (fail_rate && rnd() % fail_rate == 0) return NRF_ERROR_NO_MEM;
+  if (drop_rate && rnd() % drop_rate == 0) {
+    dropped++;
+    return 0;
+  }
+  if (recording) {
+    ops[op_count].commit = cur_commit;
+    ops[op_count].addr = addr;
+    ops[op_count].len = 0;
+    op_count++;
+  }
+  flash_erase(addr);
+  return 0;
+}
+
+static void state_get(tnv_t *tnv, state_t *s) {
+  int i;
+  memset(s, 0, sizeof(*s));
+  for (i = 1; i < TNV_ID_ESC; i++) {
+    s->defined[i] = tnv->cache[i].defined;
+    s->value[i] = tnv->cache[i].defined ? tnv->cache[i].value : 0;
+  }
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id == 0) continue;
+    if (e->blob) {
+      uint32_t len;
+      const uint8_t *d = tnv_get_blob(tnv, e->id, &len);
+      if (d == 0) continue;
+      // fnv-1a of length and data
+      uint32_t h = (2166136261u ^ len) * 16777619;
+      while (len--) h = (h ^ *d++) * 16777619;
+      s->value[e->id] = h;
+    } else {
+      s->value[e->id] = e->value;
+    }
+    s->defined[e->id] = TRUE;
+  }
+}
+
+static bool state_eq(const state_t *a, const state_t *b) {
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static void state_dump(const char *name, const state_t *s) {
+  int i;
+  printf("  %-8s", name);
+  for (i = 1; i < IDS; i++) {
+    if (s->defined[i]) printf(" %i:%x", i, s->value[i]);
+  }
+  printf("\n");
+}
+
+// sets some values and commits, or stores a blob
+static uint32_t commit_random(tnv_t *tnv) {
+  uint32_t n = 1 + rnd() % 3;
+  last_blob = rnd() % 8 == 0;
+  if (last_blob) {
+    uint8_t blob[BLOB_MAX];
+    uint32_t len = rnd() % 4 == 0 ? 0 : rnd() % BLOB_MAX;
+    uint32_t i;
+    for (i = 0; i < len; i++) blob[i] = rnd();
+    return tnv_set_blob(tnv, IDS - 1 - rnd() % BLOB_IDS, blob, len);
+  }
+  while (n--) {
+    uint32_t id = 1 + rnd() % (IDS - 1 - BLOB_IDS);
+    uint32_t bits = 1 + rnd() % 32;
+    uint32_t value = rnd() & (bits == 32 ? 0xffffffff : ((1 << bits) - 1));
+    tnv_set(tnv, id, value);
+  }
+  return tnv_commit(tnv);
+}
+
+// records all flash operations of a random commit sequence
+static void record(void) {
+  tnv_t tnv;
+  memset(flash, 0xff, sizeof(flash));
+  op_count = 0;
+  recording = TRUE;
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  state_get(&tnv, &states[0]);
+  for (cur_commit = 1; cur_commit <= COMMITS; cur_commit++) {
+    uint32_t res = commit_random(&tnv);
+    if (res) {
+      printf("fuzz: commit %i failed, res %i\n", cur_commit, res);
+      exit(1);
+    }
+    state_get(&tnv, &states[cur_commit]);
+  }
+  recording = FALSE;
+}
+
+// replays operations before op, then op cut at given byte
+static void replay(uint32_t op, uint32_t cut) {
+  uint32_t i;
+  memset(flash, 0xff, sizeof(flash));
+  for (i = 0; i < op; i++) {
+    if (ops[i].len) flash_write(ops[i].addr, ops[i].len, ops[i].data);
+    else flash_erase(ops[i].addr);
+  }
+  op_t *o = &ops[op];
+  if (o->len) {
+    flash_write(o->addr, cut, o->data);
+    // the cut byte has some of its bits programmed
+    flash[o->addr + cut] &= o->data[cut] | rnd();
+  } else {
+    memset(&flash[o->addr], 0xff, cut);
+    // the rest has some of its bits erased
+    for (i = cut; i < PAGE_SIZE; i++) flash[o->addr + i] |= rnd();
+  }
+}
+
+static bool check(uint32_t op, uint32_t cut) {
+  tnv_t tnv;
+  state_t s, after;
+  uint32_t c = ops[op].commit;
+  replay(op, cut);
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  state_get(&tnv, &s);
+  if (!state_eq(&s, &states[c - 1]) && !state_eq(&s, &states[c])) {
+    printf("fuzz: op %i (%s @%04x) commit %i cut at byte %i, bad values\n",
+        op, ops[op].len ? "write" : "erase", ops[op].addr, c, cut);
+    state_dump("loaded", &s);
+    state_dump("before", &states[c - 1]);
+    state_dump("after", &states[c]);
+    return FALSE;
+  }
+  // store must keep working after recovery
+  uint32_t res = commit_random(&tnv);
+  state_get(&tnv, &s);
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  state_get(&tnv, &after);
+  if (res || !state_eq(&s, &after)) {
+    printf("fuzz: op %i (%s @%04x) commit %i cut at byte %i, commit after recovery lost (res %i)\n",
+        op, ops[op].len ? "write" : "erase", ops[op].addr, c, cut, res);
+    state_dump("expected", &s);
+    state_dump("loaded", &after);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Commits with failing flash operations. A failed blob must be left as it
+// was, failed values are retried without failures and must then load.
+static uint32_t fail_ops(uint32_t *failed) {
+  tnv_t tnv, loaded;
+  state_t before, s, after;
+  uint32_t c, fails = 0;
+  memset(flash, 0xff, sizeof(flash));
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  *failed = 0;
+  for (c = 1; c <= COMMITS; c++) {
+    state_get(&tnv, &before);
+    fail_rate = 4;
+    uint32_t res = commit_random(&tnv);
+    fail_rate = 0;
+    if (res) {
+      (*failed)++;
+      state_get(&tnv, &s);
+      if (last_blob && !state_eq(&s, &before)) {
+        printf("fuzz: commit %i, failed blob not undone\n", c);
+        fails++;
+      }
+      res = tnv_commit(&tnv);
+    }
+    state_get(&tnv, &s);
+    tnv_init(&loaded, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+    state_get(&loaded, &after);
+    if (res || !state_eq(&s, &after)) {
+      printf("fuzz: commit %i after failed flash ops lost (res %i)\n", c, res);
+      state_dump("expected", &s);
+      state_dump("loaded", &after);
+      fails++;
+    }
+  }
+  return fails;
+}
+
+// Commits with flash operations dropped after being accepted. Recovery
+// must store all values in ram, blobs as they were in flash.
+static uint32_t drop_ops(uint32_t *recovered) {
+  tnv_t tnv, loaded;
+  state_t ram, s, after;
+  uint32_t c, i, fails = 0;
+  memset(flash, 0xff, sizeof(flash));
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  *recovered = 0;
+  for (c = 1; c <= COMMITS; c++) {
+    dropped = 0;
+    drop_rate = 4;
+    uint32_t res = commit_random(&tnv);
+    drop_rate = 0;
+    if (res) {
+      printf("fuzz: commit %i failed, res %i\n", c, res);
+      fails++;
+      continue;
+    }
+    if (dropped == 0) continue;
+    (*recovered)++;
+    state_get(&tnv, &ram);
+    tnv_recover(&tnv);
+    res = tnv_commit(&tnv);
+    state_get(&tnv, &s);
+    tnv_init(&loaded, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+    state_get(&loaded, &after);
+    for (i = IDS - BLOB_IDS; i < IDS; i++) {
+      ram.defined[i] = s.defined[i];
+      ram.value[i] = s.value[i];
+    }
+    if (res || !state_eq(&s, &after) || !state_eq(&s, &ram)) {
+      printf("fuzz: commit %i after dropped flash ops lost (res %i)\n", c, res);
+      state_dump("ram", &ram);
+      state_dump("expected", &s);
+      state_dump("loaded", &after);
+      fails++;
+    }
+  }
+  return fails;
+}
+
+static uint32_t ext_used(tnv_t *tnv) {
+  uint32_t i, n = 0;
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) n += tnv->ext[i].id != 0;
+  return n;
+}
+
+// getting a blob id and setting an id out of range leave the store as is
+static bool misuse(void) {
+  tnv_t tnv;
+  state_t before, s;
+  uint8_t blob[4] = { 1, 2, 3, 4 };
+  memset(flash, 0xff, sizeof(flash));
+  tnv_init(&tnv, flash, PAGE_SIZE, PAGES, fuzz_write, fuzz_erase);
+  tnv_set_blob(&tnv, IDS - 1, blob, sizeof(blob));
+  state_get(&tnv, &before);
+  uint32_t used = ext_used(&tnv);
+  uint32_t v = tnv_get(&tnv, IDS - 1, 7);
+  uint32_t res = tnv_set(&tnv, TNV_ID_MAX + 1, 7);
+  if (res != NRF_ERROR_INVALID_PARAM || ext_used(&tnv) != used) {
+    printf("fuzz: out of range set took an entry\n");
+    return FALSE;
+  }
+  state_get(&tnv, &s);
+  if (v != 7 || !state_eq(&s, &before)) {
+    printf("fuzz: blob get changed the store\n");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+int main(int argc, char **argv) {
+  uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+  uint32_t op, cut, cuts = 0, fails = 0;
+  rnd_state = seed ? seed : 1;
+  record();
+  for (op = 0; op < op_count; op++) {
+    uint32_t len = ops[op].len ? ops[op].len : PAGE_SIZE;
+    for (cut = 0; cut < len; cut++) {
+      cuts++;
+      if (!check(op, cut)) fails++;
+    }
+  }
+  printf("fuzz_tnv seed %u: %u commits, %u flash ops, %u power cuts, %u failed\n",
+      seed, COMMITS, op_count, cuts, fails);
+  uint32_t failed, lost = fail_ops(&failed);
+  printf("fuzz_tnv seed %u: %u commits, %u with failed flash ops, %u failed\n",
+      seed, COMMITS, failed, lost);
+  uint32_t recovered, unrecovered = drop_ops(&recovered);
+  printf("fuzz_tnv seed %u: %u commits, %u with dropped flash ops, %u failed\n",
+      seed, COMMITS, recovered, unrecovered);
+  lost += unrecovered;
+  if (!misuse()) lost++;
+  return fails || lost ? 1 : 0;
+}
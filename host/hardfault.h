@@ -0,0 +1,23 @@
+/*
+ * hardfault.h - host simulation stub
+ */
+
+#ifndef HARDFAULT_H__
+#define HARDFAULT_H__
+
+#include <stdint.h>
+
+typedef struct HardFault_stack {
+  uint32_t r0;
+  uint32_t r1;
+  uint32_t r2;
+  uint32_t r3;
+  uint32_t r12;
+  uint32_t lr;
+  uint32_t pc;
+  uint32_t psr;
+} HardFault_stack_t;
+
+void HardFault_process(HardFault_stack_t * p_stack);
+
+#endif // HARDFAULT_H__
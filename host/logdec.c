@@ -0,0 +1,290 @@
+/*
+ * logdec.c
+ *
+ * Decodes deferred log entries, see src/log.h, into a timeline, taking
+ * format strings from the elf the entries were logged by. Entries are
+ * read raw, as written by btlamp-sim -l, or with -x as hex text, such as
+ * CMD_LOG_READ replies or the uart dump of text command l. In hex text,
+ * two digit tokens are bytes, eight digit tokens are words, anything
+ * else is skipped, and CMD_LOG_READ reply headers are stripped.
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "app.h"
+#include "app_timer.h"
+#include "cmd.h"
+#include "log.h"
+
+#define TICK_BITS   24
+// with -r, ticks going back by up to this are entries stamped out of
+// order, by firmware stamping before taking the ring
+#define REORDER_S   1.0
+
+typedef struct {
+  uint64_t addr;
+  uint64_t size;
+  const uint8_t *data;
+} sect_t;
+
+static struct {
+  uint8_t *elf;
+  sect_t *sects;
+  uint32_t sect_count;
+  uint64_t logstr;
+  bool have_logstr;
+} img;
+
+static uint8_t *read_file(const char *name, size_t *len) {
+  FILE *f = strcmp(name, "-") == 0 ? stdin : fopen(name, "rb");
+  uint8_t *buf = NULL;
+  size_t cap = 0;
+  *len = 0;
+  if (f == NULL) {
+    perror(name);
+    exit(1);
+  }
+  for (;;) {
+    if (*len == cap) {
+      cap = cap ? cap * 2 : 65536;
+      buf = realloc(buf, cap);
+    }
+    size_t n = fread(buf + *len, 1, cap - *len, f);
+    if (n == 0) break;
+    *len += n;
+  }
+  if (f != stdin) fclose(f);
+  return buf;
+}
+
+// collects allocated sections with contents and finds __start_logstr
+#define LOAD_ELF(_ehdr, _shdr, _sym) do { \
+  _ehdr *eh = (_ehdr *)img.elf; \
+  _shdr *sh = (_shdr *)(img.elf + eh->e_shoff); \
+  uint32_t i; \
+  img.sects = calloc(eh->e_shnum, sizeof(sect_t)); \
+  for (i = 0; i < eh->e_shnum; i++) { \
+    if (sh[i].sh_type == SHT_PROGBITS && (sh[i].sh_flags & SHF_ALLOC)) { \
+      sect_t *s = &img.sects[img.sect_count++]; \
+      s->addr = sh[i].sh_addr; \
+      s->size = sh[i].sh_size; \
+      s->data = img.elf + sh[i].sh_offset; \
+    } \
+    if (sh[i].sh_type == SHT_SYMTAB) { \
+      _sym *sym = (_sym *)(img.elf + sh[i].sh_offset); \
+      const char *names = (const char *)img.elf + sh[sh[i].sh_link].sh_offset; \
+      uint32_t j; \
+      for (j = 0; j < sh[i].sh_size / sizeof(_sym); j++) { \
+        if (strcmp(names + sym[j].st_name, "__start_logstr") == 0) { \
+          img.logstr = sym[j].st_value; \
+          img.have_logstr = true; \
+        } \
+      } \
+    } \
+  } \
+} while (0)
+
+static void load_elf(const char *name) {
+  size_t len;
+  img.elf = read_file(name, &len);
+  if (len < EI_NIDENT || memcmp(img.elf, ELFMAG, SELFMAG)) {
+    fprintf(stderr, "%s: not an elf\n", name);
+    exit(1);
+  }
+  if (img.elf[EI_CLASS] == ELFCLASS64) {
+    LOAD_ELF(Elf64_Ehdr, Elf64_Shdr, Elf64_Sym);
+  } else {
+    LOAD_ELF(Elf32_Ehdr, Elf32_Shdr, Elf32_Sym);
+  }
+  if (!img.have_logstr) {
+    fprintf(stderr, "%s: no __start_logstr, not built with LOG_DEFERRED=1?\n", name);
+    exit(1);
+  }
+}
+
+// returns string at given address in the elf, or NULL
+static const char *elf_str(uint64_t addr) {
+  uint32_t i;
+  for (i = 0; i < img.sect_count; i++) {
+    sect_t *s = &img.sects[i];
+    if (addr >= s->addr && addr < s->addr + s->size &&
+        memchr(s->data + (addr - s->addr), 0, s->size - (addr - s->addr))) {
+      return (const char *)s->data + (addr - s->addr);
+    }
+  }
+  return NULL;
+}
+
+// parses hex text into bytes, words are stored little endian as on
+// target. Only tokens after the last other token of a line count, so
+// prefixes like "log:" or "sim: nus tx" are skipped.
+static uint8_t *parse_hex(uint8_t *txt, size_t len, size_t *out_len) {
+  uint8_t *out = malloc(len / 2 + 4);
+  uint8_t line[1024];
+  size_t n = 0;
+  char *save_line, *save_tok;
+  char *l;
+  txt = realloc(txt, len + 1);
+  txt[len] = 0;
+  for (l = strtok_r((char *)txt, "\n", &save_line); l; l = strtok_r(NULL, "\n", &save_line)) {
+    uint32_t ll = 0;
+    char *tok;
+    for (tok = strtok_r(l, " \t\r", &save_tok); tok; tok = strtok_r(NULL, " \t\r", &save_tok)) {
+      size_t tl = strlen(tok);
+      if ((tl != 2 && tl != 8) || strspn(tok, "0123456789abcdefABCDEF") != tl) {
+        ll = 0;
+        continue;
+      }
+      if (ll + tl / 2 > sizeof(line)) continue;
+      uint32_t v = strtoul(tok, NULL, 16);
+      uint32_t i;
+      for (i = 0; i < tl / 2; i++) line[ll++] = tl == 2 ? v : v >> (8 * i);
+    }
+    uint8_t *b = line;
+    // CMD_LOG_READ reply, header, opcode and length
+    if (ll >= CMD_HDR_LEN + 2 && (b[0] & CMD_MAGIC_MASK) == CMD_MAGIC &&
+        b[CMD_HDR_LEN] == CMD_LOG_READ) {
+      uint32_t pl = b[CMD_HDR_LEN + 1];
+      b += CMD_HDR_LEN + 2;
+      ll = pl < ll - CMD_HDR_LEN - 2 ? pl : ll - CMD_HDR_LEN - 2;
+    }
+    memcpy(out + n, b, ll);
+    n += ll;
+  }
+  *out_len = n;
+  return out;
+}
+
+static uint32_t word(const uint8_t *b) {
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+// formats one entry with the host printf, a conversion at a time
+static void format(const char *fmt, const uint32_t *arg, uint32_t args) {
+  char spec[32];
+  uint32_t a = 0;
+  while (*fmt) {
+    if (*fmt != '%') {
+      if (*fmt != '\n' || fmt[1]) putchar(*fmt == '\n' ? ' ' : *fmt);
+      fmt++;
+      continue;
+    }
+    const char *s = fmt++;
+    while (*fmt && strchr("-+ #0123456789.l", *fmt)) fmt++;
+    if (*fmt == 0) break;
+    char conv = *fmt++;
+    if (conv == '%') {
+      putchar('%');
+      continue;
+    }
+    size_t sl = fmt - s;
+    if (sl >= sizeof(spec)) sl = sizeof(spec) - 1;
+    memcpy(spec, s, sl);
+    spec[sl] = 0;
+    // drop length modifiers, arguments are 32 bits
+    char *l;
+    while ((l = strchr(spec, 'l'))) memmove(l, l + 1, strlen(l));
+    if (a >= args) {
+      printf("<?>");
+      continue;
+    }
+    uint32_t v = arg[a++];
+    if (conv == 's') {
+      const char *str = elf_str(v);
+      if (str) printf(spec, str);
+      else printf("<%08x>", v);
+    } else if (conv == 'c') {
+      printf(spec, (int)(v & 0xff));
+    } else if (strchr("di", conv)) {
+      printf(spec, (int32_t)v);
+    } else {
+      printf(spec, v);
+    }
+  }
+  putchar('\n');
+}
+
+static void usage(const char *prg) {
+  fprintf(stderr,
+      "usage: %s [-x] [-r] [-f hz] elf [file]\n"
+      "  -x  entries are hex text\n"
+      "  -r  small steps back in time are reordering, not wraps, for logs\n"
+      "      of firmware stamping entries outside the critical region\n"
+      "  -f  app timer frequency, default %u\n"
+      "reads entries from stdin if no file or -\n", prg, APP_TIMER_CLOCK_FREQ);
+}
+
+int main(int argc, char **argv) {
+  bool hex = false;
+  bool reorder = false;
+  double hz = APP_TIMER_CLOCK_FREQ;
+  int opt;
+  while ((opt = getopt(argc, argv, "xrf:h")) != -1) {
+    switch (opt) {
+    case 'x': hex = true; break;
+    case 'r': reorder = true; break;
+    case 'f': hz = atof(optarg); break;
+    default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+  load_elf(argv[optind++]);
+  size_t len;
+  uint8_t *d = read_file(optind < argc ? argv[optind] : "-", &len);
+  if (hex) d = parse_hex(d, len, &len);
+
+  size_t pos = 0;
+  uint32_t entries = 0, lost = 0, reordered = 0, last_tick = 0;
+  int64_t t = 0, t_prev = 0;
+  int seq = -1;
+  printf("%12s %10s %4s  %s\n", "time s", "delta ms", "seq", "entry");
+  while (pos + 4 * LOG_HDR_WORDS <= len) {
+    uint32_t hdr = word(&d[pos]);
+    uint32_t tick = word(&d[pos + 4]) & ((1 << TICK_BITS) - 1);
+    uint32_t args = LOG_ENTRY_ARGS(hdr);
+    uint32_t arg[LOG_ARGS_MAX];
+    uint32_t i;
+    if (args > LOG_ARGS_MAX || pos + 4 * (LOG_HDR_WORDS + args) > len) {
+      fprintf(stderr, "bad entry at byte %zu\n", pos);
+      break;
+    }
+    for (i = 0; i < args; i++) arg[i] = word(&d[pos + 4 * (LOG_HDR_WORDS + i)]);
+    pos += 4 * (LOG_HDR_WORDS + args);
+
+    if (seq >= 0 && LOG_ENTRY_SEQ(hdr) != ((seq + 1) & 0xff)) {
+      uint32_t gap = (LOG_ENTRY_SEQ(hdr) - seq - 1) & 0xff;
+      printf("%12s %10s %4s  -- %u entries lost --\n", "", "", "", gap);
+      lost += gap;
+    }
+    seq = LOG_ENTRY_SEQ(hdr);
+    // the tick counter wraps, entries are in order
+    uint32_t dt = (tick - last_tick) & ((1 << TICK_BITS) - 1);
+    if (entries == 0) {
+      t = tick;
+    } else if (reorder && dt > (1 << TICK_BITS) - REORDER_S * hz) {
+      t -= (1 << TICK_BITS) - dt;
+      reordered++;
+    } else {
+      t += dt;
+    }
+    last_tick = tick;
+
+    const char *fmt = elf_str(img.logstr + LOG_ENTRY_ID(hdr));
+    printf("%12.6f %10.3f %4u  ", t / hz, entries ? (t - t_prev) * 1000 / hz : 0.0, seq);
+    if (fmt) format(fmt, arg, args);
+    else printf("<unknown format %04x>\n", LOG_ENTRY_ID(hdr));
+    t_prev = t;
+    entries++;
+  }
+  fprintf(stderr, "%u entries, %u lost, %u out of order\n", entries, lost, reordered);
+  return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * nrf_drv_ppi.h - host simulation stub
+ *
+ * Channels connect an event address to a task address and a fork task,
+ * the simulator triggers the tasks of all enabled channels when the
+ * event occurs. Addresses come from the spi and timer stubs.
+ */
+
+#ifndef NRF_DRV_PPI_H__
+#define NRF_DRV_PPI_H__
+
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+typedef uint8_t nrf_ppi_channel_t;
+typedef uint8_t nrf_ppi_channel_group_t;
+
+uint32_t nrf_drv_ppi_init(void);
+
+uint32_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t * p_channel);
+uint32_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep);
+uint32_t nrf_drv_ppi_channel_fork_assign(nrf_ppi_channel_t channel, uint32_t fork_tep);
+uint32_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel);
+uint32_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel);
+
+uint32_t nrf_drv_ppi_group_alloc(nrf_ppi_channel_group_t * p_group);
+uint32_t nrf_drv_ppi_channel_include_in_group(nrf_ppi_channel_t channel,
+                                              nrf_ppi_channel_group_t group);
+uint32_t nrf_drv_ppi_group_enable(nrf_ppi_channel_group_t group);
+uint32_t nrf_drv_ppi_group_disable(nrf_ppi_channel_group_t group);
+// tasks enabling or disabling all channels of a group
+uint32_t nrf_drv_ppi_task_addr_group_enable_get(nrf_ppi_channel_group_t group);
+uint32_t nrf_drv_ppi_task_addr_group_disable_get(nrf_ppi_channel_group_t group);
+
+#endif // NRF_DRV_PPI_H__
@@ -0,0 +1,106 @@
+/*
+ * nrf_drv_spi.h - host simulation stub
+ *
+ * Transfers are captured by the simulator, see sim.h. The transfer
+ * completes after the time it would take to clock out the buffer at
+ * the configured frequency. Start task and end event can be wired with
+ * ppi, see nrf_drv_ppi.h.
+ */
+
+#ifndef NRF_DRV_SPI_H__
+#define NRF_DRV_SPI_H__
+
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+#define SPI_DEFAULT_CONFIG_IRQ_PRIORITY   7
+#define NRF_DRV_SPI_PIN_NOT_USED          0xFF
+
+typedef struct {
+  uint8_t drv_inst_idx;
+} nrf_drv_spi_t;
+
+#define NRF_DRV_SPI_INSTANCE(id) { .drv_inst_idx = (id) }
+
+// frequencies are given in kbps on the host
+typedef enum {
+  NRF_DRV_SPI_FREQ_125K = 125,
+  NRF_DRV_SPI_FREQ_250K = 250,
+  NRF_DRV_SPI_FREQ_500K = 500,
+  NRF_DRV_SPI_FREQ_1M   = 1000,
+  NRF_DRV_SPI_FREQ_2M   = 2000,
+  NRF_DRV_SPI_FREQ_4M   = 4000,
+  NRF_DRV_SPI_FREQ_8M   = 8000
+} nrf_drv_spi_frequency_t;
+
+typedef enum {
+  NRF_DRV_SPI_MODE_0,
+  NRF_DRV_SPI_MODE_1,
+  NRF_DRV_SPI_MODE_2,
+  NRF_DRV_SPI_MODE_3
+} nrf_drv_spi_mode_t;
+
+typedef enum {
+  NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
+  NRF_DRV_SPI_BIT_ORDER_LSB_FIRST
+} nrf_drv_spi_bit_order_t;
+
+typedef struct {
+  uint8_t sck_pin;
+  uint8_t mosi_pin;
+  uint8_t miso_pin;
+  uint8_t ss_pin;
+  uint8_t irq_priority;
+  uint8_t orc;
+  nrf_drv_spi_frequency_t frequency;
+  nrf_drv_spi_mode_t mode;
+  nrf_drv_spi_bit_order_t bit_order;
+} nrf_drv_spi_config_t;
+
+typedef enum {
+  NRF_DRV_SPI_EVENT_DONE
+} nrf_drv_spi_evt_type_t;
+
+typedef struct {
+  uint8_t const * p_tx_buffer;
+  uint8_t tx_length;
+  uint8_t * p_rx_buffer;
+  uint8_t rx_length;
+} nrf_drv_spi_xfer_desc_t;
+
+typedef struct {
+  nrf_drv_spi_evt_type_t type;
+  union {
+    nrf_drv_spi_xfer_desc_t done;
+  } data;
+} nrf_drv_spi_evt_t;
+
+// tx buffer pointer advances by the length after each transfer
+#define NRF_DRV_SPI_FLAG_TX_POSTINC          (1UL << 0)
+#define NRF_DRV_SPI_FLAG_RX_POSTINC          (1UL << 1)
+// no interrupt and no handler call at the end of the transfer
+#define NRF_DRV_SPI_FLAG_NO_XFER_EVT_HANDLER (1UL << 2)
+// set up only, started by the start task
+#define NRF_DRV_SPI_FLAG_HOLD_XFER           (1UL << 3)
+#define NRF_DRV_SPI_FLAG_REPEATED_XFER       (1UL << 4)
+
+typedef void (*nrf_drv_spi_handler_t)(nrf_drv_spi_evt_t const * p_event);
+
+ret_code_t nrf_drv_spi_init(nrf_drv_spi_t const * const p_instance,
+                            nrf_drv_spi_config_t const * p_config,
+                            nrf_drv_spi_handler_t handler);
+
+ret_code_t nrf_drv_spi_transfer(nrf_drv_spi_t const * const p_instance,
+                                uint8_t const * p_tx_buffer,
+                                uint8_t tx_buffer_length,
+                                uint8_t * p_rx_buffer,
+                                uint8_t rx_buffer_length);
+
+ret_code_t nrf_drv_spi_xfer(nrf_drv_spi_t const * const p_instance,
+                            nrf_drv_spi_xfer_desc_t const * p_xfer_desc,
+                            uint32_t flags);
+
+uint32_t nrf_drv_spi_start_task_get(nrf_drv_spi_t const * p_instance);
+uint32_t nrf_drv_spi_end_event_get(nrf_drv_spi_t const * p_instance);
+
+#endif // NRF_DRV_SPI_H__
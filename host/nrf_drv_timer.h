@@ -0,0 +1,96 @@
+/*
+ * nrf_drv_timer.h - host simulation stub
+ *
+ * Only counter mode is simulated, the counter advances on its count
+ * task, see nrf_drv_ppi.h. Compare events go to ppi and, when enabled,
+ * to the handler.
+ */
+
+#ifndef NRF_DRV_TIMER_H__
+#define NRF_DRV_TIMER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+typedef struct {
+  uint8_t instance_id;
+} nrf_drv_timer_t;
+
+#define NRF_DRV_TIMER_INSTANCE(id) { .instance_id = (id) }
+
+typedef enum {
+  NRF_TIMER_MODE_TIMER,
+  NRF_TIMER_MODE_COUNTER
+} nrf_timer_mode_t;
+
+typedef enum {
+  NRF_TIMER_BIT_WIDTH_16,
+  NRF_TIMER_BIT_WIDTH_8,
+  NRF_TIMER_BIT_WIDTH_24,
+  NRF_TIMER_BIT_WIDTH_32
+} nrf_timer_bit_width_t;
+
+typedef enum {
+  NRF_TIMER_FREQ_16MHz
+} nrf_timer_frequency_t;
+
+// register offsets as on the chip
+typedef enum {
+  NRF_TIMER_TASK_START = 0x000,
+  NRF_TIMER_TASK_STOP  = 0x004,
+  NRF_TIMER_TASK_COUNT = 0x008,
+  NRF_TIMER_TASK_CLEAR = 0x00C
+} nrf_timer_task_t;
+
+typedef enum {
+  NRF_TIMER_EVENT_COMPARE0 = 0x140,
+  NRF_TIMER_EVENT_COMPARE1 = 0x144,
+  NRF_TIMER_EVENT_COMPARE2 = 0x148,
+  NRF_TIMER_EVENT_COMPARE3 = 0x14C
+} nrf_timer_event_t;
+
+typedef enum {
+  NRF_TIMER_CC_CHANNEL0,
+  NRF_TIMER_CC_CHANNEL1,
+  NRF_TIMER_CC_CHANNEL2,
+  NRF_TIMER_CC_CHANNEL3
+} nrf_timer_cc_channel_t;
+
+typedef struct {
+  nrf_timer_frequency_t frequency;
+  nrf_timer_mode_t mode;
+  nrf_timer_bit_width_t bit_width;
+  uint8_t interrupt_priority;
+  void * p_context;
+} nrf_drv_timer_config_t;
+
+#define NRF_DRV_TIMER_DEFAULT_CONFIG { \
+  .frequency          = NRF_TIMER_FREQ_16MHz, \
+  .mode               = NRF_TIMER_MODE_TIMER, \
+  .bit_width          = NRF_TIMER_BIT_WIDTH_16, \
+  .interrupt_priority = 6, \
+  .p_context          = NULL }
+
+typedef void (*nrf_timer_event_handler_t)(nrf_timer_event_t event_type, void * p_context);
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const * const p_instance,
+                              nrf_drv_timer_config_t const * p_config,
+                              nrf_timer_event_handler_t timer_event_handler);
+
+void nrf_drv_timer_enable(nrf_drv_timer_t const * const p_instance);
+void nrf_drv_timer_disable(nrf_drv_timer_t const * const p_instance);
+void nrf_drv_timer_clear(nrf_drv_timer_t const * const p_instance);
+
+uint32_t nrf_drv_timer_task_address_get(nrf_drv_timer_t const * const p_instance,
+                                        nrf_timer_task_t timer_task);
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const * const p_instance,
+                                                 nrf_timer_cc_channel_t channel);
+
+void nrf_drv_timer_compare(nrf_drv_timer_t const * const p_instance,
+                           nrf_timer_cc_channel_t cc_channel,
+                           uint32_t cc_value,
+                           bool enable_int);
+
+#endif // NRF_DRV_TIMER_H__
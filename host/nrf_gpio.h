@@ -0,0 +1,10 @@
+/*
+ * nrf_gpio.h - host simulation stub
+ */
+
+#ifndef NRF_GPIO_H__
+#define NRF_GPIO_H__
+
+#include "nordic_common.h"
+
+#endif // NRF_GPIO_H__
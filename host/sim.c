@@ -0,0 +1,1096 @@
+/*
+ * sim.c
+ *
+ * Host simulation of the lamp, stub implementations of the nrf drivers
+ * used by the application and a simple event loop on simulated time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+#include "app_timer.h"
+#include "app_uart.h"
+#include "ble_flash.h"
+#include "nrf_drv_spi.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
+#include "softdevice_handler.h"
+#include "fstorage.h"
+#include "app.h"
+
+// miniutils.h clashes with libc headers
+unsigned short crc_ccitt_16(unsigned short crc, unsigned char data);
+
+#define SIM_TIMERS                16
+#define SIM_TIM_INSTANCES         5
+#define SIM_TIM_CC                4
+#define SIM_PPI_CHANNELS          20
+#define SIM_PPI_GROUPS            6
+// as FS_QUEUE_SIZE in sdk_config.h
+#define SIM_FS_QUEUE              8
+
+#define TICKS_TO_NS(t) \
+  (((uint64_t)(t) * 1000000000ULL) / APP_TIMER_CLOCK_FREQ)
+#define NS_TO_TICKS(t) \
+  (((uint64_t)(t) * APP_TIMER_CLOCK_FREQ) / 1000000000ULL)
+#define BITS_TO_NS(b, kbps) \
+  (((uint64_t)(b) * 1000000ULL) / (kbps))
+#define NS_TO_BITS(t, kbps) \
+  (((uint64_t)(t) * (kbps)) / 1000000ULL)
+
+// peripheral addresses, only used to route ppi, with register offsets
+// as on the chip
+#define SIM_SPI_ADDR(i)           (0x40003000 + (i) * 0x1000)
+#define SIM_TIM_ADDR(i)           (0x40008000 + (i) * 0x1000)
+#define SIM_PPI_ADDR              0x4001f000
+#define SIM_SPI_TASK_START        0x010
+#define SIM_SPI_EVENT_END         0x118
+#define SIM_PERIPH_SIZE           0x1000
+
+// events picked by the event loop
+#define SIM_EV_NONE               0
+#define SIM_EV_SPI_END            1
+#define SIM_EV_SPI_IRQ            2
+#define SIM_EV_TIM_IRQ            3
+#define SIM_EV_TIMER              4
+#define SIM_EV_CONN               5
+#define SIM_EV_FS                 6
+
+// connection event phases, radio notification, radio on, radio off
+#define CONN_NOTIFY               0
+#define CONN_RADIO                1
+#define CONN_DONE                 2
+
+typedef struct {
+  uint64_t t_ns;
+  uint16_t len;
+  uint8_t data[256];
+} sim_nus_write_t;
+
+typedef struct {
+  fs_config_t const *cfg;
+  bool erase;
+  uint32_t *dest;
+  uint32_t const *src;
+  uint16_t words;
+  void *ctx;
+} sim_fs_op_t;
+
+typedef struct {
+  uint8_t inst;
+  bool inited;
+  bool busy;
+  uint32_t kbps;
+  // current transfer, the pointer advances after it with postinc
+  nrf_drv_spi_xfer_desc_t xfer;
+  uint32_t flags;
+  uint64_t end_ns;
+  uint64_t last_end_ns;
+  uint64_t last_low_ns;
+  int32_t frame_ix;
+  nrf_drv_spi_handler_t handler;
+  nrf_drv_spi_evt_t evt;
+  // end interrupt waiting for the handler
+  bool irq;
+  uint64_t irq_ns;
+} sim_spi_t;
+
+typedef struct {
+  bool inited;
+  bool running;
+  uint32_t count;
+  uint32_t cc[SIM_TIM_CC];
+  uint32_t int_mask;
+  nrf_timer_event_handler_t handler;
+  void *p_context;
+  // compare channels waiting for the handler
+  uint32_t irq_mask;
+  uint64_t irq_ns;
+} sim_tim_t;
+
+typedef struct {
+  bool used;
+  bool enabled;
+  uint32_t eep;
+  uint32_t tep;
+  uint32_t fork_tep;
+} sim_ppi_t;
+
+static struct {
+  uint64_t now;
+  app_timer_t *timers[SIM_TIMERS];
+  uint32_t timer_count;
+  sim_spi_t spi[SIM_SPI_INSTANCES];
+  sim_tim_t tim[SIM_TIM_INSTANCES];
+  sim_ppi_t ppi[SIM_PPI_CHANNELS];
+  bool ppi_inited;
+  uint32_t ppi_groups[SIM_PPI_GROUPS];
+  uint32_t ppi_groups_used;
+  bool sd_enabled;
+  bool connected;
+  bool app_inited;
+  uint8_t *flash;
+  sim_frame_t *frames;
+  uint32_t frame_count;
+  uint32_t frame_cap;
+  // connection events, anchor is when the radio is on
+  uint64_t conn_interval_ns;
+  uint16_t conn_latency;
+  uint64_t conn_pend_interval_ns;
+  uint16_t conn_pend_latency;
+  uint64_t conn_anchor_ns;
+  uint64_t conn_on_ns;
+  uint8_t conn_phase;
+  bool nus_tx_pending;
+  sim_nus_write_t *nus_q;
+  uint32_t nus_q_count;
+  uint32_t nus_q_cap;
+  // fstorage queue, head op runs at fs_due_ns
+  bool fs_inited;
+  sim_fs_op_t fs_q[SIM_FS_QUEUE];
+  uint32_t fs_q_count;
+  uint64_t fs_due_ns;
+  uint32_t fs_fail;
+  uint64_t conn_last_ns;
+  sim_flash_op_t *flash_ops;
+  uint32_t flash_op_count;
+  uint32_t flash_op_cap;
+  sim_stats_t stats;
+} sim;
+
+#ifndef NRF_BLE_MAX_MTU_SIZE
+#define NRF_BLE_MAX_MTU_SIZE      23
+#endif
+
+sim_config_t sim_config = {
+  .att_mtu = 247,
+  .rng_seed = 0x12312312,
+};
+
+static void sim_fail(const char *msg, uint32_t arg) {
+  fprintf(stderr, "sim: %s (%08x) @ %llu ns\n", msg, arg,
+          (unsigned long long)sim.now);
+  abort();
+}
+
+static void *sim_grow(void *arr, uint32_t *cap, uint32_t count, size_t elem) {
+  if (count < *cap) return arr;
+  *cap = *cap ? *cap * 2 : 64;
+  arr = realloc(arr, *cap * elem);
+  if (arr == NULL) sim_fail("out of memory", count);
+  return arr;
+}
+
+//
+// flash
+//
+
+static void sim_flash_init(void) {
+  if (sim.flash) return;
+  size_t len = BLE_FLASH_PAGE_END * BLE_FLASH_PAGE_SIZE - SIM_FLASH_BASE;
+  void *p = mmap((void *)SIM_FLASH_BASE, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (p != (void *)SIM_FLASH_BASE) sim_fail("cannot map flash", SIM_FLASH_BASE);
+  sim.flash = p;
+  memset(sim.flash, 0xff, len);
+}
+
+static void sim_flash_log(uint32_t addr, uint32_t len) {
+  sim.flash_ops = sim_grow(sim.flash_ops, &sim.flash_op_cap,
+                           sim.flash_op_count, sizeof(sim_flash_op_t));
+  sim_flash_op_t *op = &sim.flash_ops[sim.flash_op_count++];
+  op->t_ns = sim.now;
+  op->addr = addr;
+  op->len = len;
+}
+
+uint32_t ble_flash_page_erase(uint8_t page_num) {
+  if (sim.sd_enabled) sim_fail("flash erase with softdevice enabled", page_num);
+  if (page_num >= BLE_FLASH_PAGE_END ||
+      page_num < SIM_FLASH_BASE / BLE_FLASH_PAGE_SIZE) {
+    return NRF_ERROR_INVALID_ADDR;
+  }
+  memset((uint8_t *)((uintptr_t)page_num * BLE_FLASH_PAGE_SIZE), 0xff,
+         BLE_FLASH_PAGE_SIZE);
+  sim.now += SIM_FLASH_ERASE_PAGE_NS;
+  sim.stats.flash_erases++;
+  sim.stats.flash_page_erases[page_num]++;
+  sim_flash_log(page_num * BLE_FLASH_PAGE_SIZE, 0);
+  return NRF_SUCCESS;
+}
+
+uint32_t ble_flash_block_write(uint32_t * p_address, uint32_t * p_in_array,
+                               uint16_t word_count) {
+  uintptr_t addr = (uintptr_t)p_address;
+  if (sim.sd_enabled) sim_fail("flash write with softdevice enabled", addr);
+  if ((addr & 3) || addr < SIM_FLASH_BASE ||
+      addr + word_count * 4 > BLE_FLASH_PAGE_END * BLE_FLASH_PAGE_SIZE) {
+    return NRF_ERROR_INVALID_ADDR;
+  }
+  uint16_t i;
+  for (i = 0; i < word_count; i++) {
+    // nor flash, bits can only be cleared
+    p_address[i] &= p_in_array[i];
+  }
+  sim.now += word_count * SIM_FLASH_WRITE_WORD_NS;
+  sim.stats.flash_writes++;
+  sim.stats.flash_bytes += word_count * 4;
+  sim_flash_log(addr, word_count * 4);
+  return NRF_SUCCESS;
+}
+
+// fstorage, operations run with the softdevice enabled and stall the cpu
+
+fs_ret_t fs_init(void) {
+  sim.fs_inited = true;
+  return FS_SUCCESS;
+}
+
+static fs_ret_t sim_fs_queue(fs_config_t const *cfg, bool erase, uint32_t const *dest,
+                             uint32_t const *src, uint16_t words, void *ctx) {
+  if (!sim.fs_inited) return FS_ERR_NOT_INITIALIZED;
+  if (cfg == NULL || cfg->callback == NULL) return FS_ERR_INVALID_CFG;
+  if ((uintptr_t)dest & 3) return FS_ERR_UNALIGNED_ADDR;
+  // pages are handed out from end of flash
+  uintptr_t lo = (BLE_FLASH_PAGE_END - cfg->num_pages) * BLE_FLASH_PAGE_SIZE;
+  uintptr_t hi = BLE_FLASH_PAGE_END * BLE_FLASH_PAGE_SIZE;
+  if ((uintptr_t)dest < lo || (uintptr_t)dest + words * 4 > hi) return FS_ERR_INVALID_ADDR;
+  if (sim.fs_q_count >= SIM_FS_QUEUE) return FS_ERR_QUEUE_FULL;
+  if (sim.fs_q_count == 0) sim.fs_due_ns = sim.now;
+  sim_fs_op_t *op = &sim.fs_q[sim.fs_q_count++];
+  op->cfg = cfg;
+  op->erase = erase;
+  op->dest = (uint32_t *)dest;
+  op->src = src;
+  op->words = words;
+  op->ctx = ctx;
+  return FS_SUCCESS;
+}
+
+fs_ret_t fs_store(fs_config_t const * p_config, uint32_t const * p_dest,
+                  uint32_t const * p_src, uint16_t length_words, void * p_context) {
+  if (p_src == NULL) return FS_ERR_NULL_ARG;
+  if (length_words == 0) return FS_ERR_INVALID_ARG;
+  return sim_fs_queue(p_config, false, p_dest, p_src, length_words, p_context);
+}
+
+fs_ret_t fs_erase(fs_config_t const * p_config, uint32_t const * p_page_addr,
+                  uint16_t num_pages, void * p_context) {
+  if ((uintptr_t)p_page_addr & (BLE_FLASH_PAGE_SIZE - 1)) return FS_ERR_UNALIGNED_ADDR;
+  if (num_pages == 0) return FS_ERR_INVALID_ARG;
+  return sim_fs_queue(p_config, true, p_page_addr, NULL,
+                      num_pages * BLE_FLASH_PAGE_SIZE / 4, p_context);
+}
+
+// Runs the operation at head of queue, source data is read when it runs.
+static void sim_fs_run(void) {
+  sim_fs_op_t op = sim.fs_q[0];
+  fs_evt_t evt;
+  uint16_t i;
+  uintptr_t addr = (uintptr_t)op.dest;
+  fs_ret_t res = FS_SUCCESS;
+  memset(&evt, 0, sizeof(evt));
+  evt.p_context = op.ctx;
+  if (sim.fs_fail) {
+    sim.fs_fail--;
+    res = FS_ERR_OPERATION_TIMEOUT;
+    evt.id = op.erase ? FS_EVT_ERASE : FS_EVT_STORE;
+  } else if (op.erase) {
+    memset(op.dest, 0xff, op.words * 4);
+    sim.now += (op.words * 4 / BLE_FLASH_PAGE_SIZE) * SIM_FLASH_ERASE_PAGE_NS;
+    for (i = 0; i < op.words * 4 / BLE_FLASH_PAGE_SIZE; i++) {
+      sim.stats.flash_erases++;
+      sim.stats.flash_page_erases[addr / BLE_FLASH_PAGE_SIZE + i]++;
+      sim_flash_log(addr + i * BLE_FLASH_PAGE_SIZE, 0);
+    }
+    evt.id = FS_EVT_ERASE;
+    evt.erase.first_page = addr / BLE_FLASH_PAGE_SIZE;
+    evt.erase.last_page = evt.erase.first_page + op.words * 4 / BLE_FLASH_PAGE_SIZE - 1;
+  } else {
+    for (i = 0; i < op.words; i++) {
+      // nor flash, bits can only be cleared
+      op.dest[i] &= op.src[i];
+    }
+    sim.now += op.words * SIM_FLASH_WRITE_WORD_NS;
+    sim.stats.flash_writes++;
+    sim.stats.flash_bytes += op.words * 4;
+    sim_flash_log(addr, op.words * 4);
+    evt.id = FS_EVT_STORE;
+    evt.store.p_data = op.dest;
+    evt.store.length_words = op.words;
+  }
+  memmove(&sim.fs_q[0], &sim.fs_q[1], --sim.fs_q_count * sizeof(sim_fs_op_t));
+  sim.fs_due_ns = sim.now;
+  op.cfg->callback(&evt, res);
+}
+
+void sim_flash_fail(uint32_t ops) {
+  sim.fs_fail = ops;
+}
+
+uint8_t *sim_flash_page(uint32_t page) {
+  sim_flash_init();
+  return (uint8_t *)((uintptr_t)page * BLE_FLASH_PAGE_SIZE);
+}
+
+uint32_t sim_flash_op_count(void) {
+  return sim.flash_op_count;
+}
+
+const sim_flash_op_t *sim_flash_op(uint32_t ix) {
+  return ix < sim.flash_op_count ? &sim.flash_ops[ix] : NULL;
+}
+
+//
+// softdevice
+//
+
+uint32_t softdevice_handler_sd_disable(void) {
+  if (!sim.sd_enabled) return NRF_ERROR_INVALID_STATE;
+  sim.sd_enabled = false;
+  sim.stats.sd_disables++;
+  if (sim.connected) {
+    // link is gone without any events
+    sim.connected = false;
+    sim.nus_q_count = 0;
+    sim.stats.link_drops++;
+  }
+  return NRF_SUCCESS;
+}
+
+bool softdevice_handler_is_enabled(void) {
+  return sim.sd_enabled;
+}
+
+// as in main.c
+void start_softdevice(void) {
+  if (sim.sd_enabled) sim_fail("softdevice already enabled", 0);
+  sim.sd_enabled = true;
+  sim.stats.sd_enables++;
+  if (!sim.app_inited) {
+    sim.app_inited = true;
+    app_init();
+  }
+}
+
+// as in main.c, parameters take effect from next connection event
+void conn_params_set(bool fast) {
+  if (!sim.connected) return;
+  sim.conn_pend_interval_ns = (fast ? CONN_FAST_MAX_MS : CONN_IDLE_MAX_MS) * 1000000ULL;
+  sim.conn_pend_latency = fast ? 0 : CONN_IDLE_LATENCY;
+  sim.stats.conn_updates++;
+}
+
+uint32_t sim_conn_interval_us(void) {
+  return sim.conn_interval_ns / 1000;
+}
+
+uint16_t sim_conn_latency(void) {
+  return sim.conn_latency;
+}
+
+//
+// uart
+//
+
+uint32_t app_uart_put(uint8_t byte) {
+  sim.stats.uart_bytes++;
+  if (sim_config.uart_echo) putchar(byte);
+  return NRF_SUCCESS;
+}
+
+uint32_t app_uart_get(uint8_t * p_byte) {
+  return NRF_ERROR_NOT_FOUND;
+}
+
+//
+// timers
+//
+
+uint32_t app_timer_create(app_timer_id_t const * p_timer_id,
+                          app_timer_mode_t mode,
+                          app_timer_timeout_handler_t timeout_handler) {
+  if (timeout_handler == NULL) return NRF_ERROR_INVALID_PARAM;
+  app_timer_t *t = *p_timer_id;
+  if (t->created) return NRF_ERROR_INVALID_STATE;
+  if (sim.timer_count >= SIM_TIMERS) return NRF_ERROR_NO_MEM;
+  memset(t, 0, sizeof(*t));
+  t->handler = timeout_handler;
+  t->mode = mode;
+  t->created = true;
+  sim.timers[sim.timer_count++] = t;
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context) {
+  if (timeout_ticks < APP_TIMER_MIN_TIMEOUT_TICKS) return NRF_ERROR_INVALID_PARAM;
+  if (!timer_id->created) return NRF_ERROR_INVALID_STATE;
+  // as the sdk, starting a running timer is ignored
+  if (timer_id->running) return NRF_SUCCESS;
+  timer_id->running = true;
+  timer_id->period = timeout_ticks;
+  timer_id->p_context = p_context;
+  timer_id->expiry_ns = sim.now + TICKS_TO_NS(timeout_ticks);
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_stop(app_timer_id_t timer_id) {
+  if (!timer_id->created) return NRF_ERROR_INVALID_STATE;
+  timer_id->running = false;
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(uint32_t * p_ticks) {
+  // rtc counter is 24 bits
+  *p_ticks = NS_TO_TICKS(sim.now) & 0x00ffffff;
+  return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from, uint32_t * p_ticks_diff) {
+  *p_ticks_diff = (ticks_to - ticks_from) & 0x00ffffff;
+  return NRF_SUCCESS;
+}
+
+//
+// spi
+//
+
+static void sim_task(uint32_t addr);
+static void sim_ppi_event(uint32_t eep);
+
+// raises an interrupt, the handler runs after the configured latency
+static uint64_t sim_irq_ns(void) {
+  return sim.now + sim_config.irq_latency_ns;
+}
+
+ret_code_t nrf_drv_spi_init(nrf_drv_spi_t const * const p_instance,
+                            nrf_drv_spi_config_t const * p_config,
+                            nrf_drv_spi_handler_t handler) {
+  if (p_instance->drv_inst_idx >= SIM_SPI_INSTANCES) return NRF_ERROR_INVALID_PARAM;
+  sim_spi_t *s = &sim.spi[p_instance->drv_inst_idx];
+  if (s->inited) return NRF_ERROR_INVALID_STATE;
+  memset(s, 0, sizeof(*s));
+  s->inst = p_instance->drv_inst_idx;
+  s->inited = true;
+  s->kbps = p_config->frequency;
+  s->handler = handler;
+  s->frame_ix = -1;
+  return NRF_SUCCESS;
+}
+
+// clocks out the current transfer
+static void sim_spi_start(sim_spi_t *s) {
+  if (s->busy) sim_fail("spi started while busy", s->inst);
+  uint8_t const *p_tx_buffer = s->xfer.p_tx_buffer;
+  uint8_t tx_buffer_length = s->xfer.tx_length;
+  uint64_t low_ns = s->last_low_ns + (sim.now - s->last_end_ns);
+  sim_frame_t *f;
+  if (s->frame_ix >= 0 && low_ns < SIM_WS2812B_RESET_NS) {
+    // no latch in between, continuation of previous frame
+    f = &sim.frames[s->frame_ix];
+  } else {
+    // the previous transfer did not end in a reset, the strip latched a
+    // partial frame while waiting for this one
+    if (s->frame_ix >= 0 && s->last_low_ns < SIM_WS2812B_RESET_NS) {
+      sim_fail("strip latched mid frame", s->inst);
+    }
+    sim.frames = sim_grow(sim.frames, &sim.frame_cap, sim.frame_count,
+                          sizeof(sim_frame_t));
+    s->frame_ix = sim.frame_count++;
+    f = &sim.frames[s->frame_ix];
+    memset(f, 0, sizeof(*f));
+    f->inst = s->inst;
+    f->t_start_ns = sim.now;
+  }
+  f->data = realloc(f->data, f->len + tx_buffer_length);
+  if (f->data == NULL) sim_fail("out of memory", f->len);
+  memcpy(&f->data[f->len], p_tx_buffer, tx_buffer_length);
+  f->len += tx_buffer_length;
+  f->transfers++;
+
+  // time line is low at end of transfer
+  uint32_t low_bits = 0;
+  int32_t i;
+  for (i = tx_buffer_length - 1; i >= 0 && p_tx_buffer[i] == 0; i--) {
+    low_bits += 8;
+  }
+  if (i >= 0) low_bits += __builtin_ctz(p_tx_buffer[i]);
+  else low_bits += NS_TO_BITS(s->last_low_ns, s->kbps);
+  s->last_low_ns = BITS_TO_NS(low_bits, s->kbps);
+
+  s->busy = true;
+  s->end_ns = sim.now + BITS_TO_NS(tx_buffer_length * 8, s->kbps);
+  f->t_end_ns = s->end_ns;
+  sim.stats.spi_transfers++;
+  sim.stats.spi_bytes += tx_buffer_length;
+}
+
+static void sim_spi_end(sim_spi_t *s) {
+  s->busy = false;
+  s->last_end_ns = s->end_ns;
+  if ((s->flags & NRF_DRV_SPI_FLAG_NO_XFER_EVT_HANDLER) == 0) {
+    s->evt.type = NRF_DRV_SPI_EVENT_DONE;
+    s->evt.data.done = s->xfer;
+    s->irq = true;
+    s->irq_ns = sim_irq_ns();
+  }
+  if (s->flags & NRF_DRV_SPI_FLAG_TX_POSTINC) {
+    s->xfer.p_tx_buffer += s->xfer.tx_length;
+  }
+  sim_ppi_event(SIM_SPI_ADDR(s->inst) + SIM_SPI_EVENT_END);
+}
+
+ret_code_t nrf_drv_spi_xfer(nrf_drv_spi_t const * const p_instance,
+                            nrf_drv_spi_xfer_desc_t const * p_xfer_desc,
+                            uint32_t flags) {
+  if (p_instance->drv_inst_idx >= SIM_SPI_INSTANCES) return NRF_ERROR_INVALID_PARAM;
+  sim_spi_t *s = &sim.spi[p_instance->drv_inst_idx];
+  if (!s->inited) return NRF_ERROR_INVALID_STATE;
+  if (s->busy) {
+    sim.stats.spi_busy++;
+    return NRF_ERROR_BUSY;
+  }
+  s->xfer = *p_xfer_desc;
+  s->flags = flags;
+  if ((flags & NRF_DRV_SPI_FLAG_HOLD_XFER) == 0) sim_spi_start(s);
+  return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_spi_transfer(nrf_drv_spi_t const * const p_instance,
+                                uint8_t const * p_tx_buffer,
+                                uint8_t tx_buffer_length,
+                                uint8_t * p_rx_buffer,
+                                uint8_t rx_buffer_length) {
+  nrf_drv_spi_xfer_desc_t xfer = {
+    .p_tx_buffer = p_tx_buffer, .tx_length = tx_buffer_length,
+    .p_rx_buffer = p_rx_buffer, .rx_length = rx_buffer_length };
+  return nrf_drv_spi_xfer(p_instance, &xfer, 0);
+}
+
+uint32_t nrf_drv_spi_start_task_get(nrf_drv_spi_t const * p_instance) {
+  return SIM_SPI_ADDR(p_instance->drv_inst_idx) + SIM_SPI_TASK_START;
+}
+
+uint32_t nrf_drv_spi_end_event_get(nrf_drv_spi_t const * p_instance) {
+  return SIM_SPI_ADDR(p_instance->drv_inst_idx) + SIM_SPI_EVENT_END;
+}
+
+//
+// timer, counter mode only
+//
+
+static sim_tim_t *sim_tim(nrf_drv_timer_t const * const p_instance) {
+  if (p_instance->instance_id >= SIM_TIM_INSTANCES) sim_fail("no timer", p_instance->instance_id);
+  return &sim.tim[p_instance->instance_id];
+}
+
+ret_code_t nrf_drv_timer_init(nrf_drv_timer_t const * const p_instance,
+                              nrf_drv_timer_config_t const * p_config,
+                              nrf_timer_event_handler_t timer_event_handler) {
+  if (p_instance->instance_id >= SIM_TIM_INSTANCES) return NRF_ERROR_INVALID_PARAM;
+  sim_tim_t *t = sim_tim(p_instance);
+  if (t->inited) return NRF_ERROR_INVALID_STATE;
+  if (p_config->mode != NRF_TIMER_MODE_COUNTER) return NRF_ERROR_NOT_SUPPORTED;
+  memset(t, 0, sizeof(*t));
+  t->inited = true;
+  t->handler = timer_event_handler;
+  t->p_context = p_config->p_context;
+  return NRF_SUCCESS;
+}
+
+void nrf_drv_timer_enable(nrf_drv_timer_t const * const p_instance) {
+  sim_tim(p_instance)->running = true;
+}
+
+void nrf_drv_timer_disable(nrf_drv_timer_t const * const p_instance) {
+  sim_tim(p_instance)->running = false;
+}
+
+void nrf_drv_timer_clear(nrf_drv_timer_t const * const p_instance) {
+  sim_tim(p_instance)->count = 0;
+}
+
+uint32_t nrf_drv_timer_task_address_get(nrf_drv_timer_t const * const p_instance,
+                                        nrf_timer_task_t timer_task) {
+  return SIM_TIM_ADDR(p_instance->instance_id) + timer_task;
+}
+
+uint32_t nrf_drv_timer_compare_event_address_get(nrf_drv_timer_t const * const p_instance,
+                                                 nrf_timer_cc_channel_t channel) {
+  return SIM_TIM_ADDR(p_instance->instance_id) + NRF_TIMER_EVENT_COMPARE0 + channel * 4;
+}
+
+void nrf_drv_timer_compare(nrf_drv_timer_t const * const p_instance,
+                           nrf_timer_cc_channel_t cc_channel,
+                           uint32_t cc_value,
+                           bool enable_int) {
+  sim_tim_t *t = sim_tim(p_instance);
+  t->cc[cc_channel] = cc_value;
+  if (enable_int) t->int_mask |= 1 << cc_channel;
+  else t->int_mask &= ~(1 << cc_channel);
+}
+
+static void sim_tim_task(uint8_t inst, uint32_t offs) {
+  sim_tim_t *t = &sim.tim[inst];
+  uint32_t c;
+  switch (offs) {
+  case NRF_TIMER_TASK_START: t->running = true; break;
+  case NRF_TIMER_TASK_STOP: t->running = false; break;
+  case NRF_TIMER_TASK_CLEAR: t->count = 0; break;
+  case NRF_TIMER_TASK_COUNT:
+    if (!t->running) break;
+    t->count++;
+    for (c = 0; c < SIM_TIM_CC; c++) {
+      if (t->count != t->cc[c]) continue;
+      if (t->int_mask & (1 << c)) {
+        if (t->irq_mask == 0) t->irq_ns = sim_irq_ns();
+        t->irq_mask |= 1 << c;
+      }
+      sim_ppi_event(SIM_TIM_ADDR(inst) + NRF_TIMER_EVENT_COMPARE0 + c * 4);
+    }
+    break;
+  default: sim_fail("timer task", offs);
+  }
+}
+
+static void sim_tim_irq(sim_tim_t *t) {
+  uint32_t c;
+  for (c = 0; c < SIM_TIM_CC; c++) {
+    if ((t->irq_mask & (1 << c)) == 0) continue;
+    t->irq_mask &= ~(1 << c);
+    if (t->handler) t->handler(NRF_TIMER_EVENT_COMPARE0 + c * 4, t->p_context);
+  }
+}
+
+//
+// ppi
+//
+
+uint32_t nrf_drv_ppi_init(void) {
+  if (sim.ppi_inited) return NRF_ERROR_INVALID_STATE;
+  sim.ppi_inited = true;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_channel_alloc(nrf_ppi_channel_t * p_channel) {
+  uint8_t ch;
+  for (ch = 0; ch < SIM_PPI_CHANNELS; ch++) {
+    if (!sim.ppi[ch].used) {
+      memset(&sim.ppi[ch], 0, sizeof(sim.ppi[ch]));
+      sim.ppi[ch].used = true;
+      *p_channel = ch;
+      return NRF_SUCCESS;
+    }
+  }
+  return NRF_ERROR_NO_MEM;
+}
+
+uint32_t nrf_drv_ppi_channel_assign(nrf_ppi_channel_t channel, uint32_t eep, uint32_t tep) {
+  if (channel >= SIM_PPI_CHANNELS || !sim.ppi[channel].used) return NRF_ERROR_INVALID_STATE;
+  sim.ppi[channel].eep = eep;
+  sim.ppi[channel].tep = tep;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_channel_fork_assign(nrf_ppi_channel_t channel, uint32_t fork_tep) {
+  if (channel >= SIM_PPI_CHANNELS || !sim.ppi[channel].used) return NRF_ERROR_INVALID_STATE;
+  sim.ppi[channel].fork_tep = fork_tep;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_channel_enable(nrf_ppi_channel_t channel) {
+  if (channel >= SIM_PPI_CHANNELS || !sim.ppi[channel].used) return NRF_ERROR_INVALID_STATE;
+  sim.ppi[channel].enabled = true;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_channel_disable(nrf_ppi_channel_t channel) {
+  if (channel >= SIM_PPI_CHANNELS || !sim.ppi[channel].used) return NRF_ERROR_INVALID_STATE;
+  sim.ppi[channel].enabled = false;
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_group_alloc(nrf_ppi_channel_group_t * p_group) {
+  uint8_t g;
+  for (g = 0; g < SIM_PPI_GROUPS; g++) {
+    if ((sim.ppi_groups_used & (1 << g)) == 0) {
+      sim.ppi_groups_used |= 1 << g;
+      sim.ppi_groups[g] = 0;
+      *p_group = g;
+      return NRF_SUCCESS;
+    }
+  }
+  return NRF_ERROR_NO_MEM;
+}
+
+uint32_t nrf_drv_ppi_channel_include_in_group(nrf_ppi_channel_t channel,
+                                              nrf_ppi_channel_group_t group) {
+  if (group >= SIM_PPI_GROUPS || channel >= SIM_PPI_CHANNELS) return NRF_ERROR_INVALID_PARAM;
+  sim.ppi_groups[group] |= 1 << channel;
+  return NRF_SUCCESS;
+}
+
+static void sim_ppi_group(nrf_ppi_channel_group_t group, bool enable) {
+  uint8_t ch;
+  for (ch = 0; ch < SIM_PPI_CHANNELS; ch++) {
+    if (sim.ppi_groups[group] & (1 << ch)) sim.ppi[ch].enabled = enable;
+  }
+}
+
+uint32_t nrf_drv_ppi_group_enable(nrf_ppi_channel_group_t group) {
+  if (group >= SIM_PPI_GROUPS) return NRF_ERROR_INVALID_PARAM;
+  sim_ppi_group(group, true);
+  return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_ppi_group_disable(nrf_ppi_channel_group_t group) {
+  if (group >= SIM_PPI_GROUPS) return NRF_ERROR_INVALID_PARAM;
+  sim_ppi_group(group, false);
+  return NRF_SUCCESS;
+}
+
+// tasks chg[n].en and chg[n].dis
+uint32_t nrf_drv_ppi_task_addr_group_enable_get(nrf_ppi_channel_group_t group) {
+  return SIM_PPI_ADDR + group * 8;
+}
+
+uint32_t nrf_drv_ppi_task_addr_group_disable_get(nrf_ppi_channel_group_t group) {
+  return SIM_PPI_ADDR + group * 8 + 4;
+}
+
+// triggers the tasks of all channels enabled at the event, like the
+// hardware does in parallel, before any of them can change channels
+static void sim_ppi_event(uint32_t eep) {
+  uint32_t tasks[2 * SIM_PPI_CHANNELS];
+  uint32_t count = 0, i;
+  for (i = 0; i < SIM_PPI_CHANNELS; i++) {
+    sim_ppi_t *p = &sim.ppi[i];
+    if (!p->enabled || p->eep != eep) continue;
+    if (p->tep) tasks[count++] = p->tep;
+    if (p->fork_tep) tasks[count++] = p->fork_tep;
+  }
+  for (i = 0; i < count; i++) sim_task(tasks[i]);
+}
+
+static void sim_task(uint32_t addr) {
+  uint32_t i;
+  if (addr >= SIM_PPI_ADDR && addr < SIM_PPI_ADDR + SIM_PPI_GROUPS * 8) {
+    sim_ppi_group((addr - SIM_PPI_ADDR) / 8, (addr & 4) == 0);
+    return;
+  }
+  for (i = 0; i < SIM_SPI_INSTANCES; i++) {
+    if (addr == SIM_SPI_ADDR(i) + SIM_SPI_TASK_START) {
+      sim_spi_start(&sim.spi[i]);
+      return;
+    }
+  }
+  for (i = 0; i < SIM_TIM_INSTANCES; i++) {
+    if (addr >= SIM_TIM_ADDR(i) && addr < SIM_TIM_ADDR(i) + SIM_PERIPH_SIZE) {
+      sim_tim_task(i, addr - SIM_TIM_ADDR(i));
+      return;
+    }
+  }
+  sim_fail("ppi task", addr);
+}
+
+uint32_t sim_frame_count(void) {
+  return sim.frame_count;
+}
+
+const sim_frame_t *sim_frame(uint32_t ix) {
+  return ix < sim.frame_count ? &sim.frames[ix] : NULL;
+}
+
+uint32_t sim_ws2812b_decode(const sim_frame_t *f, uint32_t *rgb, uint32_t max_leds) {
+  uint32_t bits = f->len * 8;
+  uint32_t bix, leds = 0;
+  uint32_t grb = 0, n = 0;
+  for (bix = 0; bix + 5 <= bits && leds < max_leds; bix += 5) {
+    uint32_t code = 0, b;
+    for (b = bix; b < bix + 5; b++) {
+      code = (code << 1) | ((f->data[b / 8] >> (7 - (b & 7))) & 1);
+    }
+    // 0b10000 or 0b11110, anything else is latch or garbage
+    if (code != 0b10000 && code != 0b11110) break;
+    grb = (grb << 1) | (code == 0b11110);
+    if (++n == 24) {
+      rgb[leds++] = ((grb & 0x00ff00) << 8) | ((grb & 0xff0000) >> 8) | (grb & 0xff);
+      grb = 0;
+      n = 0;
+    }
+  }
+  return leds;
+}
+
+//
+// simulation
+//
+
+void sim_boot(void) {
+  sim_flash_init();
+  start_softdevice();
+}
+
+uint64_t sim_time_ns(void) {
+  return sim.now;
+}
+
+static void sim_nus_deliver(const sim_nus_write_t *w) {
+  uint64_t wait = sim.now - w->t_ns;
+  sim.stats.nus_rx++;
+  sim.stats.nus_rx_bytes += w->len;
+  sim.stats.nus_rx_wait_sum_ns += wait;
+  if (wait > sim.stats.nus_rx_wait_max_ns) sim.stats.nus_rx_wait_max_ns = wait;
+  // softdevice hands over a buffer the application may not keep
+  uint8_t buf[w->len];
+  memcpy(buf, w->data, w->len);
+  app_on_data(buf, w->len);
+}
+
+// Steps the connection event state machine. The lamp listens to every
+// (latency + 1)th event, or to the next one when it has data to send.
+// Queued writes are delivered in the events it listens to.
+static void sim_conn_event(void) {
+  uint32_t i, n, bytes = 0;
+  switch (sim.conn_phase) {
+  case CONN_NOTIFY:
+    if (sim.now > sim.conn_anchor_ns - SIM_RADIO_LEAD_NS) {
+      // cpu was stalled by flash, the events meanwhile are lost
+      while (sim.conn_anchor_ns - SIM_RADIO_LEAD_NS < sim.now) {
+        sim.conn_anchor_ns += sim.conn_interval_ns;
+        sim.stats.radio_missed++;
+      }
+      if (sim.conn_anchor_ns - sim.conn_last_ns > CONN_SUP_TIMEOUT_MS * 1000000ULL) {
+        sim.connected = false;
+        sim.nus_q_count = 0;
+        sim.stats.link_drops++;
+        app_on_disconnected();
+      }
+      break;
+    }
+    sim.conn_phase = CONN_RADIO;
+    app_on_radio(true);
+    break;
+  case CONN_RADIO:
+    sim.conn_phase = CONN_DONE;
+    for (i = 0; i < sim.nus_q_count; i++) bytes += sim.nus_q[i].len;
+    sim.conn_on_ns = SIM_CONN_EVENT_NS + bytes * SIM_RADIO_BYTE_NS;
+    sim.conn_last_ns = sim.now;
+    sim.stats.radio_events++;
+    sim.stats.radio_on_ns += sim.conn_on_ns;
+    sim.nus_tx_pending = false;
+    // handlers may queue more, those wait for the next event
+    n = sim.nus_q_count;
+    for (i = 0; i < n && sim.connected; i++) sim_nus_deliver(&sim.nus_q[i]);
+    if (sim.connected) {
+      memmove(sim.nus_q, &sim.nus_q[n], (sim.nus_q_count - n) * sizeof(sim_nus_write_t));
+      sim.nus_q_count -= n;
+    }
+    break;
+  default:
+    sim.conn_phase = CONN_NOTIFY;
+    app_on_radio(false);
+    if (sim.conn_pend_interval_ns) {
+      sim.conn_interval_ns = sim.conn_pend_interval_ns;
+      sim.conn_latency = sim.conn_pend_latency;
+      sim.conn_pend_interval_ns = 0;
+    }
+    sim.conn_anchor_ns += sim.conn_interval_ns *
+        (sim.nus_tx_pending ? 1 : sim.conn_latency + 1);
+    break;
+  }
+}
+
+// picks an event at t when it is due by next, on a tie the one picked
+// first wins
+static bool sim_pick(uint64_t t, uint64_t *next, uint8_t *ev, uint8_t kind) {
+  if (t > *next || (*ev != SIM_EV_NONE && t == *next)) return false;
+  *next = t;
+  *ev = kind;
+  return true;
+}
+
+void sim_run_until(uint64_t t_ns) {
+  while (1) {
+    uint64_t next = t_ns;
+    uint8_t ev = SIM_EV_NONE;
+    app_timer_t *timer = NULL;
+    sim_spi_t *spi = NULL;
+    sim_tim_t *tim = NULL;
+    uint32_t i;
+    for (i = 0; i < SIM_SPI_INSTANCES; i++) {
+      sim_spi_t *s = &sim.spi[i];
+      if (s->irq && sim_pick(s->irq_ns, &next, &ev, SIM_EV_SPI_IRQ)) spi = s;
+      if (s->busy && sim_pick(s->end_ns, &next, &ev, SIM_EV_SPI_END)) spi = s;
+    }
+    for (i = 0; i < SIM_TIM_INSTANCES; i++) {
+      sim_tim_t *t = &sim.tim[i];
+      if (t->irq_mask && sim_pick(t->irq_ns, &next, &ev, SIM_EV_TIM_IRQ)) tim = t;
+    }
+    for (i = 0; i < sim.timer_count; i++) {
+      app_timer_t *t = sim.timers[i];
+      if (t->running && sim_pick(t->expiry_ns, &next, &ev, SIM_EV_TIMER)) timer = t;
+    }
+    if (sim.connected) {
+      uint64_t t = sim.conn_phase == CONN_NOTIFY ? sim.conn_anchor_ns - SIM_RADIO_LEAD_NS :
+          sim.conn_phase == CONN_RADIO ? sim.conn_anchor_ns : sim.conn_anchor_ns + sim.conn_on_ns;
+      sim_pick(t, &next, &ev, SIM_EV_CONN);
+    }
+    if (sim.fs_q_count) sim_pick(sim.fs_due_ns, &next, &ev, SIM_EV_FS);
+    if (ev == SIM_EV_NONE) break;
+    if (next > sim.now) sim.now = next;
+    switch (ev) {
+    case SIM_EV_FS:
+      sim_fs_run();
+      break;
+    case SIM_EV_CONN:
+      sim_conn_event();
+      break;
+    case SIM_EV_SPI_END:
+      sim_spi_end(spi);
+      break;
+    case SIM_EV_SPI_IRQ:
+      spi->irq = false;
+      if (spi->handler) spi->handler(&spi->evt);
+      break;
+    case SIM_EV_TIM_IRQ:
+      sim_tim_irq(tim);
+      break;
+    default:
+      if (timer->mode == APP_TIMER_MODE_REPEATED) {
+        timer->expiry_ns += TICKS_TO_NS(timer->period);
+      } else {
+        timer->running = false;
+      }
+      timer->handler(timer->p_context);
+      break;
+    }
+  }
+  if (sim.now < t_ns) sim.now = t_ns;
+}
+
+void sim_run_ms(uint32_t ms) {
+  sim_run_until(sim.now + ms * 1000000ULL);
+}
+
+void sim_connect(void) {
+  if (!sim.sd_enabled || sim.connected) return;
+  sim.connected = true;
+  // central picks the slowest of the preferred fast parameters
+  sim.conn_interval_ns = CONN_FAST_MAX_MS * 1000000ULL;
+  sim.conn_latency = 0;
+  sim.conn_pend_interval_ns = 0;
+  sim.conn_anchor_ns = sim.now + sim.conn_interval_ns;
+  sim.conn_last_ns = sim.now;
+  sim.conn_phase = CONN_NOTIFY;
+  sim.nus_q_count = 0;
+  app_on_connected();
+}
+
+void sim_disconnect(void) {
+  if (!sim.connected) return;
+  sim.connected = false;
+  sim.nus_q_count = 0;
+  app_on_disconnected();
+}
+
+bool sim_connected(void) {
+  return sim.connected;
+}
+
+uint16_t sim_nus_max_len(void) {
+  uint16_t mtu = sim_config.att_mtu < NRF_BLE_MAX_MTU_SIZE ?
+      sim_config.att_mtu : NRF_BLE_MAX_MTU_SIZE;
+  return mtu - 3;
+}
+
+void sim_nus_rx(const uint8_t *data, uint16_t len) {
+  if (!sim.connected) {
+    fprintf(stderr, "sim: nus rx without connection, ignored\n");
+    return;
+  }
+  if (len > sim_nus_max_len()) {
+    fprintf(stderr, "sim: nus rx of %u bytes exceeds mtu, ignored\n", len);
+    return;
+  }
+  sim.nus_q = sim_grow(sim.nus_q, &sim.nus_q_cap, sim.nus_q_count,
+                      sizeof(sim_nus_write_t));
+  sim_nus_write_t *w = &sim.nus_q[sim.nus_q_count++];
+  w->t_ns = sim.now;
+  w->len = len;
+  memcpy(w->data, data, len);
+}
+
+// as in main.c, fixed so runs repeat
+uint32_t rng_seed(void) {
+  return sim_config.rng_seed;
+}
+
+// as in main.c, central is not subscribed, only counted
+uint32_t telem_update(uint8_t *data, uint16_t len) {
+  uint16_t i;
+  sim.stats.telem_updates++;
+  if (sim_config.uart_echo) {
+    printf("sim: telem");
+    for (i = 0; i < len; i++) printf(" %02x", data[i]);
+    printf("\n");
+  }
+  return NRF_SUCCESS;
+}
+
+uint32_t nus_send(uint8_t *data, uint16_t len) {
+  uint16_t i;
+  if (!sim.connected) return NRF_ERROR_INVALID_STATE;
+  if (len > sim_nus_max_len()) return NRF_ERROR_DATA_SIZE;
+  sim.stats.nus_tx++;
+  sim.stats.nus_tx_bytes += len;
+  sim.nus_tx_pending = true;
+  if (sim_config.uart_echo) {
+    printf("sim: nus tx");
+    for (i = 0; i < len; i++) printf(" %02x", data[i]);
+    printf("\n");
+  }
+  return NRF_SUCCESS;
+}
+
+void sim_nus_rx_str(const char *s) {
+  sim_nus_rx((const uint8_t *)s, strlen(s));
+}
+
+void sim_nus_rx_hex(const char *hex, bool crc) {
+  uint8_t data[256];
+  uint16_t len = 0;
+  unsigned int b;
+  while (len < sizeof(data) - 2 && sscanf(hex, "%2x", &b) == 1) {
+    data[len++] = b;
+    hex += hex[1] ? 2 : 1;
+  }
+  if (crc) {
+    uint16_t c = 0xffff;
+    uint16_t i;
+    for (i = 0; i < len; i++) c = crc_ccitt_16(c, data[i]);
+    data[len++] = c >> 8;
+    data[len++] = c;
+  }
+  sim_nus_rx(data, len);
+}
+
+const sim_stats_t *sim_stats(void) {
+  return &sim.stats;
+}
+
+void sim_reset_capture(void) {
+  uint32_t i;
+  for (i = 0; i < sim.frame_count; i++) {
+    free(sim.frames[i].data);
+  }
+  sim.frame_count = 0;
+  sim.flash_op_count = 0;
+  for (i = 0; i < SIM_SPI_INSTANCES; i++) {
+    sim.spi[i].frame_ix = -1;
+  }
+  memset(&sim.stats, 0, sizeof(sim.stats));
+}
@@ -0,0 +1,132 @@
+/*
+ * sim.h
+ *
+ * Host simulation of the lamp. The application sources are compiled
+ * for linux against stubbed nrf drivers. Time is simulated: timers,
+ * spi transfers and flash operations all advance a virtual clock, and
+ * everything sent over spi or written to flash is captured in memory.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ble_flash.h"
+
+#define SIM_SPI_INSTANCES         3
+// ws2812b latches data when line is low for more than this
+#define SIM_WS2812B_RESET_NS      50000ULL
+// flash timings, nrf52832 datasheet
+#define SIM_FLASH_WRITE_WORD_NS   41000ULL
+#define SIM_FLASH_ERASE_PAGE_NS   85000000ULL
+#define SIM_FLASH_BASE            0x10000
+#define SIM_FLASH_PAGES           (BLE_FLASH_PAGE_END - SIM_FLASH_BASE / BLE_FLASH_PAGE_SIZE)
+// radio on time of a connection event, empty packets both ways and ramp
+// up, plus air time per payload byte at 1 Mbps
+#define SIM_CONN_EVENT_NS         400000ULL
+#define SIM_RADIO_BYTE_NS         8000ULL
+// radio notification comes this long before the radio is on
+#define SIM_RADIO_LEAD_NS         800000ULL
+
+// a frame as seen by the led strip, i.e. spi transfers on one instance
+// without a reset gap in between
+typedef struct {
+  uint8_t inst;
+  uint32_t transfers;
+  uint64_t t_start_ns;
+  uint64_t t_end_ns;
+  uint32_t len;
+  uint8_t *data;
+} sim_frame_t;
+
+typedef struct {
+  uint64_t t_ns;
+  uint32_t addr;
+  uint32_t len;
+} sim_flash_op_t;
+
+typedef struct {
+  uint32_t spi_transfers;
+  uint32_t spi_bytes;
+  uint32_t spi_busy;
+  uint32_t flash_writes;
+  uint32_t flash_bytes;
+  uint32_t flash_erases;
+  uint32_t flash_page_erases[BLE_FLASH_PAGE_END];
+  uint32_t sd_disables;
+  uint32_t sd_enables;
+  uint32_t link_drops;
+  uint32_t uart_bytes;
+  uint32_t nus_rx;
+  uint32_t nus_rx_bytes;
+  uint32_t nus_tx;
+  uint32_t nus_tx_bytes;
+  uint32_t telem_updates;
+  // time writes waited in the central for a connection event
+  uint64_t nus_rx_wait_max_ns;
+  uint64_t nus_rx_wait_sum_ns;
+  uint32_t radio_events;
+  uint32_t radio_missed;
+  uint64_t radio_on_ns;
+  uint32_t conn_updates;
+} sim_stats_t;
+
+typedef struct {
+  // echo uart output to stdout
+  bool uart_echo;
+  // att mtu of central, the one used is the smaller of this and ours
+  uint16_t att_mtu;
+  // returned by rng_seed
+  uint32_t rng_seed;
+  // delay from a peripheral event to its interrupt handler, as when the
+  // softdevice or a higher priority handler runs first
+  uint32_t irq_latency_ns;
+} sim_config_t;
+
+extern sim_config_t sim_config;
+
+// boots the application, same sequence as main.c
+void sim_boot(void);
+// returns current simulated time
+uint64_t sim_time_ns(void);
+// runs all events up to and including given absolute time
+void sim_run_until(uint64_t t_ns);
+// runs all events for given number of milliseconds
+void sim_run_ms(uint32_t ms);
+// simulates central connecting or disconnecting
+void sim_connect(void);
+void sim_disconnect(void);
+bool sim_connected(void);
+// simulates a write to the nus rx characteristic, the lamp gets it in
+// the next connection event it listens to
+void sim_nus_rx(const uint8_t *data, uint16_t len);
+// current connection interval and slave latency
+uint32_t sim_conn_interval_us(void);
+uint16_t sim_conn_latency(void);
+// max nus payload of current connection
+uint16_t sim_nus_max_len(void);
+void sim_nus_rx_str(const char *s);
+// simulates a write of hex encoded data, optionally followed by crc_ccitt_16
+void sim_nus_rx_hex(const char *hex, bool crc);
+
+// captured frames
+uint32_t sim_frame_count(void);
+const sim_frame_t *sim_frame(uint32_t ix);
+// decodes a ws2812b frame back to 0xrrggbb values, returns number of leds
+uint32_t sim_ws2812b_decode(const sim_frame_t *f, uint32_t *rgb, uint32_t max_leds);
+
+// captured flash operations, erases have len 0
+uint32_t sim_flash_op_count(void);
+const sim_flash_op_t *sim_flash_op(uint32_t ix);
+// pointer to simulated flash page
+uint8_t *sim_flash_page(uint32_t page);
+// fails the next ops queued flash operations, leaving flash as it is,
+// the way fstorage reports an operation it gave up on
+void sim_flash_fail(uint32_t ops);
+
+const sim_stats_t *sim_stats(void);
+// drops all captured frames and flash operations and zeroes stats
+void sim_reset_capture(void);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,196 @@
+/*
+ * sim_main.c
+ *
+ * Runs the lamp in the host simulation from a command line script and
+ * reports what was sent to the leds and written to flash.
+ *
+ * Script arguments are processed in order:
+ *   +<ms>        run simulation for given milliseconds
+ *   @connect     central connects
+ *   @disconnect  central disconnects
+ *   @flashfail<n> next n queued flash operations fail
+ *   %<hex>       binary data written to the nus rx characteristic
+ *   ^<hex>       same, with crc_ccitt_16 appended
+ *   <other>      written to the nus rx characteristic, e.g. "i5", "cff0000"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "app.h"
+#include "app_timer.h"
+#include "log.h"
+#include "prof.h"
+
+static void usage(const char *prg) {
+  fprintf(stderr,
+      "usage: %s [-v] [-f] [-m mtu] [-l file] [-r seed] [-i us] [script..]\n"
+      "  -v  echo uart output\n"
+      "  -f  dump every frame sent to the leds\n"
+      "  -m  att mtu of central, default 247\n"
+      "  -l  write deferred log entries to file at end\n"
+      "  -r  seed returned by the rng, default 0x12312312\n"
+      "  -i  interrupt latency of spi and timer handlers, default 0\n"
+      "script:\n"
+      "  +<ms>        run simulation for given milliseconds\n"
+      "  @connect     central connects\n"
+      "  @disconnect  central disconnects\n"
+      "  @flashfail<n> next n queued flash operations fail\n"
+      "  %%<hex>       binary data written to nus rx\n"
+      "  ^<hex>       same, with crc appended\n"
+      "  <data>       written to nus rx\n", prg);
+}
+
+static void dump_frames(void) {
+  uint32_t i, j;
+  for (i = 0; i < sim_frame_count(); i++) {
+    const sim_frame_t *f = sim_frame(i);
+    uint32_t rgb[f->len * 8 / 5 / 24 + 1];
+    uint32_t leds = sim_ws2812b_decode(f, rgb, sizeof(rgb) / sizeof(rgb[0]));
+    printf("frame %5u @ %10.3f ms spi%u:", i, f->t_start_ns / 1e6, f->inst);
+    for (j = 0; j < leds; j++) {
+      printf(" %06x", rgb[j]);
+    }
+    printf("\n");
+  }
+}
+
+static void report(void) {
+  const sim_stats_t *s = sim_stats();
+  uint32_t frames = sim_frame_count();
+  uint32_t i;
+  printf("time        %.3f ms\n", sim_time_ns() / 1e6);
+  printf("spi         %u frames, %u transfers, %u bytes, %u busy\n",
+         frames, s->spi_transfers, s->spi_bytes, s->spi_busy);
+  if (frames > 1) {
+    uint64_t min = ~0ULL, max = 0;
+    for (i = 1; i < frames; i++) {
+      uint64_t d = sim_frame(i)->t_start_ns - sim_frame(i - 1)->t_start_ns;
+      if (d < min) min = d;
+      if (d > max) max = d;
+    }
+    printf("frame gap   min %.3f ms, max %.3f ms\n", min / 1e6, max / 1e6);
+  }
+  app_frame_stats_t fs;
+  app_frame_stats(&fs);
+  printf("frames      %u encoded, %u coalesced, spi max %.3f ms, mean %.3f ms\n",
+         fs.frames, fs.coalesced, fs.spi_max * 1000.0 / APP_TIMER_CLOCK_FREQ,
+         fs.spi_frames ? fs.spi_sum * 1000.0 / APP_TIMER_CLOCK_FREQ / fs.spi_frames : 0);
+  app_anim_stats_t as;
+  app_anim_stats(&as);
+  if (as.steps) {
+    printf("anim        %u steps, late max %.3f ms, mean %.3f ms\n", as.steps,
+           as.late_max * 1000.0 / APP_TIMER_CLOCK_FREQ,
+           as.late_sum * 1000.0 / APP_TIMER_CLOCK_FREQ / as.steps);
+  }
+  printf("flash       %u writes, %u bytes, %u erases\n",
+         s->flash_writes, s->flash_bytes, s->flash_erases);
+  for (i = 0; i < BLE_FLASH_PAGE_END; i++) {
+    if (s->flash_page_erases[i]) {
+      printf("            page %u erased %u times\n", i, s->flash_page_erases[i]);
+    }
+  }
+  printf("softdevice  %u disables, %u enables, %u link drops\n",
+         s->sd_disables, s->sd_enables, s->link_drops);
+  printf("nus         %u writes, %u bytes, %u notifications, %u bytes\n",
+         s->nus_rx, s->nus_rx_bytes, s->nus_tx, s->nus_tx_bytes);
+  printf("telem       %u updates\n", s->telem_updates);
+  if (s->nus_rx) {
+    printf("            writes waited max %.3f ms, mean %.3f ms\n",
+           s->nus_rx_wait_max_ns / 1e6, s->nus_rx_wait_sum_ns / 1e6 / s->nus_rx);
+  }
+  printf("radio       %u events, %u missed, on %.3f ms, %u conn updates\n",
+         s->radio_events, s->radio_missed, s->radio_on_ns / 1e6, s->conn_updates);
+  connpol_stats_t cs[CONNPOL_MODES];
+  app_conn_stats(cs);
+  for (i = 0; i < CONNPOL_MODES; i++) {
+    if (cs[i].radio_events == 0) continue;
+    printf("conn %-6s %u events, radio on %.2f%%, %u cmds, latency max %.3f ms, mean %.3f ms\n",
+           i == CONNPOL_FAST ? "fast" : "idle", cs[i].radio_events,
+           cs[i].radio_span ? cs[i].radio_on * 100.0 / cs[i].radio_span : 0,
+           cs[i].cmds, cs[i].latency_max * 1000.0 / APP_TIMER_CLOCK_FREQ,
+           cs[i].cmds ? cs[i].latency_sum * 1000.0 / APP_TIMER_CLOCK_FREQ / cs[i].cmds : 0);
+  }
+  commitpol_stats_t ms;
+  app_commit_stats(&ms);
+  printf("commits     %u, %u bytes, %u erases, %u deferred, latency max %.3f s\n",
+         ms.commits, ms.bytes, ms.erases, ms.deferred, (double)ms.latency_max / APP_TIMER_CLOCK_FREQ);
+  log_stats_t ls;
+  log_stats(&ls);
+  if (ls.entries) printf("log         %u entries, %u lost\n", ls.entries, ls.lost);
+  printf("uart        %u bytes\n", s->uart_bytes);
+  for (i = 0; i < PROF_POINTS; i++) {
+    static const char *names[PROF_POINTS] = {
+      [PROF_WS_ENCODE] = "encode", [PROF_ANIM] = "anim", [PROF_ON_DATA] = "on_data",
+      [PROF_TNV_COMMIT] = "commit", [PROF_TNV_READ] = "tnv_read" };
+    prof_stats_t ps;
+    uint32_t b;
+    prof_stats(i, &ps);
+    if (ps.count == 0) continue;
+    // host cpu time, not simulated time
+    printf("prof %-8s %u calls, min %.1f us, mean %.1f us, max %.1f us\n",
+           names[i], ps.count, ps.min * 1e6 / PROF_HZ, ps.sum * 1e6 / PROF_HZ / ps.count,
+           ps.max * 1e6 / PROF_HZ);
+    printf("             ");
+    for (b = 0; b < PROF_BUCKETS; b++) {
+      printf(" %s%u:%u", b == PROF_BUCKETS - 1 ? ">=" : "<",
+             PROF_BUCKET_US << (2 * (b == PROF_BUCKETS - 1 ? b - 1 : b)), ps.hist[b]);
+    }
+    printf(" us\n");
+  }
+}
+
+static int dump_log(const char *name) {
+  uint8_t buf[256];
+  uint32_t len;
+  FILE *f = fopen(name, "wb");
+  if (f == NULL) {
+    perror(name);
+    return 1;
+  }
+  while ((len = log_read(buf, sizeof(buf))) > 0) fwrite(buf, 1, len, f);
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bool frames = false;
+  const char *log_file = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "vfm:l:r:i:h")) != -1) {
+    switch (opt) {
+    case 'v': sim_config.uart_echo = true; break;
+    case 'f': frames = true; break;
+    case 'm': sim_config.att_mtu = atoi(optarg); break;
+    case 'l': log_file = optarg; break;
+    case 'r': sim_config.rng_seed = strtoul(optarg, NULL, 0); break;
+    case 'i': sim_config.irq_latency_ns = atoi(optarg) * 1000; break;
+    default: usage(argv[0]); return 1;
+    }
+  }
+
+  sim_boot();
+  for (; optind < argc; optind++) {
+    const char *arg = argv[optind];
+    if (arg[0] == '+') {
+      sim_run_ms(atoi(&arg[1]));
+    } else if (strcmp(arg, "@connect") == 0) {
+      sim_connect();
+    } else if (strcmp(arg, "@disconnect") == 0) {
+      sim_disconnect();
+    } else if (strncmp(arg, "@flashfail", 10) == 0) {
+      sim_flash_fail(atoi(&arg[10]));
+    } else if (arg[0] == '%' || arg[0] == '^') {
+      sim_nus_rx_hex(&arg[1], arg[0] == '^');
+    } else {
+      sim_nus_rx_str(arg);
+    }
+  }
+
+  if (frames) dump_frames();
+  report();
+  return log_file ? dump_log(log_file) : 0;
+}
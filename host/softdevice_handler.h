@@ -0,0 +1,16 @@
+/*
+ * softdevice_handler.h - host simulation stub
+ *
+ * Disabling the softdevice drops any simulated connection, see sim.h.
+ */
+
+#ifndef SOFTDEVICE_HANDLER_H__
+#define SOFTDEVICE_HANDLER_H__
+
+#include "nordic_common.h"
+#include "nrf_error.h"
+
+uint32_t softdevice_handler_sd_disable(void);
+bool softdevice_handler_is_enabled(void);
+
+#endif // SOFTDEVICE_HANDLER_H__
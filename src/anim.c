@@ -0,0 +1,99 @@
+/*
+ * anim.c
+ *
+ *  Declarative led animation engine.
+ */
+
+#include "anim.h"
+
+static uint16_t _wrap(anim_t *a, int32_t pos) {
+  pos %= a->leds;
+  return pos < 0 ? pos + a->leds : pos;
+}
+
+static px_t _scale(px_t c, uint32_t num, uint32_t den) {
+  px_t p = { (c.r * num) / den, (c.g * num) / den, (c.b * num) / den };
+  return p;
+}
+
+static uint16_t _lerp1(int32_t a, int32_t b, uint32_t num, uint32_t den) {
+  // slow fades run up to 65535 steps, so the product needs 64 bits
+  return a + ((int64_t)(b - a) * num) / (int32_t)den;
+}
+
+static px_t _lerp(px_t a, px_t b, uint32_t num, uint32_t den) {
+  px_t p = { _lerp1(a.r, b.r, num, den), _lerp1(a.g, b.g, num, den),
+             _lerp1(a.b, b.b, num, den) };
+  return p;
+}
+
+static px_t _key_rgb(const anim_desc_t *d, uint16_t ix) {
+  const anim_key_t *k = d->key;
+  uint8_t i;
+  if (d->keys == 0) return px_rgb(0);
+  if (ix <= k[0].step) return px_rgb(k[0].rgb);
+  for (i = 1; i < d->keys; i++) {
+    if (ix < k[i].step) {
+      return _lerp(px_rgb(k[i-1].rgb), px_rgb(k[i].rgb),
+                   ix - k[i-1].step, k[i].step - k[i-1].step);
+    }
+  }
+  return px_rgb(k[d->keys - 1].rgb);
+}
+
+static void _fill(anim_t *a, uint16_t from, uint16_t len, px_t rgb) {
+  px_t *p = &a->rgb[from];
+  while (len--) *p++ = rgb;
+}
+
+void anim_init(anim_t *a, px_t *rgb, uint16_t leds) {
+  memset(a, 0, sizeof(anim_t));
+  a->rgb = rgb;
+  a->leds = leds;
+}
+
+void anim_start(anim_t *a, const anim_desc_t *desc) {
+  a->desc = desc;
+  a->ix = 0;
+  a->steps = desc->steps ? desc->steps : desc->laps * a->leds;
+  a->cur_rgb = px_rgb(0);
+}
+
+bool anim_step(anim_t *a) {
+  const anim_desc_t *d = a->desc;
+  a->ix++;
+  bool first = a->ix == 1;
+  px_t rgb = _key_rgb(d, a->ix);
+
+  switch (d->fx) {
+  case ANIM_FX_FILL:
+    if (first || !px_eq(rgb, a->cur_rgb)) {
+      _fill(a, 0, a->leds, rgb);
+    }
+    break;
+  case ANIM_FX_COMET: {
+    int32_t head = d->pos + d->dir * a->ix;
+    uint8_t k;
+    if (first) {
+      _fill(a, 0, a->leds, px_rgb(0));
+    } else {
+      // clear the led that just left the tail
+      a->rgb[_wrap(a, head - d->dir * d->arg)] = px_rgb(0);
+    }
+    for (k = 0; k < d->arg; k++) {
+      a->rgb[_wrap(a, head - d->dir * k)] = _scale(rgb, d->arg - k, d->arg);
+    }
+    break;
+  }
+  case ANIM_FX_HALVES: {
+    uint16_t half = a->leds / 2;
+    _fill(a, 0, a->leds, px_rgb(0));
+    if (a->ix & 1) {
+      _fill(a, (a->ix >> 1) & 1 ? half : 0, half, rgb);
+    }
+    break;
+  }
+  }
+  a->cur_rgb = rgb;
+  return a->ix < a->steps;
+}
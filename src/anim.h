@@ -0,0 +1,68 @@
+/*
+ * anim.h
+ *
+ * Declarative led animations. An animation is a constant descriptor
+ * giving a pixel effect, its motion and colour keyframes. The engine
+ * renders one step at a time into a pixel buffer, touching only the
+ * pixels that change. Timing is up to the caller, see anim_timer in
+ * app.c.
+ */
+
+#ifndef ANIM_H_
+#define ANIM_H_
+
+#include "system.h"
+#include "px.h"
+#include <stdbool.h>
+
+// all leds in keyframed colour
+#define ANIM_FX_FILL        0
+// head moving one led per step in dir, with a tail of arg leds fading out
+#define ANIM_FX_COMET       1
+// every odd step lights a half of the leds, alternating halves
+#define ANIM_FX_HALVES      2
+
+typedef struct {
+  // step where colour is reached, colours in between are interpolated
+  // at 8.8 per channel
+  uint16_t step;
+  uint32_t rgb;
+} anim_key_t;
+
+typedef struct {
+  uint8_t fx;
+  // effect argument, e.g. comet length
+  uint8_t arg;
+  // motion in leds per step
+  int8_t dir;
+  // start position
+  int8_t pos;
+  // number of steps, if zero it is laps times number of leds
+  uint16_t steps;
+  uint8_t laps;
+  uint8_t keys;
+  uint16_t step_ms;
+  // delay before first step
+  uint16_t delay_ms;
+  const anim_key_t *key;
+} anim_desc_t;
+
+typedef struct {
+  const anim_desc_t *desc;
+  px_t *rgb;
+  uint16_t leds;
+  uint16_t steps;
+  uint16_t ix;
+  px_t cur_rgb;
+} anim_t;
+
+// initiates animation engine rendering to given pixel buffer
+void anim_init(anim_t *a, px_t *rgb, uint16_t leds);
+
+// starts given animation, nothing is rendered until first step
+void anim_start(anim_t *a, const anim_desc_t *desc);
+
+// renders next step, returns FALSE if this was the last step
+bool anim_step(anim_t *a);
+
+#endif /* ANIM_H_ */
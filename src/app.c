@@ -2,42 +2,53 @@
 #include "app.h"
 #include "nrf_gpio.h"
 #include "miniutils.h"
+#include "log.h"
 #include "nrf_drv_spi.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
 #include "app_timer.h"
+#include "app_util_platform.h"
 #include "hardfault.h"
-#include "softdevice_handler.h"
 #include "ble_flash.h"
 #include "tnv.h"
+#include "ws2812b.h"
+#include "anim.h"
+#include "pvm.h"
+#include "cmd.h"
+#include "stream.h"
+#include "flashq.h"
+#include "prof.h"
 
-#define BITMANIO_STORAGE_BITS 8
-#define BITMANIO_H_WHEREABOUTS "bitmanio.h"
-#define BITMANIO_HEADER
-#include BITMANIO_H_WHEREABOUTS
+#if TNV_PAGES > FLASHQ_PAGES
+#error "fstorage must cover the tnv ring"
+#endif
 
-#define CODED_BYTES_PER_RGB_BYTE  5
-#define WS2812B_LEDS              16
-#define RGB_DATA_LEN \
-  (3 * WS2812B_LEDS * CODED_BYTES_PER_RGB_BYTE)
-
-#define CODE0 0b10000
-#define CODE1 0b11110
+#define WS2812B_LEDS              (WS2812B_STRIPS * WS2812B_STRIP_LEDS)
+#define RGB_DATA_LEN              WS2812B_FRAME_LEN(WS2812B_STRIP_LEDS)
+#define SPI_CHUNK                 WS2812B_SPI_CHUNK(RGB_DATA_LEN)
+#define SPI_CHUNKS                WS2812B_SPI_CHUNKS(RGB_DATA_LEN)
+#define SPI_DATA_LEN              WS2812B_SPI_LEN(RGB_DATA_LEN)
 
 #define ANIM_NONE         0
 #define ANIM_CONNECT      1
 #define ANIM_DISCONNECT   2
 #define ANIM_WRITE        3
 #define ANIM_ERROR        4
+#define ANIM_PROGRAM      5
 
 #define TNV_RGB           1
 #define TNV_INTENSITY     2
+#define TNV_WHITE_BAL     3
+#define TNV_DITHER        4
+#define TNV_PROGRAM       5
+// from TNV_ID_ESC on ids are extended, see tnv.h
 #define TNV_USER_VAL      15
+// uploaded pixel program
+#define TNV_PROG_BLOB     16
 
 static void settings_read(void);
-
-typedef struct anim_s {
-  uint32_t rgb;
-  uint16_t ms;
-} anim_t;
+static void start_anim(int anim);
+static void flash_idle(uint32_t errors);
 
 static const uint8_t GAMMA[] = {
    37, 38, 39, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 50,
@@ -49,82 +60,354 @@ static const uint8_t GAMMA[] = {
   177,180,182,184,186,189,191,193,196,198,200,203,205,208,210,213,
   215,218,220,223,225,228,231,233,236,239,241,244,247,249,252,255 };
 
+static const anim_key_t KEYS_CONNECT[] = { { 0, 0x00ee77 } };
+static const anim_key_t KEYS_DISCONNECT[] = { { 0, 0xee0077 } };
+static const anim_key_t KEYS_WRITE[] = { { 0, 0xff00ff } };
+static const anim_key_t KEYS_ERROR[] = { { 0, 0xff0000 } };
+
+static const anim_desc_t ANIMS[] = {
+  [ANIM_CONNECT] = {
+    .fx = ANIM_FX_COMET, .arg = 7, .dir = 1, .pos = 6, .laps = 5,
+    .step_ms = 40, .delay_ms = 100, .keys = 1, .key = KEYS_CONNECT },
+  [ANIM_DISCONNECT] = {
+    .fx = ANIM_FX_COMET, .arg = 7, .dir = -1, .pos = -7, .laps = 5,
+    .step_ms = 40, .delay_ms = 100, .keys = 1, .key = KEYS_DISCONNECT },
+  [ANIM_WRITE] = {
+    .fx = ANIM_FX_COMET, .arg = 1, .dir = -1, .pos = 0, .laps = 1,
+    .step_ms = 40, .delay_ms = 100, .keys = 1, .key = KEYS_WRITE },
+  [ANIM_ERROR] = {
+    .fx = ANIM_FX_HALVES, .steps = 20,
+    .step_ms = 400, .delay_ms = 100, .keys = 1, .key = KEYS_ERROR },
+};
+
 APP_TIMER_DEF(tim_anim_id);
-APP_TIMER_DEF(tim_lamp_id);
 APP_TIMER_DEF(tim_ctrl_id);
-const nrf_drv_spi_t spi = NRF_DRV_SPI_INSTANCE(0);
+APP_TIMER_DEF(tim_dither_id);
+APP_TIMER_DEF(tim_stream_id);
+APP_TIMER_DEF(tim_conn_id);
+APP_TIMER_DEF(tim_telem_id);
+static const nrf_drv_spi_t spi[WS2812B_STRIPS] = {
+  NRF_DRV_SPI_INSTANCE(0),
+#if WS2812B_STRIPS > 1
+  NRF_DRV_SPI_INSTANCE(1),
+#endif
+#if WS2812B_STRIPS > 2
+  NRF_DRV_SPI_INSTANCE(2),
+#endif
+};
+// counts spi chunks of each strip, timer0 belongs to the softdevice
+static const nrf_drv_timer_t spi_timer[WS2812B_STRIPS] = {
+  NRF_DRV_TIMER_INSTANCE(1),
+#if WS2812B_STRIPS > 1
+  NRF_DRV_TIMER_INSTANCE(2),
+#endif
+#if WS2812B_STRIPS > 2
+  NRF_DRV_TIMER_INSTANCE(3),
+#endif
+};
+static const uint8_t spi_mosi_pins[] = PIN_MOSI_STRIPS;
 static struct app {
-  uint8_t spi_ws_buf[RGB_DATA_LEN];
-  int anim;
-  int anim_ix;
-  uint32_t rgb[WS2812B_LEDS];
+  // ping-pong frame buffers per strip, one is transmitted while next is encoded
+  uint8_t spi_ws_buf[WS2812B_STRIPS][2][SPI_DATA_LEN];
+  // ppi group of the channel starting the next chunk
+  nrf_ppi_channel_group_t spi_chain[WS2812B_STRIPS];
+  volatile uint8_t spi_tx_ix;
+  volatile uint8_t spi_tx_strips;
+  int anim_id;
+  anim_t anim;
+  uint32_t anim_due;
+  uint32_t anim_step_ticks;
+  app_anim_stats_t anim_stats;
+  app_frame_stats_t frame_stats;
+  // start of spi transfer of current frame
+  uint32_t spi_tx_t;
+  // working colour of each led, see px.h
+  px_t rgb[WS2812B_LEDS];
   uint32_t lamp_rgb;
   uint32_t lamp_intens;
+  uint32_t lamp_white_bal;
+  // per channel output value of r, g and b in 8.8 fixed point, see lamp_build_lut
+  uint16_t lut[3][256];
+  // per channel lut slope, adding the output of pixel colour fractions
+  uint32_t lut_scale[3];
+  // lut has no fractions, dithering is pointless unless pixels have
+  bool lut_exact;
+  // pixels of the last frame had fractions
+  bool px_frac;
+  // temporal dithering, fractions left over from previous frames
+  uint8_t dither_err[WS2812B_LEDS][3];
+  bool dither;
+  bool dither_running;
+  // uploaded pixel program, see pvm.h, run from its tnv blob
+  pvm_t pvm;
+  bool prog_run;
+  // kept until the program is in flash
+  uint8_t prog_up[PVM_HDR_LEN + PVM_MAX_LEN];
+  uint16_t prog_up_len;
+  uint8_t prog_tries;
+  bool prog_rsp;
+  // live streaming, frames are assembled in stream_rgb
+  stream_t stream;
+  px_t stream_rgb[WS2812B_LEDS];
+  bool streaming;
+  // stream frame in back buffer and on its way out, with first chunk time
+  volatile bool stream_enc;
+  volatile bool stream_tx;
+  uint32_t stream_enc_t;
+  uint32_t stream_tx_t;
+  // same for leds changed by a command, with reception time
+  bool cmd_pending;
+  uint32_t cmd_t;
+  volatile bool cmd_enc;
+  volatile bool cmd_tx;
+  uint32_t cmd_enc_t;
+  uint32_t cmd_tx_t;
+  // connection interval policy, see connpol.h
+  connpol_t connpol;
+  // settings commit policy, see commitpol.h
+  commitpol_t commitpol;
+  bool connected;
+  // back buffer holds a completely encoded frame not sent yet
   volatile bool lamp_dirty;
   volatile bool lamp_tx;
   volatile bool factory_reset;
+  // work waiting for queued flash operations to finish
+  bool flash_erased;
+  bool flash_prog;
+  bool flash_reset;
+  bool flash_prog_store;
+  bool flash_commit;
   volatile bool startup;
   tnv_t tnv;
 } app;
 
-static void ws2812b_make_buffer(uint32_t *rgb) {
-  bitmanio_array8_t bio_arr;
-  bitmanio_init_array8(&bio_arr, app.spi_ws_buf, CODED_BYTES_PER_RGB_BYTE);
-  uint32_t bix = 0;
-  int i, j;
-  for (i = 0; i < WS2812B_LEDS; i++) {
-    uint32_t d = *rgb++;
-    uint16_t r = (d>>16)&0xff;
-    uint16_t g = (d>>8)&0xff;
-    uint16_t b = (d)&0xff;
-    if (app.lamp_intens < 10) {
-      uint8_t intens = GAMMA[(sizeof(GAMMA) * app.lamp_intens) / 10];
-      r = (r * intens) >> 8;
-      g = (g * intens) >> 8;
-      b = (b * intens) >> 8;
+// Runs the dither refresh timer when dithering is enabled and there are
+// fractions to spread.
+static void lamp_dither_ctrl(void) {
+  bool run = app.dither && (!app.lut_exact || app.px_frac);
+  if (run && !app.dither_running) {
+    app_timer_start(tim_dither_id, APP_TIMER_TICKS(TIME_DITHER_MS, APP_TIMER_PRESCALER), NULL);
+  } else if (!run && app.dither_running) {
+    app_timer_stop(tim_dither_id);
+  }
+  app.dither_running = run;
+}
+
+// Builds the output lookup table from intensity and white balance, so
+// encoding a frame needs no arithmetic per pixel. White balance holds a
+// scale per channel as 0xrrggbb, where 0xff is full.
+static void lamp_build_lut(void) {
+  uint32_t intens = app.lamp_intens < 10 ?
+      GAMMA[(sizeof(GAMMA) * app.lamp_intens) / 10] : 256;
+  uint16_t fractions = 0;
+  int c, v;
+  for (c = 0; c < 3; c++) {
+    uint32_t scale = intens * (((app.lamp_white_bal >> (16 - c*8)) & 0xff) + 1);
+    app.lut_scale[c] = scale;
+    for (v = 0; v < 256; v++) {
+      app.lut[c][v] = (v * scale) >> 8;
+      fractions |= app.lut[c][v];
     }
-    r &= 0xff;
-    g &= 0xff;
-    b &= 0xff;
+  }
+  app.lut_exact = (fractions & 0xff) == 0;
+  lamp_dither_ctrl();
+}
 
-    d = (g << 16) | (r << 8) | b;
-    for (j = 8*3-1; j >= 0; j--) {
-      bitmanio_set8(&bio_arr, bix++, (d >> j) & 1 ? CODE1 : CODE0);
+// Output of one channel from its 8.8 working colour, with the error
+// carried over from the previous frame.
+static inline uint8_t ws2812b_dither(uint16_t v, uint8_t c, uint8_t *err) {
+  uint32_t o = app.lut[c][v >> 8] + ((app.lut_scale[c] * (v & 0xff)) >> 16) + *err;
+  *err = o;
+  return o > 0xffff ? 0xff : o >> 8;
+}
+
+// Encodes leds to dst, returns all pixel channels or'ed together telling
+// if there were fractions.
+static uint16_t ws2812b_make_buffer(uint8_t *dst, px_t *px, uint8_t (*err)[3], uint32_t leds) {
+  uint16_t frac = 0;
+  int i;
+  PROF_START(PROF_WS_ENCODE);
+  if (!app.dither_running) {
+    for (i = 0; i < leds; i++) {
+      px_t p = *px++;
+      frac |= p.r | p.g | p.b;
+      dst = ws2812b_encode_pixel(dst,
+          app.lut[0][p.r >> 8] >> 8,
+          app.lut[1][p.g >> 8] >> 8,
+          app.lut[2][p.b >> 8] >> 8);
+    }
+  } else {
+    // first order error diffusion over time, each frame carries the
+    // fractions dropped by the previous one
+    for (i = 0; i < leds; i++) {
+      px_t p = *px++;
+      frac |= p.r | p.g | p.b;
+      dst = ws2812b_encode_pixel(dst,
+          ws2812b_dither(p.r, 0, &err[i][0]),
+          ws2812b_dither(p.g, 1, &err[i][1]),
+          ws2812b_dither(p.b, 2, &err[i][2]));
     }
   }
+  PROF_END(PROF_WS_ENCODE);
+  return frac;
 }
 
+// swaps buffers and starts transmitting the encoded frame on all strips
+static void lamp_tx(void) {
+  uint8_t strip;
+  app.lamp_tx = true;
+  app.lamp_dirty = false;
+  app.spi_tx_ix ^= 1;
+  app_timer_cnt_get(&app.spi_tx_t);
+  app.spi_tx_strips = WS2812B_STRIPS;
+  app.stream_tx = app.stream_enc;
+  app.stream_tx_t = app.stream_enc_t;
+  app.stream_enc = false;
+  app.cmd_tx = app.cmd_enc;
+  app.cmd_tx_t = app.cmd_enc_t;
+  app.cmd_enc = false;
+  for (strip = 0; strip < WS2812B_STRIPS; strip++) {
+    nrf_drv_spi_xfer_desc_t xfer = {
+      .p_tx_buffer = app.spi_ws_buf[strip][app.spi_tx_ix],
+      .tx_length = SPI_CHUNK,
+    };
+    // first chunk starts here, the rest from the chain, see lamp_tx_chain
+    nrf_drv_timer_clear(&spi_timer[strip]);
+    if (SPI_CHUNKS > 1) nrf_drv_ppi_group_enable(app.spi_chain[strip]);
+    nrf_drv_spi_xfer(&spi[strip], &xfer,
+        NRF_DRV_SPI_FLAG_TX_POSTINC | NRF_DRV_SPI_FLAG_NO_XFER_EVT_HANDLER);
+  }
+}
+
+// Frames go out without an event per chunk, the end of the frame comes
+// from the chunk counter, see spi_count_handler. The handler only keeps
+// the driver non-blocking.
 static void spi_handler(nrf_drv_spi_evt_t const * p_event) {
+}
+
+// last chunk of a strip is out
+static void spi_count_handler(nrf_timer_event_t event_type, void * p_context) {
   //print("spi.finished dirty:%i\n", app.lamp_dirty);
+  if (event_type != NRF_TIMER_EVENT_COMPARE1) {
+    return;
+  }
+  if (--app.spi_tx_strips > 0) {
+    return;
+  }
   app.lamp_tx = false;
+  uint32_t now, spi_t;
+  app_timer_cnt_get(&now);
+  app_timer_cnt_diff_compute(now, app.spi_tx_t, &spi_t);
+  app.frame_stats.spi_frames++;
+  app.frame_stats.spi_sum += spi_t;
+  if (spi_t > app.frame_stats.spi_max) app.frame_stats.spi_max = spi_t;
+  if (app.stream_tx) {
+    uint32_t latency;
+    app_timer_cnt_diff_compute(now, app.stream_tx_t, &latency);
+    stream_shown(&app.stream, latency);
+    app.stream_tx = false;
+  }
+  if (app.cmd_tx) {
+    uint32_t latency;
+    app_timer_cnt_diff_compute(now, app.cmd_tx_t, &latency);
+    connpol_latency(&app.connpol, latency);
+    app.cmd_tx = false;
+  }
+  // send next frame right away if there is one, else lamp_update will
+  // start it once encoded
   if (app.lamp_dirty) {
-    app.lamp_dirty = false;
-    app_timer_start(tim_lamp_id, APP_TIMER_TICKS(5, APP_TIMER_PRESCALER), NULL);
+    lamp_tx();
   }
 }
 
-static void lamp_tx(void) {
-  app.lamp_tx = true;
-  ws2812b_make_buffer(app.rgb);
-  nrf_drv_spi_transfer(&spi, app.spi_ws_buf, sizeof(app.spi_ws_buf), NULL, 0);
+// Chains the chunks of a strip in hardware so no interrupt latency can
+// pause the line long enough to latch the strip mid frame. Each spi end
+// counts on the strip's timer and starts the next chunk from the next
+// address, tx list mode. The count before the last chunk disables the
+// starting channel, the count of the last one ends the frame.
+static uint32_t lamp_tx_chain(uint8_t strip) {
+  nrf_drv_timer_config_t config = NRF_DRV_TIMER_DEFAULT_CONFIG;
+  nrf_ppi_channel_t count, next, stop;
+  uint32_t end = nrf_drv_spi_end_event_get(&spi[strip]);
+  uint32_t err_code;
+  config.mode = NRF_TIMER_MODE_COUNTER;
+  err_code = nrf_drv_timer_init(&spi_timer[strip], &config, spi_count_handler);
+  if (err_code != NRF_SUCCESS) return err_code;
+  nrf_drv_timer_compare(&spi_timer[strip], NRF_TIMER_CC_CHANNEL0, SPI_CHUNKS - 1, false);
+  nrf_drv_timer_compare(&spi_timer[strip], NRF_TIMER_CC_CHANNEL1, SPI_CHUNKS, true);
+  nrf_drv_timer_enable(&spi_timer[strip]);
+  err_code = nrf_drv_ppi_channel_alloc(&count);
+  if (err_code != NRF_SUCCESS) return err_code;
+  nrf_drv_ppi_channel_assign(count, end,
+      nrf_drv_timer_task_address_get(&spi_timer[strip], NRF_TIMER_TASK_COUNT));
+  nrf_drv_ppi_channel_enable(count);
+  if (SPI_CHUNKS == 1) return NRF_SUCCESS;
+  err_code = nrf_drv_ppi_channel_alloc(&next);
+  if (err_code == NRF_SUCCESS) err_code = nrf_drv_ppi_channel_alloc(&stop);
+  if (err_code == NRF_SUCCESS) err_code = nrf_drv_ppi_group_alloc(&app.spi_chain[strip]);
+  if (err_code != NRF_SUCCESS) return err_code;
+  nrf_drv_ppi_channel_assign(next, end, nrf_drv_spi_start_task_get(&spi[strip]));
+  nrf_drv_ppi_channel_include_in_group(next, app.spi_chain[strip]);
+  nrf_drv_ppi_channel_assign(stop,
+      nrf_drv_timer_compare_event_address_get(&spi_timer[strip], NRF_TIMER_CC_CHANNEL0),
+      nrf_drv_ppi_task_addr_group_disable_get(app.spi_chain[strip]));
+  nrf_drv_ppi_channel_enable(stop);
+  return NRF_SUCCESS;
 }
 
 static void lamp_update(void) {
   //print("app.lamp_update tx:%i\n", app.lamp_tx);
+  uint8_t strip;
+  uint16_t frac = 0;
+  CRITICAL_REGION_ENTER();
+  // back buffer is overwritten, a frame waiting in it is never sent
+  if (app.lamp_dirty) app.frame_stats.coalesced++;
+  app.lamp_dirty = false;
+  CRITICAL_REGION_EXIT();
+  if (app.cmd_pending) {
+    app.cmd_enc = true;
+    app.cmd_enc_t = app.cmd_t;
+    app.cmd_pending = false;
+  }
+  for (strip = 0; strip < WS2812B_STRIPS; strip++) {
+    frac |= ws2812b_make_buffer(app.spi_ws_buf[strip][app.spi_tx_ix ^ 1],
+        &app.rgb[strip * WS2812B_STRIP_LEDS],
+        &app.dither_err[strip * WS2812B_STRIP_LEDS], WS2812B_STRIP_LEDS);
+  }
+  if (((frac & 0xff) != 0) != app.px_frac) {
+    app.px_frac = !app.px_frac;
+    lamp_dither_ctrl();
+  }
+  CRITICAL_REGION_ENTER();
+  app.frame_stats.frames++;
   if (app.lamp_tx) {
     app.lamp_dirty = true;
   } else {
-    app.lamp_dirty = false;
     lamp_tx();
   }
+  CRITICAL_REGION_EXIT();
 }
 
+static void lamp_set_program(bool run, bool store);
+
 static void lamp_set_color(uint32_t rgb, bool store) {
+  if (store && app.prog_run) {
+    // picking a colour stops the program
+    lamp_set_program(FALSE, TRUE);
+  }
   app.lamp_rgb = rgb;
-  print("app.lamp_color:%06x\n", rgb);
-  int i;
-  for (i = 0; i < WS2812B_LEDS; i++) {
-    app.rgb[i] = rgb ? rgb : (rand_next() & 0xffffff);
+  log_dbg("app.lamp_color:%06x\n", rgb);
+  int i, j;
+  if (rgb) {
+    for (i = 0; i < WS2812B_LEDS; i++) app.rgb[i] = px_rgb(rgb);
+  } else {
+    // random colours come a batch at a time, expanded to pixels
+    uint32_t rnd[16];
+    for (i = 0; i < WS2812B_LEDS; i += j) {
+      uint32_t n = MIN(WS2812B_LEDS - i, sizeof(rnd) / sizeof(rnd[0]));
+      rand_fill(rnd, n * sizeof(rnd[0]));
+      for (j = 0; j < n; j++) app.rgb[i + j] = px_rgb(rnd[j]);
+    }
   }
   lamp_update();
   if (store) tnv_set(&app.tnv, TNV_RGB, rgb);
@@ -132,174 +415,689 @@ static void lamp_set_color(uint32_t rgb, bool store) {
 
 static void lamp_set_intensity(uint32_t i, bool store) {
   app.lamp_intens = i;
-  print("app.lamp_intensity:%i\n", i);
+  log_dbg("app.lamp_intensity:%i\n", i);
+  lamp_build_lut();
   lamp_update();
   if (store) tnv_set(&app.tnv, TNV_INTENSITY, i);
 }
 
+static void lamp_set_white_balance(uint32_t wb, bool store) {
+  app.lamp_white_bal = wb;
+  log_dbg("app.lamp_white_balance:%06x\n", wb);
+  lamp_build_lut();
+  lamp_update();
+  if (store) tnv_set(&app.tnv, TNV_WHITE_BAL, wb);
+}
+
+static void lamp_set_dither(bool dither, bool store) {
+  app.dither = dither;
+  log_dbg("app.lamp_dither:%i\n", dither);
+  lamp_dither_ctrl();
+  lamp_update();
+  if (store) tnv_set(&app.tnv, TNV_DITHER, dither);
+}
+
+static void lamp_set_program(bool run, bool store) {
+  if (run && app.pvm.code == 0) {
+    log_dbg("app.prog none\n");
+    run = FALSE;
+  }
+  app.prog_run = run;
+  log_dbg("app.lamp_program:%i\n", run);
+  // other animations pick up the program when they finish
+  if (app.anim_id == ANIM_NONE || app.anim_id == ANIM_PROGRAM) {
+    start_anim(ANIM_NONE);
+  }
+  if (store) tnv_set(&app.tnv, TNV_PROGRAM, run);
+}
+
+static void lamp_load_program(void) {
+  uint32_t len;
+  const uint8_t *prog = tnv_get_blob(&app.tnv, TNV_PROG_BLOB, &len);
+  int res = PVM_ERR_MAGIC;
+  if (prog) {
+    res = pvm_load(&app.pvm, prog, len, app.rgb, WS2812B_LEDS);
+  } else {
+    memset(&app.pvm, 0, sizeof(app.pvm));
+  }
+  log_info("app.prog load len %i res %i\n", prog ? len : 0, res);
+}
+
+// A commit moving to a new page carries the program blob along, the
+// code is read from there once the old page may go.
+static void lamp_follow_program(void) {
+  uint32_t len;
+  const uint8_t *prog = tnv_get_blob(&app.tnv, TNV_PROG_BLOB, &len);
+  if (app.pvm.code && prog) app.pvm.code = &prog[PVM_HDR_LEN];
+}
+
+static bool lamp_storing_program(void) {
+  return app.flash_prog_store || app.flash_prog;
+}
+
+// Stores an uploaded program in flash if it is valid. It is committed as
+// a tnv blob in flash_idle, and loaded and started once written.
+static void lamp_store_program(bool rsp) {
+  pvm_t vm;
+  int res = pvm_load(&vm, app.prog_up, app.prog_up_len, 0, 0);
+  log_info("app.prog upload len %i res %i\n", app.prog_up_len, res);
+  if (res != PVM_OK || lamp_storing_program()) return;
+  app.prog_run = FALSE;
+  if (app.anim_id == ANIM_PROGRAM) start_anim(ANIM_NONE);
+  tnv_set(&app.tnv, TNV_PROGRAM, TRUE);
+  app.prog_tries = 0;
+  app.prog_rsp = rsp;
+  app.flash_prog_store = TRUE;
+  if (!flashq_busy()) flash_idle(0);
+}
+
+static void program_store_done(uint8_t res) {
+  uint8_t rsp[CMD_HDR_LEN + 2 + 1] = { CMD_MAGIC | CMD_VERSION, CMD_PROG_STORE, 1, res };
+  log_info("app.prog store res %i, %i tries\n", res, app.prog_tries);
+  if (app.prog_rsp) nus_send(rsp, sizeof(rsp));
+}
+
+// Commits the uploaded program along with dirty settings.
+static void program_commit(void) {
+  uint32_t now;
+  uint32_t res = tnv_set_blob(&app.tnv, TNV_PROG_BLOB, app.prog_up, app.prog_up_len);
+  app.prog_tries++;
+  if (res) {
+    log_warn("app.prog store failed, res %i\n", res);
+    program_store_done(1);
+    return;
+  }
+  app_timer_cnt_get(&now);
+  commitpol_commit(&app.commitpol, now);
+  app.flash_prog = TRUE;
+}
+
+// The program made it if its blob holds the upload once written, else it
+// is committed again from the upload.
+static void program_written(void) {
+  uint32_t len, i;
+  const uint8_t *prog = tnv_get_blob(&app.tnv, TNV_PROG_BLOB, &len);
+  bool same = prog && len == app.prog_up_len;
+  for (i = 0; same && i < len; i++) same = prog[i] == app.prog_up[i];
+  if (same) {
+    app.prog_up_len = 0;
+    lamp_load_program();
+    lamp_set_program(TRUE, FALSE);
+    program_store_done(0);
+  } else if (app.prog_tries < PROG_STORE_TRIES) {
+    log_warn("app.prog not written, again\n");
+    app.flash_prog_store = TRUE;
+  } else {
+    program_store_done(1);
+  }
+}
+
+static void lamp_stream_stop(void) {
+  log_info("app.stream stop, %i frames\n", app.stream.stats.frames);
+  app.streaming = FALSE;
+  app_timer_stop(tim_stream_id);
+  start_anim(ANIM_NONE);
+}
+
+static void lamp_stream_start(void) {
+  log_info("app.stream start\n");
+  app_timer_stop(tim_anim_id);
+  app.anim_id = ANIM_NONE;
+  app.streaming = TRUE;
+  memcpy(app.stream_rgb, app.rgb, sizeof(app.rgb));
+  stream_restart(&app.stream);
+}
+
+static void stream_timer(void * p_context) {
+  lamp_stream_stop();
+}
+
 static void lamp_store_user_value(uint32_t x) {
   tnv_set(&app.tnv, TNV_USER_VAL, x);
 }
 
 
 static void start_anim(int anim) {
-  app.anim = anim;
-  app.anim_ix = 0;
-  if (anim == 0) {
+  uint16_t step_ms, delay_ms;
+  if (app.streaming) return;
+  if (anim == ANIM_NONE && app.prog_run) {
+    anim = ANIM_PROGRAM;
+  }
+  app.anim_id = anim;
+  if (anim == ANIM_NONE) {
     app_timer_stop(tim_anim_id);
     lamp_set_color(app.lamp_rgb, FALSE);
     return;
   }
-
-  app_timer_start(tim_anim_id, APP_TIMER_TICKS(100, APP_TIMER_PRESCALER), NULL);
+  if (anim == ANIM_PROGRAM) {
+    // restart the frame, pixels may have been overwritten meanwhile
+    app.pvm.pix = 0;
+    app.pvm.frame_icount = 0;
+    step_ms = MAX(TIME_PROG_MIN_MS, app.pvm.frame_ms);
+    delay_ms = step_ms;
+  } else {
+    const anim_desc_t *desc = &ANIMS[anim];
+    anim_start(&app.anim, desc);
+    step_ms = desc->step_ms;
+    delay_ms = desc->delay_ms;
+  }
+  app.anim_step_ticks = APP_TIMER_TICKS(step_ms, APP_TIMER_PRESCALER);
+  app_timer_cnt_get(&app.anim_due);
+  app.anim_due += APP_TIMER_TICKS(delay_ms, APP_TIMER_PRESCALER);
+  app_timer_stop(tim_anim_id);
+  app_timer_start(tim_anim_id, APP_TIMER_TICKS(delay_ms, APP_TIMER_PRESCALER), NULL);
 }
 
+// Steps are scheduled on a fixed grid from animation start, so time spent
+// in handlers or with the cpu blocked by flash does not accumulate.
 static void anim_timer(void * p_context) {
-  uint32_t call_again = 0;
-  app.anim_ix++;
-  switch (app.anim) {
-  case ANIM_CONNECT: {
-    int i;
-    memset(app.rgb, 0, sizeof(app.rgb));
-    for (i = 1; i < 8; i++) {
-      app.rgb[(app.anim_ix -1 + i) % WS2812B_LEDS] = 0x002211 * i;
-    }
-    lamp_update();
-    call_again = app.anim_ix >= WS2812B_LEDS*5 ? 0 : 40;
-    break;
-  }
-  case ANIM_DISCONNECT: {
-    int i;
-    memset(app.rgb, 0, sizeof(app.rgb));
-    for (i = 1; i < 8; i++) {
-      app.rgb[(5*WS2812B_LEDS - app.anim_ix - i) % WS2812B_LEDS] = 0x220011 * i;
-    }
-    lamp_update();
-    call_again = app.anim_ix >= WS2812B_LEDS*5 ? 0 : 40;
-    break;
-  }
-  case ANIM_WRITE: {
-    memset(app.rgb, 0, sizeof(app.rgb));
-    app.rgb[(5*WS2812B_LEDS - app.anim_ix) % WS2812B_LEDS] = 0xff00ff;
-    lamp_update();
-    call_again = app.anim_ix >= WS2812B_LEDS*1 ? 0 : 40;
-    break;
-  }
-  case ANIM_ERROR: {
-    int i;
-    memset(app.rgb, 0, sizeof(app.rgb));
-    if (app.anim_ix & 1) {
-      for (i = 0; i < WS2812B_LEDS/2; i++) {
-        if ((app.anim_ix>>1) & 1) {
-          app.rgb[(WS2812B_LEDS/2 + i) % WS2812B_LEDS] = 0xff0000;
-        } else {
-          app.rgb[i] = 0xff0000;
-        }
-      }
+  uint32_t now, late, next;
+  PROF_START(PROF_ANIM);
+  app_timer_cnt_get(&now);
+  app_timer_cnt_diff_compute(now, app.anim_due, &late);
+  if (late & 0x800000) late = 0; // early
+  app.anim_stats.steps++;
+  app.anim_stats.late_sum += late;
+  if (late > app.anim_stats.late_max) app.anim_stats.late_max = late;
+
+  bool more = TRUE;
+  if (app.anim_id == ANIM_PROGRAM) {
+    // frames needing more than the budget are finished in later steps
+    int res = pvm_frame(&app.pvm, PROG_BUDGET);
+    if (res < 0) {
+      log_warn("app.prog error %i\n", res);
+      app.prog_run = FALSE;
+      more = FALSE;
+    } else if (res > 0) {
+      lamp_update();
     }
+  } else {
+    more = anim_step(&app.anim);
     lamp_update();
-    call_again = app.anim_ix >= 20 ? 0 : 400;
-    break;
   }
-  }
-  if (call_again == 0) {
+  if (!more) {
     start_anim(ANIM_NONE);
-  } else {
-    app_timer_start(tim_anim_id, APP_TIMER_TICKS(call_again, APP_TIMER_PRESCALER), NULL);
+    PROF_END(PROF_ANIM);
+    return;
   }
-}
-static void lamp_timer(void * p_context) {
-  lamp_update();
+  // next step on grid, skip steps already missed
+  do {
+    app.anim_due += app.anim_step_ticks;
+    app_timer_cnt_diff_compute(app.anim_due, now, &next);
+  } while (next & 0x800000);
+  if (next < APP_TIMER_MIN_TIMEOUT_TICKS) next = APP_TIMER_MIN_TIMEOUT_TICKS;
+  app_timer_start(tim_anim_id, next, NULL);
+  PROF_END(PROF_ANIM);
 }
 
-uint32_t flash_write_fn(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src) {
-  start_anim(ANIM_WRITE);
-  // align src to 32 bits
-  uint32_t start = (uint32_t)(buf + offs);
-  uint32_t end = (uint32_t)(buf + offs + len);
-  uint32_t start_align_pre = (start & 3);
-  uint32_t end_align_post = (end & 3) == 0 ? 0 : (4 - (end & 3));
-  uint32_t aligned_size = (end + end_align_post) - (start - start_align_pre);
-  uint32_t wbuf[aligned_size/4];
-  memset(wbuf, 0xff, aligned_size);
-  memcpy((uint8_t *)wbuf + start_align_pre, src, len);
-  uint32_t *flash_addr = (uint32_t *)(start - start_align_pre);
-  print("app.flash write @ %08x, len %i\n", flash_addr, aligned_size);
-  uint32_t err_code;
-  err_code = softdevice_handler_sd_disable();
+void app_anim_stats(app_anim_stats_t *stats) {
+  *stats = app.anim_stats;
+}
 
-  err_code = ble_flash_block_write(flash_addr, wbuf, aligned_size/4);
+void app_frame_stats(app_frame_stats_t *stats) {
+  CRITICAL_REGION_ENTER();
+  *stats = app.frame_stats;
+  CRITICAL_REGION_EXIT();
+}
 
-  print("app.softdevice enabling\n");
+static void dither_timer(void * p_context) {
+  // refresh with next dithered frame, unless one is already on its way
+  if (!app.lamp_tx) {
+    lamp_update();
+  }
+}
 
-  start_softdevice();
+// Flash operations are queued and run by fstorage in between radio
+// events, the link stays up. Anything reading back what was written
+// waits for flash_idle.
+uint32_t flash_write_fn(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src) {
+  start_anim(ANIM_WRITE);
+  commitpol_write(&app.commitpol, len);
+  uint32_t err_code = flashq_write(buf, offs, len, src);
+  log_dbg("app.flash write @ %08x, len %i res %i\n", buf + offs, len, err_code);
   return err_code;
 }
 
 uint32_t flash_erase_fn(uint8_t *buf) {
-  lamp_set_color(0x880088, FALSE);
-  uint32_t err_code;
-  err_code = softdevice_handler_sd_disable();
-  print("app.softdevice disabled res %i\n", err_code);
-  volatile int a = 0x2000;
-  while(a--);
-
-  uint8_t page = (uint32_t)buf / BLE_FLASH_PAGE_SIZE;
-  err_code = ble_flash_page_erase(page);
-  print("app.flash erase page %i res %i\n", page, err_code);
-
-  print("app.softdevice enabling\n");
-  a = 0x2000;
-  while(a--);
-  start_softdevice();
-  lamp_set_color(app.lamp_rgb, FALSE);
+  int i;
+  if (!app.streaming) {
+    // purple until erased
+    for (i = 0; i < WS2812B_LEDS; i++) app.rgb[i] = px_rgb(0x880088);
+    lamp_update();
+  }
+  app.flash_erased = TRUE;
+  commitpol_erase(&app.commitpol);
+  uint32_t err_code = flashq_erase(buf);
+  log_dbg("app.flash erase page %i res %i\n", (uint32_t)buf / BLE_FLASH_PAGE_SIZE, err_code);
   return err_code;
 }
 
+static void save_trigger(void);
+
+// Commits settings, charging the commit policy only for a commit that
+// went through. A failed one, e.g. on a full flash queue, keeps its
+// values dirty and is tried again as if they just changed.
+static void settings_commit(void) {
+  uint32_t now;
+  if (tnv_commit(&app.tnv)) {
+    save_trigger();
+    return;
+  }
+  app_timer_cnt_get(&now);
+  commitpol_commit(&app.commitpol, now);
+}
+
+// Queued flash operations that failed leave flash behind what tnv has
+// committed. Settings go back to the last commit in flash, and those in
+// ram are committed again on a fresh page. The program is the one in
+// flash then.
+static void flash_recover(void) {
+  tnv_recover(&app.tnv);
+  lamp_load_program();
+  if (app.prog_run) lamp_set_program(TRUE, FALSE);
+  save_trigger();
+}
+
+static void flash_idle(uint32_t errors) {
+  log_info("app.flash idle, %i errors\n", errors);
+  if (errors) {
+    flash_recover();
+  } else {
+    lamp_follow_program();
+  }
+  if (app.flash_reset) {
+    app.flash_reset = FALSE;
+    settings_read();
+    start_anim(ANIM_NONE);
+  }
+  if (app.flash_prog) {
+    app.flash_prog = FALSE;
+    program_written();
+  }
+  if (app.flash_erased) {
+    app.flash_erased = FALSE;
+    if (app.anim_id == ANIM_NONE) start_anim(ANIM_NONE);
+  }
+  if (app.flash_prog_store) {
+    // dirty settings go with the program
+    app.flash_prog_store = FALSE;
+    app.flash_commit = FALSE;
+    program_commit();
+  } else if (app.flash_commit) {
+    app.flash_commit = FALSE;
+    settings_commit();
+  }
+}
+
 
 static void control_timer(void * p_context) {
   if (app.startup) {
     app.startup = FALSE;
-    lamp_set_color(app.lamp_rgb, FALSE);
+    start_anim(ANIM_NONE);
   } else if (app.factory_reset) {
     app.factory_reset = FALSE;
-    flash_erase_fn(app.tnv.buf);
-    settings_read();
-    lamp_set_color(app.lamp_rgb, FALSE);
+    // settings are read back in flash_idle
+    app.flash_reset = TRUE;
+    tnv_format(&app.tnv);
+    if (!flashq_busy()) flash_idle(0);
   } else {
-    tnv_commit(&app.tnv);
+    uint32_t now;
+    app_timer_cnt_get(&now);
+    uint32_t wait = commitpol_due(&app.commitpol, now);
+    if (wait) {
+      // held back by interval or budget
+      app_timer_start(tim_ctrl_id, MAX(wait, APP_TIMER_MIN_TIMEOUT_TICKS), NULL);
+      return;
+    }
+    if (flashq_busy()) {
+      // commits read back flash written before
+      app.flash_commit = TRUE;
+    } else {
+      settings_commit();
+    }
   }
 }
 
 static void save_trigger(void) {
+  uint32_t now;
+  app_timer_cnt_get(&now);
+  uint32_t wait = commitpol_change(&app.commitpol, now);
   app_timer_stop(tim_ctrl_id);
-  app_timer_start(tim_ctrl_id, APP_TIMER_TICKS(TIME_COMMIT_MS, APP_TIMER_PRESCALER), NULL);
+  app_timer_start(tim_ctrl_id, MAX(wait, APP_TIMER_MIN_TIMEOUT_TICKS), NULL);
+}
+
+static uint16_t ticks_to_us16(uint32_t ticks) {
+  uint32_t us = (ticks * 15625ULL) / 512;
+  return MIN(0xffff, us);
+}
+
+// logs radio on time and command to light latency of mode just left
+static void conn_log(uint8_t mode) {
+  int16_t duty[CONNPOL_MODES];
+  const connpol_stats_t *st = &app.connpol.stats[mode];
+  connpol_duty(&app.connpol, duty);
+  log_info("app.conn %s, left mode radio %i/10000, %i cmds, latency max %ius mean %ius\n",
+      mode == CONNPOL_FAST ? "idle" : "fast", duty[mode], st->cmds,
+      ticks_to_us16(st->latency_max), ticks_to_us16(st->cmds ? st->latency_sum / st->cmds : 0));
+}
+
+static void conn_fast(void) {
+  app_timer_stop(tim_conn_id);
+  app_timer_start(tim_conn_id, APP_TIMER_TICKS(TIME_CONN_IDLE_MS, APP_TIMER_PRESCALER), NULL);
+  if (connpol_traffic(&app.connpol)) {
+    conn_log(CONNPOL_IDLE);
+    conn_params_set(TRUE);
+  }
+}
+
+static void conn_timer(void * p_context) {
+  if (connpol_idle(&app.connpol)) {
+    conn_log(CONNPOL_FAST);
+    conn_params_set(FALSE);
+  }
+}
+
+void app_on_radio(bool active) {
+  uint32_t now;
+  if (!app.connected) return;
+  app_timer_cnt_get(&now);
+  connpol_radio(&app.connpol, active, now);
+}
+
+void app_commit_stats(commitpol_stats_t *stats) {
+  memcpy(stats, &app.commitpol.stats, sizeof(app.commitpol.stats));
+}
+
+void app_conn_stats(connpol_stats_t stats[CONNPOL_MODES]) {
+  memcpy(stats, app.connpol.stats, sizeof(app.connpol.stats));
+}
+
+static void telem_timer(void * p_context) {
+  const app_frame_stats_t *fs = &app.frame_stats;
+  const commitpol_stats_t *ms = &app.commitpol.stats;
+  uint8_t t[TELEM_LEN];
+  uint8_t *r = t;
+  uint32_t cmds = 0, latency_sum = 0, latency_max = 0;
+  int i;
+  for (i = 0; i < CONNPOL_MODES; i++) {
+    const connpol_stats_t *cs = &app.connpol.stats[i];
+    cmds += cs->cmds;
+    latency_sum += cs->latency_sum;
+    latency_max = MAX(latency_max, cs->latency_max);
+  }
+  uint32_t v32[2] = { fs->frames, fs->coalesced };
+  uint16_t v16[6] = {
+      ticks_to_us16(fs->spi_frames ? fs->spi_sum / fs->spi_frames : 0),
+      ticks_to_us16(fs->spi_max),
+      ticks_to_us16(cmds ? latency_sum / cmds : 0),
+      ticks_to_us16(latency_max),
+      MIN(0xffff, ms->commits),
+      MIN(0xffff, ms->erases) };
+  for (i = 0; i < 2; i++) {
+    *r++ = v32[i] >> 24; *r++ = v32[i] >> 16; *r++ = v32[i] >> 8; *r++ = v32[i];
+  }
+  for (i = 0; i < 6; i++) {
+    *r++ = v16[i] >> 8; *r++ = v16[i];
+  }
+  telem_update(t, sizeof(t));
 }
 
 void app_on_connected(void) {
-  print("app.on_connected\n");
+  log_info("app.on_connected\n");
+  app.connected = TRUE;
+  // link starts out with the fast preferred parameters
+  connpol_traffic(&app.connpol);
+  app_timer_stop(tim_conn_id);
+  app_timer_start(tim_conn_id, APP_TIMER_TICKS(TIME_CONN_IDLE_MS, APP_TIMER_PRESCALER), NULL);
+  telem_timer(NULL);
+  app_timer_start(tim_telem_id, APP_TIMER_TICKS(TIME_TELEM_MS, APP_TIMER_PRESCALER), NULL);
   start_anim(ANIM_CONNECT);
 }
 
 void app_on_disconnected(void) {
-  print("app.on_disconnected\n");
+  log_info("app.on_disconnected\n");
+  app.connected = FALSE;
+  app_timer_stop(tim_conn_id);
+  app_timer_stop(tim_telem_id);
+  if (app.streaming) lamp_stream_stop();
   start_anim(ANIM_DISCONNECT);
 }
 
+// binary command handlers return this when settings are changed
+#define CMD_SAVE          (1<<0)
+
+static uint32_t cmd_nop(const uint8_t *p, uint8_t len) {
+  return 0;
+}
+
+static uint32_t cmd_color(const uint8_t *p, uint8_t len) {
+  lamp_set_color((p[0] << 16) | (p[1] << 8) | p[2], TRUE);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_intensity(const uint8_t *p, uint8_t len) {
+  lamp_set_intensity(MIN(10, p[0]), TRUE);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_white_bal(const uint8_t *p, uint8_t len) {
+  lamp_set_white_balance((p[0] << 16) | (p[1] << 8) | p[2], TRUE);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_dither(const uint8_t *p, uint8_t len) {
+  lamp_set_dither(p[0] != 0, TRUE);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_user_val(const uint8_t *p, uint8_t len) {
+  lamp_store_user_value((p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_prog_upload(const uint8_t *p, uint8_t len) {
+  uint16_t offs = (p[0] << 8) | p[1];
+  len -= 2;
+  if (lamp_storing_program()) {
+    log_warn("app.prog upload while storing\n");
+    return 0;
+  }
+  if (offs > app.prog_up_len || offs + len > sizeof(app.prog_up)) {
+    log_warn("app.prog upload bad offset %i\n", offs);
+    return 0;
+  }
+  memcpy(&app.prog_up[offs], &p[2], len);
+  app.prog_up_len = offs + len;
+  return 0;
+}
+
+static uint32_t cmd_prog_store(const uint8_t *p, uint8_t len) {
+  lamp_store_program(TRUE);
+  return 0;
+}
+
+static uint32_t cmd_prog_run(const uint8_t *p, uint8_t len) {
+  lamp_set_program(p[0] != 0, TRUE);
+  return CMD_SAVE;
+}
+
+static uint32_t cmd_error(const uint8_t *p, uint8_t len) {
+  start_anim(ANIM_ERROR);
+  return 0;
+}
+
+static uint32_t cmd_reload(const uint8_t *p, uint8_t len) {
+  tnv_reload(&app.tnv);
+  return 0;
+}
+
+static uint32_t cmd_factory_reset(const uint8_t *p, uint8_t len) {
+  app.factory_reset = TRUE;
+  return CMD_SAVE;
+}
+
+// Streamed frames go straight to the leds, nothing is stored.
+static uint32_t cmd_stream(const uint8_t *p, uint8_t len) {
+  uint32_t now;
+  app_timer_cnt_get(&now);
+  if (!app.streaming) lamp_stream_start();
+  app_timer_stop(tim_stream_id);
+  app_timer_start(tim_stream_id, APP_TIMER_TICKS(TIME_STREAM_IDLE_MS, APP_TIMER_PRESCALER), NULL);
+  if (stream_put(&app.stream, p, len, now) == STREAM_FRAME) {
+    memcpy(app.rgb, app.stream_rgb, sizeof(app.rgb));
+    app.stream_enc = true;
+    app.stream_enc_t = app.stream.t_first;
+    lamp_update();
+  }
+  return 0;
+}
+
+static uint32_t cmd_stream_stats(const uint8_t *p, uint8_t len) {
+  const stream_stats_t *st = &app.stream.stats;
+  uint8_t rsp[CMD_HDR_LEN + 2 + 14];
+  uint8_t *r = rsp;
+  uint16_t v[5] = {
+      MIN(0xffff, st->late),
+      MIN(0xffff, st->incomplete),
+      ticks_to_us16(st->latency_last),
+      ticks_to_us16(st->latency_max),
+      ticks_to_us16(st->latched ? st->latency_sum / st->latched : 0) };
+  int i;
+  *r++ = CMD_MAGIC | CMD_VERSION;
+  *r++ = CMD_STREAM_STATS;
+  *r++ = sizeof(rsp) - CMD_HDR_LEN - 2;
+  *r++ = st->frames >> 24; *r++ = st->frames >> 16; *r++ = st->frames >> 8; *r++ = st->frames;
+  for (i = 0; i < 5; i++) {
+    *r++ = v[i] >> 8; *r++ = v[i];
+  }
+  nus_send(rsp, sizeof(rsp));
+  return 0;
+}
+
+static uint32_t cmd_commit_stats(const uint8_t *p, uint8_t len) {
+  const commitpol_stats_t *st = &app.commitpol.stats;
+  uint8_t rsp[CMD_HDR_LEN + 2 + 16];
+  uint8_t *r = rsp;
+  uint32_t v[3] = { st->commits, st->bytes, st->erases };
+  uint16_t latency_s = MIN(0xffff, st->latency_max / APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER));
+  int i;
+  *r++ = CMD_MAGIC | CMD_VERSION;
+  *r++ = CMD_COMMIT_STATS;
+  *r++ = sizeof(rsp) - CMD_HDR_LEN - 2;
+  for (i = 0; i < 3; i++) {
+    *r++ = v[i] >> 24; *r++ = v[i] >> 16; *r++ = v[i] >> 8; *r++ = v[i];
+  }
+  *r++ = MIN(0xffff, st->deferred) >> 8; *r++ = MIN(0xffff, st->deferred);
+  *r++ = latency_s >> 8; *r++ = latency_s;
+  nus_send(rsp, sizeof(rsp));
+  return 0;
+}
+
+static uint32_t cmd_log_read(const uint8_t *p, uint8_t len) {
+  uint8_t rsp[CMD_HDR_LEN + 2 + LOG_READ_MAX];
+  uint32_t n = log_read(&rsp[CMD_HDR_LEN + 2], MIN(p[0], LOG_READ_MAX));
+  rsp[0] = CMD_MAGIC | CMD_VERSION;
+  rsp[1] = CMD_LOG_READ;
+  rsp[2] = n;
+  nus_send(rsp, CMD_HDR_LEN + 2 + n);
+  return 0;
+}
+
+static uint32_t cmd_prof_stats(const uint8_t *p, uint8_t len) {
+  if (p[0] == PROF_CLEAR) {
+    prof_clear();
+    return 0;
+  }
+  if (p[0] >= PROF_POINTS) return 0;
+  prof_stats_t st;
+  prof_stats(p[0], &st);
+  uint8_t rsp[CMD_HDR_LEN + 2 + 1 + 16 + 2 * PROF_BUCKETS];
+  uint8_t *r = rsp;
+  uint32_t v[4] = { st.count, st.min, st.max, st.count ? st.sum / st.count : 0 };
+  int i;
+  *r++ = CMD_MAGIC | CMD_VERSION;
+  *r++ = CMD_PROF_STATS;
+  *r++ = sizeof(rsp) - CMD_HDR_LEN - 2;
+  *r++ = p[0];
+  for (i = 0; i < 4; i++) {
+    *r++ = v[i] >> 24; *r++ = v[i] >> 16; *r++ = v[i] >> 8; *r++ = v[i];
+  }
+  for (i = 0; i < PROF_BUCKETS; i++) {
+    *r++ = MIN(0xffff, st.hist[i]) >> 8; *r++ = MIN(0xffff, st.hist[i]);
+  }
+  nus_send(rsp, sizeof(rsp));
+  return 0;
+}
+
+static const cmd_def_t CMDS[] = {
+  [CMD_NOP]           = { cmd_nop,           0, 255 },
+  [CMD_COLOR]         = { cmd_color,         3, 3 },
+  [CMD_INTENSITY]     = { cmd_intensity,     1, 1 },
+  [CMD_WHITE_BAL]     = { cmd_white_bal,     3, 3 },
+  [CMD_DITHER]        = { cmd_dither,        1, 1 },
+  [CMD_USER_VAL]      = { cmd_user_val,      4, 4 },
+  [CMD_PROG_UPLOAD]   = { cmd_prog_upload,   2, 255 },
+  [CMD_PROG_STORE]    = { cmd_prog_store,    0, 0 },
+  [CMD_PROG_RUN]      = { cmd_prog_run,      1, 1 },
+  [CMD_ERROR]         = { cmd_error,         0, 0 },
+  [CMD_RELOAD]        = { cmd_reload,        0, 0 },
+  [CMD_FACTORY_RESET] = { cmd_factory_reset, 0, 0 },
+  [CMD_STREAM]        = { cmd_stream,        STREAM_HDR_LEN, 255 },
+  [CMD_STREAM_STATS]  = { cmd_stream_stats,  0, 0 },
+  [CMD_COMMIT_STATS]  = { cmd_commit_stats,  0, 0 },
+  [CMD_LOG_READ]      = { cmd_log_read,      1, 1 },
+  [CMD_PROF_STATS]    = { cmd_prof_stats,    1, 1 },
+};
+
+static void app_on_cmd(uint8_t *data, uint16_t len);
+
 void app_on_data(uint8_t *data, uint16_t len) {
+  PROF_START(PROF_ON_DATA);
+  conn_fast();
+  // leds changed by the command are tagged in lamp_update
+  app_timer_cnt_get(&app.cmd_t);
+  app.cmd_pending = TRUE;
+  app_on_cmd(data, len);
+  app.cmd_pending = FALSE;
+  PROF_END(PROF_ON_DATA);
+}
+
+static void app_on_cmd(uint8_t *data, uint16_t len) {
+  if (CMD_IS_BINARY(data, len)) {
+    int32_t res = cmd_dispatch(CMDS, sizeof(CMDS)/sizeof(CMDS[0]), data, len);
+    // quiet unless failing, streaming sends lots of these
+    if (res < 0) log_warn("app.cmd len %i res %i\n", len, res);
+    if (res > 0 && (res & CMD_SAVE)) {
+      save_trigger();
+    }
+    return;
+  }
+  if (len >= 1 && data[0] == 'l') {
+    // deferred log entries, see host/logdec.c
+    log_dump();
+    return;
+  }
   if (len < 2) return;
   bool trigger_save = TRUE;
   int i;
+#if LOG_TEXT(LOG_LEVEL_DBG)
   for (i = 0; i < len; i++) {
     print("%c", data[i]);
   }
   print("\n");
+#else
+  // text is gone when deferred entries are read, the command is kept
+  log_dbg("app.cmd %c len %i\n", data[0], len);
+#endif
   if (data[0] == 'i') {
     int intens = atoin((char *)&data[1], 10, len-1);
     intens = MIN(10, intens);
     intens = MAX(0, intens);
     lamp_set_intensity(intens, TRUE);
   }
+  else if (data[0] == 'd') {
+    lamp_set_dither(atoin((char *)&data[1], 10, len-1) != 0, TRUE);
+  }
   else if (data[0] == 's') {
     uint32_t x = atoin((char *)&data[1], 16, len-1);
     lamp_store_user_value(x);
@@ -308,6 +1106,28 @@ void app_on_data(uint8_t *data, uint16_t len) {
     uint32_t rgb = atoin((char *)&data[1], 16, len-1);
     lamp_set_color(rgb, TRUE);
   }
+  else if (data[0] == 'p') {
+    // p+<hex> appends to upload, p= stores upload, p1/p0 runs/stops program
+    trigger_save = false;
+    if ((data[1] == '+' || data[1] == '-') && lamp_storing_program()) {
+      log_warn("app.prog upload while storing\n");
+    } else if (data[1] == '+') {
+      for (i = 2; i + 1 < len && app.prog_up_len < sizeof(app.prog_up); i += 2) {
+        app.prog_up[app.prog_up_len++] = atoin((char *)&data[i], 16, 2);
+      }
+    } else if (data[1] == '=') {
+      lamp_store_program(FALSE);
+    } else if (data[1] == '-') {
+      app.prog_up_len = 0;
+    } else {
+      lamp_set_program(data[1] == '1', TRUE);
+      trigger_save = TRUE;
+    }
+  }
+  else if (len > 2 && strncmp((char *)data, "wb", 2) == 0) {
+    uint32_t wb = atoin((char *)&data[2], 16, len-2);
+    lamp_set_white_balance(wb & 0xffffff, TRUE);
+  }
   else if (len == 4 && strncmp((char *)data, "warm", 4) == 0) {
     lamp_set_color(COLOR_DEFAULT, TRUE);
   }
@@ -362,30 +1182,66 @@ void app_on_data(uint8_t *data, uint16_t len) {
 
 static void settings_read(void) {
   tnv_init(&app.tnv,
-      (uint8_t *)((BLE_FLASH_PAGE_END - 1) * BLE_FLASH_PAGE_SIZE),
+      (uint8_t *)((BLE_FLASH_PAGE_END - TNV_PAGES) * BLE_FLASH_PAGE_SIZE),
+      BLE_FLASH_PAGE_SIZE, TNV_PAGES,
       flash_write_fn, flash_erase_fn);
   app.lamp_intens = tnv_get(&app.tnv, TNV_INTENSITY, 5);
   app.lamp_rgb = tnv_get(&app.tnv, TNV_RGB, COLOR_DEFAULT);
+  app.lamp_white_bal = tnv_get(&app.tnv, TNV_WHITE_BAL, 0xffffff);
+  app.dither = tnv_get(&app.tnv, TNV_DITHER, 0);
   uint32_t user_val = tnv_get(&app.tnv, TNV_USER_VAL, 0);
-  print("tnv.int:%i\n", app.lamp_intens);
-  print("tnv.rgb:%08x\n", app.lamp_rgb);
-  print("tnv.usr:%08x\n", user_val);
+  lamp_load_program();
+  app.prog_run = tnv_get(&app.tnv, TNV_PROGRAM, 0) && app.pvm.code;
+  lamp_build_lut();
+  log_info("tnv.int:%i\n", app.lamp_intens);
+  log_info("tnv.rgb:%08x\n", app.lamp_rgb);
+  log_info("tnv.wb:%06x\n", app.lamp_white_bal);
+  log_info("tnv.dither:%i\n", app.dither);
+  log_info("tnv.prog:%i\n", app.prog_run);
+  log_info("tnv.usr:%08x\n", user_val);
+}
+
+static uint32_t log_now(void) {
+  uint32_t now;
+  app_timer_cnt_get(&now);
+  return now;
 }
 
 void app_init(void) {
   uint32_t err_code;
-  print("\n\napp.init\n");
+  uint8_t strip;
+  log_init(log_now);
+  prof_init();
+  log_info("\n\napp.init\n");
   memset(&app, 0, sizeof(app));
+  anim_init(&app.anim, app.rgb, WS2812B_LEDS);
+  stream_init(&app.stream, app.stream_rgb, WS2812B_LEDS);
+  connpol_init(&app.connpol, APP_TIMER_TICKS(RADIO_LEAD_US, APP_TIMER_PRESCALER) / 1000);
+  uint32_t now;
+  app_timer_cnt_get(&now);
+  commitpol_init(&app.commitpol,
+      APP_TIMER_TICKS(TIME_COMMIT_MS, APP_TIMER_PRESCALER),
+      APP_TIMER_TICKS(TIME_COMMIT_MAX_MS, APP_TIMER_PRESCALER),
+      APP_TIMER_TICKS(TIME_COMMIT_MIN_MS, APP_TIMER_PRESCALER),
+      COMMITS_PER_HOUR, APP_TIMER_TICKS(3600000, APP_TIMER_PRESCALER), now);
+  err_code = flashq_init(flash_idle);
+  log_info("app: flashq init res %i\n", err_code);
 
   err_code = app_timer_create(&tim_anim_id, APP_TIMER_MODE_SINGLE_SHOT, anim_timer);
-  print("app: tim_anim creat res %i\n", err_code);
-  err_code = app_timer_create(&tim_lamp_id, APP_TIMER_MODE_SINGLE_SHOT, lamp_timer);
-  print("app: tim_lamp creat res %i\n", err_code);
+  log_info("app: tim_anim creat res %i\n", err_code);
   err_code = app_timer_create(&tim_ctrl_id, APP_TIMER_MODE_SINGLE_SHOT, control_timer);
-  print("app: tim_save creat res %i\n", err_code);
+  log_info("app: tim_save creat res %i\n", err_code);
+  err_code = app_timer_create(&tim_dither_id, APP_TIMER_MODE_REPEATED, dither_timer);
+  log_info("app: tim_dither creat res %i\n", err_code);
+  err_code = app_timer_create(&tim_stream_id, APP_TIMER_MODE_SINGLE_SHOT, stream_timer);
+  log_info("app: tim_stream creat res %i\n", err_code);
+  err_code = app_timer_create(&tim_conn_id, APP_TIMER_MODE_SINGLE_SHOT, conn_timer);
+  log_info("app: tim_conn creat res %i\n", err_code);
+  err_code = app_timer_create(&tim_telem_id, APP_TIMER_MODE_REPEATED, telem_timer);
+  log_info("app: tim_telem creat res %i\n", err_code);
   nrf_drv_spi_config_t config = {                                                            \
       .sck_pin      = NRF_DRV_SPI_PIN_NOT_USED,
-      .mosi_pin     = PIN_MOSI_NUMBER, //NRF_DRV_SPI_PIN_NOT_USED,
+      .mosi_pin     = NRF_DRV_SPI_PIN_NOT_USED,
       .miso_pin     = NRF_DRV_SPI_PIN_NOT_USED,
       .ss_pin       = NRF_DRV_SPI_PIN_NOT_USED,
       .irq_priority = SPI_DEFAULT_CONFIG_IRQ_PRIORITY,
@@ -394,15 +1250,23 @@ void app_init(void) {
       .mode         = NRF_DRV_SPI_MODE_3,
       .bit_order    = NRF_DRV_SPI_BIT_ORDER_MSB_FIRST,
   };
-  err_code = nrf_drv_spi_init(&spi, &config, spi_handler);
-  print("app: spi_init res %i\n", err_code);
+  err_code = nrf_drv_ppi_init();
+  log_info("app: ppi_init res %i\n", err_code);
+  for (strip = 0; strip < WS2812B_STRIPS; strip++) {
+    config.mosi_pin = spi_mosi_pins[strip];
+    err_code = nrf_drv_spi_init(&spi[strip], &config, spi_handler);
+    log_info("app: spi%i_init res %i\n", strip, err_code);
+    err_code = lamp_tx_chain(strip);
+    log_info("app: spi%i_chain res %i\n", strip, err_code);
+  }
 
-  rand_seed(0x12312312);
+  // softdevice is up, its rng pool is ours
+  rand_seed(rng_seed());
   settings_read();
   app.startup = TRUE;
   app_timer_start(tim_ctrl_id, APP_TIMER_TICKS(TIME_START_LAMP_MS, APP_TIMER_PRESCALER), NULL);
 
-  print("app.init finished\n");
+  log_info("app.init finished\n");
 }
 
 void HardFault_process(HardFault_stack_t * p_stack)
@@ -10,19 +10,120 @@
 
 #include "system_config.h"
 #include "ble_flash.h"
+#include "connpol.h"
+#include "commitpol.h"
 
-#define TNV_BUF_SIZE              BLE_FLASH_PAGE_SIZE
+// settings ring, last pages of flash, with the program blob below
+#define TNV_PAGES                 4
 #define TNV_ID_BITS               4
 #define TNV_LEN_BITS              5
 
+// settings are committed this long after the last change, but at most
+// TIME_COMMIT_MAX_MS after the first, see commitpol.h
 #define TIME_COMMIT_MS            10000
+#define TIME_COMMIT_MAX_MS        60000
+#define TIME_COMMIT_MIN_MS        30000
+#define COMMITS_PER_HOUR          30
 #define TIME_START_LAMP_MS        230
+#define TIME_DITHER_MS            5
+// instructions per animation step for uploaded pixel programs
+#define PROG_BUDGET               2000
+// commits of an uploaded program before giving up on flash
+#define PROG_STORE_TRIES          3
+#define TIME_PROG_MIN_MS          10
+// streaming ends when no chunks are received for this long
+#define TIME_STREAM_IDLE_MS       2000
+// link goes idle when nothing is received for this long
+#define TIME_CONN_IDLE_MS         10000
+// connection parameters while there is traffic and when idle
+#define CONN_FAST_MIN_MS          15
+#define CONN_FAST_MAX_MS          30
+#define CONN_IDLE_MIN_MS          100
+#define CONN_IDLE_MAX_MS          200
+#define CONN_IDLE_LATENCY         4
+#define CONN_SUP_TIMEOUT_MS       4000
+// radio notification distance, see main.c
+#define RADIO_LEAD_US             800
+// telemetry characteristic is updated this often while connected
+#define TIME_TELEM_MS             1000
 #define COLOR_DEFAULT             0xffaa22
 
+// binary command opcodes, see cmd.h for framing
+#define CMD_NOP                   0x00
+// rgb as 3 bytes
+#define CMD_COLOR                 0x01
+// 0..10
+#define CMD_INTENSITY             0x02
+// rgb as 3 bytes
+#define CMD_WHITE_BAL             0x03
+// 0 or 1
+#define CMD_DITHER                0x04
+// 32 bits big endian
+#define CMD_USER_VAL              0x05
+// 16 bit big endian offset followed by program bytes, offset 0 restarts upload
+#define CMD_PROG_UPLOAD           0x06
+// stores and runs uploaded program, replies with CMD_PROG_STORE and 0
+// once it is in flash, or 1 if it could not be stored
+#define CMD_PROG_STORE            0x07
+// 0 or 1
+#define CMD_PROG_RUN              0x08
+#define CMD_ERROR                 0x09
+#define CMD_RELOAD                0x0a
+#define CMD_FACTORY_RESET         0x0b
+// stream chunk, see stream.h
+#define CMD_STREAM                0x0c
+// replies with CMD_STREAM_STATS: frames as 32 bits, then late chunks,
+// incomplete frames, latency last, max and mean in us as 16 bits, big endian
+#define CMD_STREAM_STATS          0x0d
+// replies with CMD_COMMIT_STATS: commits, bytes written and erases as 32
+// bits, then deferred commits and max latency in s as 16 bits, big endian
+#define CMD_COMMIT_STATS          0x0e
+// max reply length as 8 bits, replies with CMD_LOG_READ: oldest deferred
+// log entries as 32 bit little endian words, see log.h
+#define CMD_LOG_READ              0x0f
+#define LOG_READ_MAX              240
+// profiled point as 8 bits, see prof.h, replies with CMD_PROF_STATS: point,
+// then count, min, max and mean in PROF_HZ units as 32 bits, then the
+// histogram as 16 bits, big endian. PROF_CLEAR clears all points.
+#define CMD_PROF_STATS            0x10
+#define PROF_CLEAR                0xff
+
+// Telemetry characteristic value, big endian: frames encoded and frames
+// coalesced as 32 bits, then spi transfer time mean and max, command to
+// leds latency mean and max in us, commits and erases as 16 bits.
+#define TELEM_LEN                 20
+
+typedef struct {
+  // frames encoded, and encoded frames replaced by a later one before
+  // they were sent
+  uint32_t frames;
+  uint32_t coalesced;
+  // spi transfer time of sent frames, in app timer ticks
+  uint32_t spi_frames;
+  uint32_t spi_max;
+  uint32_t spi_sum;
+} app_frame_stats_t;
+
+typedef struct {
+  uint32_t steps;
+  // lateness of animation steps versus schedule, in app timer ticks
+  uint32_t late_max;
+  uint32_t late_sum;
+} app_anim_stats_t;
+
 void app_init(void);
 void app_on_connected(void);
 void app_on_disconnected(void);
 void app_on_data(uint8_t *data, uint16_t len);
+void app_on_radio(bool active);
+void app_anim_stats(app_anim_stats_t *stats);
+void app_frame_stats(app_frame_stats_t *stats);
+void app_commit_stats(commitpol_stats_t *stats);
+void app_conn_stats(connpol_stats_t stats[CONNPOL_MODES]);
 
 void start_softdevice(void); // in main.c, yeah, pretty ugly
+uint32_t nus_send(uint8_t *data, uint16_t len); // in main.c
+uint32_t telem_update(uint8_t *data, uint16_t len); // in main.c
+uint32_t rng_seed(void); // in main.c
+void conn_params_set(bool fast); // in main.c
 #endif /* APP_H_ */
@@ -47,6 +47,14 @@
  * Bitmanio has an upper limit of 2^23 number of bytes in total for an
  * array or stream.
  *
+ * Streams also give access to fields of up to 32 bits whatever the
+ * memory size, by bitmanio_readw<X> and bitmanio_writew<X>. On little
+ * endian targets with memory of at most 32 bits these read whole
+ * aligned 32 bit words instead of looping over the memory units, so
+ * a field is read by one or two loads. Many fields of same bit range
+ * are read and written in one call by bitmanio_read_n<X> and
+ * bitmanio_write_n<X>.
+ *
  * The header file contains both API and implementation.
  * To include this library as both header and implementation in your
  * source, define
@@ -106,6 +114,18 @@
   #error BITMANIO_STORAGE_BITS must be 8, 16, 32, or 64
 #endif
 
+/* word loads, memory units in stream order from msb */
+#undef __BM_WORD
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  #if   BITMANIO_STORAGE_BITS == 8
+    #define __BM_WORD(w) __builtin_bswap32(w)
+  #elif BITMANIO_STORAGE_BITS == 16
+    #define __BM_WORD(w) (((w) << 16) | ((w) >> 16))
+  #elif BITMANIO_STORAGE_BITS == 32
+    #define __BM_WORD(w) (w)
+  #endif
+#endif
+
 #undef  __BM_FILTERED
 #define __BM_FILTERED             0
 
@@ -333,6 +353,210 @@ uint32_t __BM_FN(bitmanio_getpos, __BM_FN_PF)(
 }
 #endif
 
+/**
+ * Reads up to 32 bits from bitmanio memory stream.
+ * @param bs    pointer a bitmanio_stream<X>_t struct
+ * @param bits  number of bits to read, 1 to 32
+ * @return read value from stream
+ */
+uint32_t __BM_FN(bitmanio_readw, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+#ifdef __BM_WORD
+  // only the low address bits are needed, long is pointer wide on both
+  // target and host
+  const uint8_t *p = (const uint8_t *)&bs->mem[bs->m_offs];
+  uint8_t mis = (unsigned long)p & 3;
+  const uint32_t *w = (const uint32_t *)(p - mis);
+  uint8_t offs = mis * 8 + bs->b_offs;
+  uint32_t v = __BM_WORD(w[0]) << offs;
+  if (offs + bits > 32) v |= __BM_WORD(w[1]) >> (32 - offs);
+  uint32_t end = bs->b_offs + bits;
+  bs->m_offs += end / __BM_TBITS;
+  bs->b_offs = end & (__BM_TBITS - 1);
+  return bits == 32 ? v : v >> (32 - bits);
+#elif __BM_FN_PF == 64
+  return __BM_FN(bitmanio_read, __BM_FN_PF)(bs, bits);
+#else
+  uint32_t v = 0;
+  while (bits > __BM_TBITS) {
+    bits -= __BM_TBITS;
+    v |= (uint32_t)__BM_FN(bitmanio_read, __BM_FN_PF)(bs, __BM_TBITS) << bits;
+  }
+  return v | __BM_FN(bitmanio_read, __BM_FN_PF)(bs, bits);
+#endif
+}
+#endif
+
+/**
+ * Reads up to 32 inverted bits from bitmanio memory stream.
+ * @param bs    pointer a bitmanio_stream<X>_t struct
+ * @param bits  number of bits to read, 1 to 32
+ * @return read value from stream
+ */
+uint32_t __BM_FN(bitmanio_readw_z, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+  uint32_t v = ~__BM_FN(bitmanio_readw, __BM_FN_PF)(bs, bits);
+  return bits == 32 ? v : v & (((uint32_t)1 << bits) - 1);
+}
+#endif
+
+/**
+ * Writes up to 32 bits to bitmanio memory stream. Only the memory
+ * units covered by the field are written.
+ * @param bs   pointer a bitmanio_stream<X>_t struct
+ * @param v    the value to write
+ * @param bits number of bits to write, 1 to 32
+ */
+void __BM_FN(bitmanio_writew, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  uint32_t v,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+#if __BM_FN_PF == 64
+  __BM_FN(bitmanio_write, __BM_FN_PF)(bs, v, bits);
+#else
+  if (bits < 32) v &= ((uint32_t)1 << bits) - 1;
+  __BM_TYPE *d = &bs->mem[bs->m_offs];
+  uint32_t end = bs->b_offs + bits;
+  /* field left aligned from first unit */
+  uint64_t w = (uint64_t)v << (64 - end);
+  uint32_t n = (end + __BM_TBITS - 1) / __BM_TBITS;
+  while (n--) {
+    *d++ |= (__BM_TYPE)(w >> (64 - __BM_TBITS));
+    w <<= __BM_TBITS;
+  }
+  bs->m_offs += end / __BM_TBITS;
+  bs->b_offs = end & (__BM_TBITS - 1);
+#endif
+}
+#endif
+
+/**
+ * Writes up to 32 inverted bits to bitmanio memory stream. Only the
+ * memory units covered by the field are written.
+ * @param bs   pointer a bitmanio_stream<X>_t struct
+ * @param v    the value to write
+ * @param bits number of bits to write, 1 to 32
+ */
+void __BM_FN(bitmanio_writew_z, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  uint32_t v,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+#if __BM_FN_PF == 64
+  __BM_FN(bitmanio_write_z, __BM_FN_PF)(bs, v, bits);
+#else
+  if (bits < 32) v &= ((uint32_t)1 << bits) - 1;
+  __BM_TYPE *d = &bs->mem[bs->m_offs];
+  uint32_t end = bs->b_offs + bits;
+  uint64_t w = (uint64_t)v << (64 - end);
+  uint32_t n = (end + __BM_TBITS - 1) / __BM_TBITS;
+  while (n--) {
+    *d++ &= ~(__BM_TYPE)(w >> (64 - __BM_TBITS));
+    w <<= __BM_TBITS;
+  }
+  bs->m_offs += end / __BM_TBITS;
+  bs->b_offs = end & (__BM_TBITS - 1);
+#endif
+}
+#endif
+
+/**
+ * Reads a number of values of same bit range from bitmanio memory
+ * stream.
+ * @param bs    pointer a bitmanio_stream<X>_t struct
+ * @param dst   where to put the read values
+ * @param n     number of values to read
+ * @param bits  number of bits of each value
+ */
+void __BM_FN(bitmanio_read_n, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  __BM_TYPE *dst,
+  uint32_t n,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+  __BM_TYPE *d = &bs->mem[bs->m_offs];
+  uint8_t b_offs = bs->b_offs;
+  __BM_TYPE m = bits == __BM_TBITS ? (__BM_TYPE)~0 : (__BM_TYPE)(((__BM_TYPE)1<<bits)-1);
+  while (n--) {
+    __BM_TYPE v;
+    if (b_offs + bits > __BM_TBITS) {
+      uint8_t shift = 2 * __BM_TBITS - (b_offs + bits);
+      v = (d[1] >> shift) | (d[0] << (__BM_TBITS - shift));
+    } else {
+      v = d[0] >> (__BM_TBITS - (bits + b_offs));
+    }
+    *dst++ = v & m;
+    b_offs += bits;
+    if (b_offs >= __BM_TBITS) {
+      b_offs -= __BM_TBITS;
+      d++;
+    }
+  }
+  bs->m_offs = d - bs->mem;
+  bs->b_offs = b_offs;
+}
+#endif
+
+/**
+ * Writes a number of values of same bit range to bitmanio memory
+ * stream.
+ * @param bs    pointer a bitmanio_stream<X>_t struct
+ * @param src   the values to write
+ * @param n     number of values to write
+ * @param bits  number of bits of each value
+ */
+void __BM_FN(bitmanio_write_n, __BM_FN_PF)(
+  __BM_TP(bitmanio_stream, __BM_FN_PF) *bs,
+  const __BM_TYPE *src,
+  uint32_t n,
+  uint8_t bits)
+#ifndef __BM_IMPLEMENTATION
+;
+#else
+{
+  __BM_TYPE *d = &bs->mem[bs->m_offs];
+  uint8_t b_offs = bs->b_offs;
+  __BM_TYPE m = bits == __BM_TBITS ? (__BM_TYPE)~0 : (__BM_TYPE)(((__BM_TYPE)1<<bits)-1);
+  while (n--) {
+    __BM_TYPE v = *src++ & m;
+    if (b_offs + bits > __BM_TBITS) {
+      uint8_t shift = 2 * __BM_TBITS - (b_offs + bits);
+      d[1] |= v << shift;
+      d[0] |= v >> (__BM_TBITS - shift);
+    } else {
+      d[0] |= v << (__BM_TBITS - (bits + b_offs));
+    }
+    b_offs += bits;
+    if (b_offs >= __BM_TBITS) {
+      b_offs -= __BM_TBITS;
+      d++;
+    }
+  }
+  bs->m_offs = d - bs->mem;
+  bs->b_offs = b_offs;
+}
+#endif
+
 /**
  * Initializes bitmanio memory array.
  * In contranst to memory streams, the given memory does not have to
@@ -0,0 +1,36 @@
+/*
+ * cmd.c
+ *
+ *  Binary command framing and dispatch.
+ */
+
+#include "cmd.h"
+#include "miniutils.h"
+
+int32_t cmd_dispatch(const cmd_def_t *table, uint8_t ops,
+                     const uint8_t *data, uint16_t len) {
+  uint16_t i;
+  if (!CMD_IS_BINARY(data, len)) return CMD_ERR_FRAMING;
+  if ((data[0] & CMD_VERSION_MASK) != CMD_VERSION) return CMD_ERR_VERSION;
+  if (data[0] & CMD_F_CRC) {
+    uint16_t crc = 0xffff;
+    if (len < CMD_HDR_LEN + CMD_CRC_LEN) return CMD_ERR_FRAMING;
+    len -= CMD_CRC_LEN;
+    for (i = 0; i < len; i++) crc = crc_ccitt_16(crc, data[i]);
+    if (crc != ((data[len] << 8) | data[len+1])) return CMD_ERR_CRC;
+  }
+
+  // check all before running any, a packet is run as a whole or not at all
+  for (i = CMD_HDR_LEN; i < len; i += 2 + data[i+1]) {
+    uint8_t op = data[i];
+    if (i + 2 > len || i + 2 + data[i+1] > len) return CMD_ERR_FRAMING;
+    if (op >= ops || table[op].fn == 0) return CMD_ERR_OPCODE;
+    if (data[i+1] < table[op].min_len || data[i+1] > table[op].max_len) return CMD_ERR_LEN;
+  }
+
+  uint32_t flags = 0;
+  for (i = CMD_HDR_LEN; i < len; i += 2 + data[i+1]) {
+    flags |= table[data[i]].fn(&data[i+2], data[i+1]);
+  }
+  return flags;
+}
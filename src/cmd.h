@@ -0,0 +1,52 @@
+/*
+ * cmd.h
+ *
+ * Binary command framing. A packet is a header byte followed by any
+ * number of commands, each an opcode, a payload length and the payload.
+ * If flagged in the header, the packet ends with a crc_ccitt_16 of all
+ * preceding bytes, big endian. Header has the top bit set, so packets
+ * never collide with text commands.
+ *
+ *   [hdr] [op len payload..] [op len payload..] .. [crc hi crc lo]
+ *
+ * hdr: 0xb0 | CMD_F_CRC | version
+ */
+
+#ifndef CMD_H_
+#define CMD_H_
+
+#include "system.h"
+
+#define CMD_MAGIC           0xb0
+#define CMD_MAGIC_MASK      0xf0
+#define CMD_F_CRC           0x08
+#define CMD_VERSION_MASK    0x07
+#define CMD_VERSION         1
+#define CMD_HDR_LEN         1
+#define CMD_CRC_LEN         2
+
+#define CMD_ERR_VERSION     -1
+#define CMD_ERR_CRC         -2
+#define CMD_ERR_FRAMING     -3
+#define CMD_ERR_OPCODE      -4
+#define CMD_ERR_LEN         -5
+
+#define CMD_IS_BINARY(data, len) \
+  ((len) >= CMD_HDR_LEN && ((data)[0] & CMD_MAGIC_MASK) == CMD_MAGIC)
+
+// command handler, returns flags that are or:ed together for the packet
+typedef uint32_t (* cmd_fn_t)(const uint8_t *payload, uint8_t len);
+
+typedef struct {
+  cmd_fn_t fn;
+  uint8_t min_len;
+  uint8_t max_len;
+} cmd_def_t;
+
+// Checks the whole packet and then runs its commands, using opcode as
+// index into table. Returns or:ed handler flags, or negative error if
+// the packet is rejected, in which case nothing was run.
+int32_t cmd_dispatch(const cmd_def_t *table, uint8_t ops,
+                     const uint8_t *data, uint16_t len);
+
+#endif /* CMD_H_ */
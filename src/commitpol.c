@@ -0,0 +1,82 @@
+/*
+ * commitpol.c
+ *
+ *  Settings commit policy.
+ */
+
+#include "commitpol.h"
+#include "nordic_common.h"
+
+// app timer counter width
+#define TICKS_MASK    0xffffff
+
+static uint32_t add_sat(uint32_t a, uint32_t b, uint32_t max) {
+  return a + b > max || a + b < a ? max : a + b;
+}
+
+static void advance(commitpol_t *p, uint32_t now) {
+  uint32_t dt = (now - p->t) & TICKS_MASK;
+  p->t = now;
+  p->pending_age = add_sat(p->pending_age, dt, 0xffffffff);
+  p->quiet_age = add_sat(p->quiet_age, dt, 0xffffffff);
+  p->commit_age = add_sat(p->commit_age, dt, 0xffffffff);
+  p->credit = add_sat(p->credit, dt, p->credit_max);
+}
+
+void commitpol_init(commitpol_t *p, uint32_t quiet, uint32_t max_latency,
+    uint32_t min_interval, uint32_t per_hour, uint32_t hour, uint32_t now) {
+  memset(p, 0, sizeof(commitpol_t));
+  p->quiet = quiet;
+  p->max_latency = max_latency;
+  p->min_interval = min_interval;
+  p->cost = per_hour ? hour / per_hour : 0;
+  // a full hour of budget may be spent at once
+  p->credit_max = hour;
+  p->credit = hour;
+  p->commit_age = min_interval;
+  p->t = now;
+}
+
+uint32_t commitpol_change(commitpol_t *p, uint32_t now) {
+  advance(p, now);
+  // quiet time passed uncommitted, the timer was held back
+  if (p->pending && p->quiet_age >= p->quiet) p->held = TRUE;
+  if (!p->pending) {
+    p->pending = TRUE;
+    p->pending_age = 0;
+  }
+  p->quiet_age = 0;
+  return commitpol_due(p, now);
+}
+
+uint32_t commitpol_due(commitpol_t *p, uint32_t now) {
+  advance(p, now);
+  uint32_t wait_quiet = p->quiet > p->quiet_age ? p->quiet - p->quiet_age : 0;
+  uint32_t wait_latency = p->max_latency > p->pending_age ? p->max_latency - p->pending_age : 0;
+  uint32_t wait = MIN(wait_quiet, wait_latency);
+  uint32_t wait_rate = 0;
+  if (p->min_interval > p->commit_age) wait_rate = p->min_interval - p->commit_age;
+  if (p->cost > p->credit) wait_rate = MAX(wait_rate, p->cost - p->credit);
+  if (p->pending && wait == 0 && wait_rate) p->held = TRUE;
+  return MAX(wait, wait_rate);
+}
+
+void commitpol_commit(commitpol_t *p, uint32_t now) {
+  advance(p, now);
+  commitpol_stats_t *st = &p->stats;
+  st->commits++;
+  if (p->pending && p->pending_age > st->latency_max) st->latency_max = p->pending_age;
+  if (p->held) st->deferred++;
+  p->pending = FALSE;
+  p->held = FALSE;
+  p->commit_age = 0;
+  p->credit = p->credit > p->cost ? p->credit - p->cost : 0;
+}
+
+void commitpol_write(commitpol_t *p, uint32_t bytes) {
+  p->stats.bytes += bytes;
+}
+
+void commitpol_erase(commitpol_t *p) {
+  p->stats.erases++;
+}
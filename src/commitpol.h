@@ -0,0 +1,65 @@
+/*
+ * commitpol.h
+ *
+ * Settings commit policy. Changes are coalesced into one commit a quiet
+ * time after the last change, but no later than a max latency after the
+ * first one, so a steady stream of changes still gets stored. Commits
+ * are kept a minimum interval apart and within a budget per hour, taken
+ * from a bucket of credit refilled with time. All times are in app timer
+ * ticks, elapsed time is summed from the 24 bit counter between calls so
+ * gaps longer than a wrap count short, which only delays commits.
+ */
+
+#ifndef COMMITPOL_H_
+#define COMMITPOL_H_
+
+#include "system.h"
+#include <stdbool.h>
+
+typedef struct {
+  uint32_t commits;
+  uint32_t bytes;
+  uint32_t erases;
+  // commits held back past their due time by interval or budget
+  uint32_t deferred;
+  // time from first change to commit
+  uint32_t latency_max;
+} commitpol_stats_t;
+
+typedef struct {
+  uint32_t quiet;
+  uint32_t max_latency;
+  uint32_t min_interval;
+  // credit one commit costs, 0 for no budget
+  uint32_t cost;
+  uint32_t credit_max;
+  bool pending;
+  // pending commit was held back
+  bool held;
+  uint32_t t;
+  // times since first and last change, since last commit, and credit
+  uint32_t pending_age;
+  uint32_t quiet_age;
+  uint32_t commit_age;
+  uint32_t credit;
+  commitpol_stats_t stats;
+} commitpol_t;
+
+// hour is ticks of an hour, per_hour the commit budget or 0 for none
+void commitpol_init(commitpol_t *p, uint32_t quiet, uint32_t max_latency,
+    uint32_t min_interval, uint32_t per_hour, uint32_t hour, uint32_t now);
+
+// registers a settings change, returns ticks until commit is due
+uint32_t commitpol_change(commitpol_t *p, uint32_t now);
+
+// returns 0 if a commit is due now, else ticks until it is
+uint32_t commitpol_due(commitpol_t *p, uint32_t now);
+
+// registers a commit made
+void commitpol_commit(commitpol_t *p, uint32_t now);
+
+// registers flash written and erased, by commits or else
+void commitpol_write(commitpol_t *p, uint32_t bytes);
+void commitpol_erase(commitpol_t *p);
+
+#endif /* COMMITPOL_H_ */
@@ -0,0 +1,62 @@
+/*
+ * connpol.c
+ *
+ *  Connection interval policy.
+ */
+
+#include "connpol.h"
+
+// app timer counter width
+#define TICKS_MASK    0xffffff
+
+void connpol_init(connpol_t *p, uint32_t radio_lead) {
+  memset(p, 0, sizeof(connpol_t));
+  p->radio_lead = radio_lead;
+  p->mode = CONNPOL_FAST;
+}
+
+bool connpol_traffic(connpol_t *p) {
+  p->cmd_mode = p->mode;
+  if (p->mode == CONNPOL_FAST) return FALSE;
+  p->mode = CONNPOL_FAST;
+  return TRUE;
+}
+
+bool connpol_idle(connpol_t *p) {
+  if (p->mode == CONNPOL_IDLE) return FALSE;
+  p->mode = CONNPOL_IDLE;
+  return TRUE;
+}
+
+void connpol_radio(connpol_t *p, bool active, uint32_t now) {
+  connpol_stats_t *st = &p->stats[p->mode];
+  if (active) {
+    // time between events is bounded by supervision timeout, so no wrap
+    if (st->radio_events > 0) {
+      st->radio_span += (now - p->radio_prev_t) & TICKS_MASK;
+    }
+    p->radio_prev_t = now;
+    p->radio_t = now;
+    p->radio_active = TRUE;
+  } else if (p->radio_active) {
+    uint32_t on = (now - p->radio_t) & TICKS_MASK;
+    st->radio_on += on > p->radio_lead ? on - p->radio_lead : 0;
+    st->radio_events++;
+    p->radio_active = FALSE;
+  }
+}
+
+void connpol_latency(connpol_t *p, uint32_t latency) {
+  connpol_stats_t *st = &p->stats[p->cmd_mode];
+  st->cmds++;
+  st->latency_sum += latency;
+  if (latency > st->latency_max) st->latency_max = latency;
+}
+
+void connpol_duty(const connpol_t *p, int16_t duty[CONNPOL_MODES]) {
+  int m;
+  for (m = 0; m < CONNPOL_MODES; m++) {
+    const connpol_stats_t *st = &p->stats[m];
+    duty[m] = st->radio_span ? (int16_t)(((uint64_t)st->radio_on * 10000) / st->radio_span) : -1;
+  }
+}
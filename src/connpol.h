@@ -0,0 +1,61 @@
+/*
+ * connpol.h
+ *
+ * Connection interval policy. The link runs with a short interval while
+ * there is traffic, and falls back to a long interval with slave latency
+ * when idle. Per mode, radio on time is accumulated from radio
+ * notifications, and latency from command received to frame latched.
+ * All times are in app timer ticks.
+ */
+
+#ifndef CONNPOL_H_
+#define CONNPOL_H_
+
+#include "system.h"
+#include <stdbool.h>
+
+#define CONNPOL_FAST        0
+#define CONNPOL_IDLE        1
+#define CONNPOL_MODES       2
+
+typedef struct {
+  // radio events, time radio was on and time between first and last event
+  uint32_t radio_events;
+  uint32_t radio_on;
+  uint32_t radio_span;
+  // commands that changed the leds
+  uint32_t cmds;
+  uint32_t latency_max;
+  uint32_t latency_sum;
+} connpol_stats_t;
+
+typedef struct {
+  uint8_t mode;
+  // mode last traffic arrived in, latencies are accounted to it
+  uint8_t cmd_mode;
+  bool radio_active;
+  // radio active notification comes this long before radio is on
+  uint32_t radio_lead;
+  uint32_t radio_t;
+  uint32_t radio_prev_t;
+  connpol_stats_t stats[CONNPOL_MODES];
+} connpol_t;
+
+void connpol_init(connpol_t *p, uint32_t radio_lead);
+
+// registers traffic or a new connection, returns TRUE if link needs to go fast
+bool connpol_traffic(connpol_t *p);
+
+// registers idle timeout, returns TRUE if link may go idle
+bool connpol_idle(connpol_t *p);
+
+// registers radio notification at time now
+void connpol_radio(connpol_t *p, bool active, uint32_t now);
+
+// registers latency of a command from reception to light
+void connpol_latency(connpol_t *p, uint32_t latency);
+
+// sets radio on time per mode in 1/10000, -1 when unknown
+void connpol_duty(const connpol_t *p, int16_t duty[CONNPOL_MODES]);
+
+#endif /* CONNPOL_H_ */
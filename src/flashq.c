@@ -0,0 +1,130 @@
+/*
+ * flashq.c
+ *
+ *  Flash operations queued to fstorage.
+ */
+
+#include "flashq.h"
+#include "fstorage.h"
+#include "nrf_error.h"
+#include "ble_flash.h"
+#include "miniutils.h"
+#include "log.h"
+
+static void flashq_evt(fs_evt_t const * const evt, fs_ret_t result);
+
+FS_REGISTER_CFG(fs_config_t flashq_cfg) = {
+  .callback = flashq_evt,
+  .num_pages = FLASHQ_PAGES,
+  .priority = 0xfe,
+};
+
+#define FLASHQ_START ((BLE_FLASH_PAGE_END - FLASHQ_PAGES) * BLE_FLASH_PAGE_SIZE)
+#define FLASHQ_END   (BLE_FLASH_PAGE_END * BLE_FLASH_PAGE_SIZE)
+
+static struct flashq {
+  uint32_t buf[FLASHQ_WORDS];
+  // data of queued writes lies from tail up to head, wrapping at end
+  uint16_t head;
+  uint16_t tail;
+  uint8_t ops;
+  uint32_t errors;
+  flashq_idle_fn_t idle;
+} fq;
+
+// Allocates words from the ring, keeping head off tail unless empty.
+static uint32_t *flashq_alloc(uint16_t words) {
+  uint32_t *p;
+  if (fq.ops == 0) fq.head = fq.tail = 0;
+  if (fq.head >= fq.tail && FLASHQ_WORDS - fq.head >= words) {
+    p = &fq.buf[fq.head];
+    fq.head += words;
+  } else if (fq.head >= fq.tail && fq.tail > words) {
+    // skip the end, it is freed when tail passes
+    p = &fq.buf[0];
+    fq.head = words;
+  } else if (fq.head < fq.tail && fq.tail - fq.head > words) {
+    p = &fq.buf[fq.head];
+    fq.head += words;
+  } else {
+    return 0;
+  }
+  return p;
+}
+
+// Operations complete in order, each carries the ring head after its data.
+static void flashq_evt(fs_evt_t const * const evt, fs_ret_t result) {
+  fq.tail = (uint32_t)evt->p_context;
+  if (result != FS_SUCCESS) {
+    log_warn("flashq: op %i res %i\n", evt->id, result);
+    fq.errors++;
+  }
+  if (--fq.ops == 0) {
+    uint32_t errors = fq.errors;
+    fq.errors = 0;
+    if (fq.idle) fq.idle(errors);
+  }
+}
+
+uint32_t flashq_init(flashq_idle_fn_t idle) {
+  memset(&fq, 0, sizeof(fq));
+  fq.idle = idle;
+  return fs_init();
+}
+
+// Queues whole words of data already in the queue's own pages, written
+// from where they are when their turn comes. Pages are erased only by
+// later operations, so the data is still there.
+static uint32_t flashq_write_flash(uint32_t *dst, const uint32_t *src, uint32_t words) {
+  fs_ret_t res = fs_store(&flashq_cfg, dst, src, words, (void *)(uint32_t)fq.head);
+  if (res != FS_SUCCESS) {
+    return res == FS_ERR_QUEUE_FULL ? NRF_ERROR_BUSY : NRF_ERROR_INTERNAL;
+  }
+  fq.ops++;
+  return NRF_SUCCESS;
+}
+
+uint32_t flashq_write(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src) {
+  if (src >= (uint8_t *)FLASHQ_START && src < (uint8_t *)FLASHQ_END &&
+      ((uint32_t)(buf + offs) & 3) == 0 && ((uint32_t)src & 3) == 0 && len >= 4) {
+    // by reference, only a trailing part word goes through the ring
+    uint32_t res = flashq_write_flash((uint32_t *)(buf + offs), (uint32_t *)src, len / 4);
+    if (res || (len & 3) == 0) return res;
+    offs += len & ~3;
+    src += len & ~3;
+    len &= 3;
+  }
+  // align to 32 bits, padding with ones leaves flash as it is
+  uint32_t start = (uint32_t)(buf + offs);
+  uint32_t end = start + len;
+  uint32_t start_align_pre = start & 3;
+  uint32_t end_align_post = (end & 3) == 0 ? 0 : (4 - (end & 3));
+  uint32_t words = ((end + end_align_post) - (start - start_align_pre)) / 4;
+  uint16_t head = fq.head;
+  uint32_t *wbuf = flashq_alloc(words);
+  if (wbuf == 0) return NRF_ERROR_NO_MEM;
+  memset(wbuf, 0xff, words * 4);
+  memcpy((uint8_t *)wbuf + start_align_pre, src, len);
+  fs_ret_t res = fs_store(&flashq_cfg, (uint32_t *)(start - start_align_pre), wbuf, words,
+      (void *)(uint32_t)fq.head);
+  if (res != FS_SUCCESS) {
+    fq.head = head;
+    return res == FS_ERR_QUEUE_FULL ? NRF_ERROR_BUSY : NRF_ERROR_INTERNAL;
+  }
+  fq.ops++;
+  return NRF_SUCCESS;
+}
+
+uint32_t flashq_erase(uint8_t *buf) {
+  if (fq.ops == 0) fq.head = fq.tail = 0;
+  fs_ret_t res = fs_erase(&flashq_cfg, (uint32_t *)buf, 1, (void *)(uint32_t)fq.head);
+  if (res != FS_SUCCESS) {
+    return res == FS_ERR_QUEUE_FULL ? NRF_ERROR_BUSY : NRF_ERROR_INTERNAL;
+  }
+  fq.ops++;
+  return NRF_SUCCESS;
+}
+
+bool flashq_busy(void) {
+  return fq.ops > 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * flashq.h
+ *
+ * Flash writes and erases queued to fstorage, run while the softdevice
+ * keeps the link up. Write data is copied into a ring of words, so
+ * callers may reuse their buffers at once. Data already in the queue's
+ * own pages, like tnv blobs carried to a new page, is written from where
+ * it is and takes no room in the ring. Operations run in order, and
+ * the idle callback is called when the last queued one has finished.
+ * Writes and erases match the tnv hooks, see tnv.h.
+ */
+
+#ifndef FLASHQ_H_
+#define FLASHQ_H_
+
+#include "system.h"
+#include <stdbool.h>
+
+// pages handed to fstorage, counted from end of flash, covering the tnv
+// ring, see app.h
+#ifndef FLASHQ_PAGES
+#define FLASHQ_PAGES        4
+#endif
+// words of write data from ram that can be queued
+#ifndef FLASHQ_WORDS
+#define FLASHQ_WORDS        256
+#endif
+
+// called with number of failed operations since last idle
+typedef void (* flashq_idle_fn_t)(uint32_t errors);
+
+uint32_t flashq_init(flashq_idle_fn_t idle);
+
+// queues a write of len bytes from src to buf + offs, padding to words
+uint32_t flashq_write(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src);
+
+// queues an erase of the page at buf
+uint32_t flashq_erase(uint8_t *buf);
+
+// returns TRUE while operations are queued
+bool flashq_busy(void);
+
+#endif /* FLASHQ_H_ */
@@ -0,0 +1,88 @@
+/*
+ * log.c
+ *
+ *  Deferred log ring, see log.h.
+ */
+
+#include "log.h"
+#include "miniutils.h"
+#include "app_util_platform.h"
+
+static struct {
+  uint32_t (*now)(void);
+  uint32_t ring[LOG_RING_WORDS];
+  // oldest entry and words in use
+  uint32_t tail;
+  uint32_t used;
+  uint8_t seq;
+  log_stats_t stats;
+} logr;
+
+void log_init(uint32_t (*now)(void)) {
+  logr.now = now;
+}
+
+static uint32_t entry_words(uint32_t ix) {
+  return LOG_HDR_WORDS + LOG_ENTRY_ARGS(logr.ring[ix]);
+}
+
+#if LOG_DEFERRED
+// start of the format strings, provided by the linker
+extern const char __start_logstr[];
+
+void log_put(const char *fmt, uint32_t args, const uint32_t *arg) {
+  uint32_t words = LOG_HDR_WORDS + args;
+  CRITICAL_REGION_ENTER();
+  // stamped in here, so ticks follow ring order
+  uint32_t t = logr.now ? logr.now() : 0;
+  while (LOG_RING_WORDS - logr.used < words) {
+    uint32_t n = entry_words(logr.tail);
+    logr.tail = (logr.tail + n) % LOG_RING_WORDS;
+    logr.used -= n;
+    logr.stats.lost++;
+  }
+  uint32_t ix = (logr.tail + logr.used) % LOG_RING_WORDS;
+  logr.ring[ix] = ((uint32_t)(fmt - __start_logstr) << 16) | (args << 8) | logr.seq++;
+  logr.ring[(ix + 1) % LOG_RING_WORDS] = t;
+  ix = (ix + LOG_HDR_WORDS) % LOG_RING_WORDS;
+  while (args--) {
+    logr.ring[ix] = *arg++;
+    ix = (ix + 1) % LOG_RING_WORDS;
+  }
+  logr.used += words;
+  logr.stats.entries++;
+  CRITICAL_REGION_EXIT();
+}
+#endif
+
+uint32_t log_read(uint8_t *dst, uint32_t max) {
+  uint32_t len = 0;
+  CRITICAL_REGION_ENTER();
+  while (logr.used) {
+    uint32_t n = entry_words(logr.tail);
+    if (len + n * 4 > max) break;
+    while (n--) {
+      memcpy(dst, &logr.ring[logr.tail], 4);
+      dst += 4;
+      len += 4;
+      logr.tail = (logr.tail + 1) % LOG_RING_WORDS;
+      logr.used--;
+    }
+  }
+  CRITICAL_REGION_EXIT();
+  return len;
+}
+
+void log_dump(void) {
+  uint32_t w[LOG_HDR_WORDS + LOG_ARGS_MAX];
+  uint32_t len, i;
+  while ((len = log_read((uint8_t *)w, sizeof(w))) > 0) {
+    print("log:");
+    for (i = 0; i < len / 4; i++) print(" %08x", w[i]);
+    print("\n");
+  }
+}
+
+void log_stats(log_stats_t *stats) {
+  memcpy(stats, &logr.stats, sizeof(logr.stats));
+}
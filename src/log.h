@@ -0,0 +1,117 @@
+/*
+ * log.h
+ *
+ * Levelled logging. Calls above LOG_LEVEL compile out, arguments and
+ * all. With LOG_DEFERRED set, calls are not formatted but put as a
+ * binary entry in a ram ring, read out by CMD_LOG_READ and formatted on
+ * the host from the format strings in the elf.
+ *
+ * A deferred entry is words in native order:
+ *   [id:16][args:8][seq:8]  id is offset of format in section logstr
+ *   [time]                  app timer ticks
+ *   [arg]...                each argument as 32 bits
+ * String arguments are kept as pointers, so only constant strings can be
+ * resolved on the host.
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include "system.h"
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERR       1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DBG       4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_DBG
+#endif
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED        0
+#endif
+
+#define LOG_RING_WORDS      512
+#define LOG_HDR_WORDS       2
+#define LOG_ARGS_MAX        8
+
+#define LOG_ENTRY_ID(w)     ((w) >> 16)
+#define LOG_ENTRY_ARGS(w)   (((w) >> 8) & 0xff)
+#define LOG_ENTRY_SEQ(w)    ((w) & 0xff)
+
+// counts up to LOG_ARGS_MAX arguments
+#define _LOG_NARGS(...) _LOG_SEL(_0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define _LOG_SEL(_0, _1, _2, _3, _4, _5, _6, _7, _8, _n, ...) _n
+#define _LOG_CAT(a, b) _LOG_CAT_(a, b)
+#define _LOG_CAT_(a, b) a##b
+#define _LOG_W0()
+#define _LOG_W1(a) (uint32_t)(a)
+#define _LOG_W2(a, ...) (uint32_t)(a), _LOG_W1(__VA_ARGS__)
+#define _LOG_W3(a, ...) (uint32_t)(a), _LOG_W2(__VA_ARGS__)
+#define _LOG_W4(a, ...) (uint32_t)(a), _LOG_W3(__VA_ARGS__)
+#define _LOG_W5(a, ...) (uint32_t)(a), _LOG_W4(__VA_ARGS__)
+#define _LOG_W6(a, ...) (uint32_t)(a), _LOG_W5(__VA_ARGS__)
+#define _LOG_W7(a, ...) (uint32_t)(a), _LOG_W6(__VA_ARGS__)
+#define _LOG_W8(a, ...) (uint32_t)(a), _LOG_W7(__VA_ARGS__)
+
+#if LOG_DEFERRED
+#define _LOG(_fmt, ...) \
+  do { \
+    static const char _log_fmt[] __attribute__((section("logstr"), used)) = _fmt; \
+    const uint32_t _log_args[] = { 0, _LOG_CAT(_LOG_W, _LOG_NARGS(__VA_ARGS__))(__VA_ARGS__) }; \
+    log_put(_log_fmt, _LOG_NARGS(__VA_ARGS__), &_log_args[1]); \
+  } while (0)
+#else
+// print of miniutils.h, included by the caller
+#define _LOG(...) print(__VA_ARGS__)
+#endif
+// arguments stay referenced so compiled out calls leave no unused values
+#define _LOG_NONE(...) do { if (0) print(__VA_ARGS__); } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERR
+#define log_err(...) _LOG(__VA_ARGS__)
+#else
+#define log_err(...) _LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define log_warn(...) _LOG(__VA_ARGS__)
+#else
+#define log_warn(...) _LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define log_info(...) _LOG(__VA_ARGS__)
+#else
+#define log_info(...) _LOG_NONE(__VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DBG
+#define log_dbg(...) _LOG(__VA_ARGS__)
+#else
+#define log_dbg(...) _LOG_NONE(__VA_ARGS__)
+#endif
+
+// true if calls of given level print text as they are made
+#define LOG_TEXT(level) (LOG_LEVEL >= (level) && !LOG_DEFERRED)
+
+typedef struct {
+  uint32_t entries;
+  // entries overwritten before read
+  uint32_t lost;
+} log_stats_t;
+
+// sets the time source of deferred entries, app timer ticks, called in
+// a critical region
+void log_init(uint32_t (*now)(void));
+
+void log_put(const char *fmt, uint32_t args, const uint32_t *arg);
+
+// moves whole entries, oldest first, to dst as long as they fit in max
+// bytes, returns bytes moved
+uint32_t log_read(uint8_t *dst, uint32_t max);
+
+// prints and drains all entries as hex words on the uart
+void log_dump(void);
+
+void log_stats(log_stats_t *stats);
+
+#endif /* LOG_H_ */
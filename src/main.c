@@ -29,6 +29,8 @@
 #include "ble_advdata.h"
 #include "ble_advertising.h"
 #include "ble_conn_params.h"
+#include "ble_radio_notification.h"
+#include "fstorage.h"
 #include "softdevice_handler.h"
 #include "app_timer.h"
 #include "app_button.h"
@@ -36,12 +38,15 @@
 #include "app_uart.h"
 #include "app_util_platform.h"
 #include "miniutils.h"
+#include "log.h"
 #include "app.h"
 
 #define IS_SRVC_CHANGED_CHARACT_PRESENT 0                                           /**< Include the service_changed characteristic. If not enabled, the server's database cannot be changed for the lifetime of the device. */
 
-#if (NRF_SD_BLE_API_VERSION == 3)
-#define NRF_BLE_MAX_MTU_SIZE            GATT_MTU_SIZE_DEFAULT                       /**< MTU size used in the softdevice enabling and to reply to a BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST event. */
+#if (NRF_SD_BLE_API_VERSION >= 3)
+#ifndef NRF_BLE_MAX_MTU_SIZE
+#define NRF_BLE_MAX_MTU_SIZE            GATT_MTU_SIZE_DEFAULT                       /**< MTU size used in the softdevice enabling and to reply to a BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST event, set by makefile. */
+#endif
 #endif
 
 #define APP_FEATURE_NOT_SUPPORTED       BLE_GATT_STATUS_ATTERR_APP_BEGIN + 2        /**< Reply when unsupported features are requested. */
@@ -50,14 +55,18 @@
 #define PERIPHERAL_LINK_COUNT           1                                           /**< Number of peripheral links used by the application. When changing this number remember to adjust the RAM settings*/
 
 #define NUS_SERVICE_UUID_TYPE           BLE_UUID_TYPE_VENDOR_BEGIN                  /**< UUID type for the Nordic UART Service (vendor specific). */
+#define BLE_UUID_TELEM_CHARACTERISTIC   0x0004                                      /**< Telemetry characteristic, on the NUS base UUID next to RX and TX. */
 
 #define APP_ADV_INTERVAL                64                                          /**< The advertising interval (in units of 0.625 ms. This value corresponds to 40 ms). */
 #define APP_ADV_TIMEOUT_IN_SECONDS      0 //no adv timeout 180                                    /**< The advertising timeout (in units of seconds). */
 
-#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(20, UNIT_1_25_MS)             /**< Minimum acceptable connection interval (20 ms), Connection interval uses 1.25 ms units. */
-#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(75, UNIT_1_25_MS)             /**< Maximum acceptable connection interval (75 ms), Connection interval uses 1.25 ms units. */
-#define SLAVE_LATENCY                   0                                           /**< Slave latency. */
-#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(4000, UNIT_10_MS)             /**< Connection supervisory timeout (4 seconds), Supervision Timeout uses 10 ms units. */
+#define MIN_CONN_INTERVAL               MSEC_TO_UNITS(CONN_FAST_MIN_MS, UNIT_1_25_MS) /**< Minimum acceptable connection interval with traffic, Connection interval uses 1.25 ms units. */
+#define MAX_CONN_INTERVAL               MSEC_TO_UNITS(CONN_FAST_MAX_MS, UNIT_1_25_MS) /**< Maximum acceptable connection interval with traffic. */
+#define SLAVE_LATENCY                   0                                           /**< Slave latency with traffic. */
+#define IDLE_MIN_CONN_INTERVAL          MSEC_TO_UNITS(CONN_IDLE_MIN_MS, UNIT_1_25_MS) /**< Minimum acceptable connection interval when idle. */
+#define IDLE_MAX_CONN_INTERVAL          MSEC_TO_UNITS(CONN_IDLE_MAX_MS, UNIT_1_25_MS) /**< Maximum acceptable connection interval when idle. */
+#define IDLE_SLAVE_LATENCY              CONN_IDLE_LATENCY                           /**< Slave latency when idle, must keep (1 + latency) * max interval * 2 below supervision timeout. */
+#define CONN_SUP_TIMEOUT                MSEC_TO_UNITS(CONN_SUP_TIMEOUT_MS, UNIT_10_MS) /**< Connection supervisory timeout, Supervision Timeout uses 10 ms units. */
 #define FIRST_CONN_PARAMS_UPDATE_DELAY  APP_TIMER_TICKS(5000, APP_TIMER_PRESCALER)  /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000, APP_TIMER_PRESCALER) /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                           /**< Number of attempts before giving up the connection parameter negotiation. */
@@ -69,6 +78,9 @@
 
 static ble_nus_t m_nus; /**< Structure to identify the Nordic UART Service. */
 static uint16_t m_conn_handle = BLE_CONN_HANDLE_INVALID; /**< Handle of the current connection. */
+static uint16_t m_nus_data_len = GATT_MTU_SIZE_DEFAULT - 3; /**< Max NUS payload with the ATT MTU of the current connection. */
+static ble_gatts_char_handles_t m_telem_handles; /**< Handles of the telemetry characteristic. */
+static bool m_telem_notify; /**< Central subscribed to telemetry notifications. */
 
 static ble_uuid_t m_adv_uuids[] = { { BLE_UUID_NUS_SERVICE,
     NUS_SERVICE_UUID_TYPE } }; /**< Universally unique service identifier. */
@@ -131,6 +143,81 @@ static void nus_data_handler(ble_nus_t * p_nus, uint8_t * p_data,
 }
 /**@snippet [Handling the data received over BLE] */
 
+uint32_t nus_send(uint8_t *data, uint16_t len) {
+  if (len > m_nus_data_len) return NRF_ERROR_DATA_SIZE;
+  return ble_nus_string_send(&m_nus, data, len);
+}
+
+/**@brief Function for updating the telemetry characteristic, see TELEM_LEN in app.h.
+ *
+ * @details The value is always set for reads, and notified if the central has subscribed.
+ */
+uint32_t telem_update(uint8_t *data, uint16_t len) {
+  uint32_t err_code;
+  ble_gatts_value_t value;
+  ble_gatts_hvx_params_t hvx;
+
+  memset(&value, 0, sizeof(value));
+  value.len = len;
+  value.p_value = data;
+  err_code = sd_ble_gatts_value_set(m_conn_handle, m_telem_handles.value_handle, &value);
+  if (err_code != NRF_SUCCESS || !m_telem_notify || m_conn_handle == BLE_CONN_HANDLE_INVALID) {
+    return err_code;
+  }
+  memset(&hvx, 0, sizeof(hvx));
+  hvx.handle = m_telem_handles.value_handle;
+  hvx.type = BLE_GATT_HVX_NOTIFICATION;
+  hvx.p_len = &len;
+  hvx.p_data = data;
+  return sd_ble_gatts_hvx(m_conn_handle, &hvx);
+}
+
+/**@brief Function for getting a random seed from the RNG peripheral.
+ *
+ * @details The SoftDevice owns the RNG and keeps a pool of random bytes filled, so
+ *          every lamp starts its pseudo random generator differently.
+ */
+uint32_t rng_seed(void) {
+  uint32_t seed;
+  uint8_t avail;
+  do {
+    avail = 0;
+    sd_rand_application_bytes_available_get(&avail);
+  } while (avail < sizeof(seed));
+  uint32_t err_code = sd_rand_application_vector_get((uint8_t *)&seed, sizeof(seed));
+  APP_ERROR_CHECK(err_code);
+  return seed;
+}
+
+static void on_mtu(uint16_t mtu) {
+  m_nus_data_len = MIN(mtu, NRF_BLE_MAX_MTU_SIZE) - 3;
+  log_info("on_ble_evt: mtu %i, nus len %i\n", mtu, m_nus_data_len);
+}
+
+// Asks central for the largest MTU we handle. With API v3 the softdevice
+// follows up with a data length update on its own, fitting the MTU.
+// Later apis need explicit data length and phy updates.
+static void link_speed_up(void) {
+  uint32_t err_code;
+#if (NRF_SD_BLE_API_VERSION >= 3)
+  if (NRF_BLE_MAX_MTU_SIZE > GATT_MTU_SIZE_DEFAULT) {
+    err_code = sd_ble_gattc_exchange_mtu_request(m_conn_handle, NRF_BLE_MAX_MTU_SIZE);
+    log_info("on_ble_evt: mtu req res %i\n", err_code);
+  }
+#endif
+#if (NRF_SD_BLE_API_VERSION >= 5)
+  err_code = sd_ble_gap_data_length_update(m_conn_handle, NULL, NULL);
+  log_info("on_ble_evt: dle req res %i\n", err_code);
+  ble_gap_phys_t phys = {
+      .tx_phys = BLE_GAP_PHY_2MBPS,
+      .rx_phys = BLE_GAP_PHY_2MBPS,
+  };
+  err_code = sd_ble_gap_phy_update(m_conn_handle, &phys);
+  log_info("on_ble_evt: phy req res %i\n", err_code);
+#endif
+  (void)err_code;
+}
+
 /**@brief Function for initializing services that will be used by the application.
  */
 static void services_init(void) {
@@ -143,6 +230,44 @@ static void services_init(void) {
 
   err_code = ble_nus_init(&m_nus, &nus_init);
   APP_ERROR_CHECK(err_code);
+
+  // telemetry goes in the nus service, which is the last one added
+  ble_gatts_char_md_t char_md;
+  ble_gatts_attr_md_t cccd_md;
+  ble_gatts_attr_md_t attr_md;
+  ble_gatts_attr_t attr_char_value;
+  ble_uuid_t ble_uuid;
+  uint8_t telem_init[TELEM_LEN];
+
+  memset(&cccd_md, 0, sizeof(cccd_md));
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+  cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+  memset(&char_md, 0, sizeof(char_md));
+  char_md.char_props.read = 1;
+  char_md.char_props.notify = 1;
+  char_md.p_cccd_md = &cccd_md;
+
+  ble_uuid.type = m_nus.uuid_type;
+  ble_uuid.uuid = BLE_UUID_TELEM_CHARACTERISTIC;
+
+  memset(&attr_md, 0, sizeof(attr_md));
+  BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.read_perm);
+  BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+  attr_md.vloc = BLE_GATTS_VLOC_STACK;
+
+  memset(telem_init, 0, sizeof(telem_init));
+  memset(&attr_char_value, 0, sizeof(attr_char_value));
+  attr_char_value.p_uuid = &ble_uuid;
+  attr_char_value.p_attr_md = &attr_md;
+  attr_char_value.init_len = TELEM_LEN;
+  attr_char_value.max_len = TELEM_LEN;
+  attr_char_value.p_value = telem_init;
+
+  err_code = sd_ble_gatts_characteristic_add(m_nus.service_handle, &char_md,
+      &attr_char_value, &m_telem_handles);
+  APP_ERROR_CHECK(err_code);
 }
 
 /**@brief Function for handling an event from the Connection Parameters Module.
@@ -150,22 +275,33 @@ static void services_init(void) {
  * @details This function will be called for all events in the Connection Parameters Module
  *          which are passed to the application.
  *
- * @note All this function does is to disconnect. This could have been done by simply setting
- *       the disconnect_on_fail config parameter, but instead we use the event handler
- *       mechanism to demonstrate its use.
+ * @note The lamp works with any parameters the central insists on, only slower or
+ *       hungrier, so a failed negotiation is logged instead of dropping the link.
  *
  * @param[in] p_evt  Event received from the Connection Parameters Module.
  */
 static void on_conn_params_evt(ble_conn_params_evt_t * p_evt) {
-  uint32_t err_code;
-
   if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED) {
-    err_code = sd_ble_gap_disconnect(m_conn_handle,
-        BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-    APP_ERROR_CHECK(err_code);
+    log_warn("main: conn params rejected\n");
   }
 }
 
+/**@brief Function for switching between the fast and idle connection parameters, see connpol.h.
+ */
+void conn_params_set(bool fast) {
+  uint32_t err_code;
+  ble_gap_conn_params_t params;
+
+  if (m_conn_handle == BLE_CONN_HANDLE_INVALID) return;
+  memset(&params, 0, sizeof(params));
+  params.min_conn_interval = fast ? MIN_CONN_INTERVAL : IDLE_MIN_CONN_INTERVAL;
+  params.max_conn_interval = fast ? MAX_CONN_INTERVAL : IDLE_MAX_CONN_INTERVAL;
+  params.slave_latency = fast ? SLAVE_LATENCY : IDLE_SLAVE_LATENCY;
+  params.conn_sup_timeout = CONN_SUP_TIMEOUT;
+  err_code = ble_conn_params_change_conn_params(&params);
+  log_info("main: conn params %s res %i\n", fast ? "fast" : "idle", err_code);
+}
+
 /**@brief Function for handling errors from the Connection Parameters module.
  *
  * @param[in] nrf_error  Error code containing information about what went wrong.
@@ -236,15 +372,27 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
   case BLE_GAP_EVT_CONNECTED:
     app_on_connected();
     m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+    link_speed_up();
     break; // BLE_GAP_EVT_CONNECTED
 
   case BLE_GAP_EVT_DISCONNECTED:
     app_on_disconnected();
     m_conn_handle = BLE_CONN_HANDLE_INVALID;
+    m_nus_data_len = GATT_MTU_SIZE_DEFAULT - 3;
+    m_telem_notify = false;
     break; // BLE_GAP_EVT_DISCONNECTED
 
+  case BLE_GATTS_EVT_WRITE: {
+    ble_gatts_evt_write_t *p_write = &p_ble_evt->evt.gatts_evt.params.write;
+    if (p_write->handle == m_telem_handles.cccd_handle && p_write->len == 2) {
+      m_telem_notify = ble_srv_is_notification_enabled(p_write->data);
+      log_info("on_ble_evt: telem notify %i\n", m_telem_notify);
+    }
+  }
+    break; // BLE_GATTS_EVT_WRITE
+
   case BLE_GAP_EVT_SEC_PARAMS_REQUEST:
-    print("on_ble_evt: sec params req\n");
+    log_info("on_ble_evt: sec params req\n");
     // Pairing not supported
     err_code = sd_ble_gap_sec_params_reply(m_conn_handle,
         BLE_GAP_SEC_STATUS_PAIRING_NOT_SUPP, NULL, NULL);
@@ -252,14 +400,14 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
     break; // BLE_GAP_EVT_SEC_PARAMS_REQUEST
 
   case BLE_GATTS_EVT_SYS_ATTR_MISSING:
-    print("on_ble_evt: sys attr missing\n");
+    log_info("on_ble_evt: sys attr missing\n");
     // No system attributes have been stored.
     err_code = sd_ble_gatts_sys_attr_set(m_conn_handle, NULL, 0, 0);
     APP_ERROR_CHECK(err_code);
     break; // BLE_GATTS_EVT_SYS_ATTR_MISSING
 
   case BLE_GATTC_EVT_TIMEOUT:
-    print("on_ble_evt: gattc tmo\n");
+    log_info("on_ble_evt: gattc tmo\n");
     // Disconnect on GATT Client timeout event.
     err_code = sd_ble_gap_disconnect(p_ble_evt->evt.gattc_evt.conn_handle,
     BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
@@ -267,7 +415,7 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
     break; // BLE_GATTC_EVT_TIMEOUT
 
   case BLE_GATTS_EVT_TIMEOUT:
-    print("on_ble_evt: evt tmo\n");
+    log_info("on_ble_evt: evt tmo\n");
     // Disconnect on GATT Server timeout event.
     err_code = sd_ble_gap_disconnect(p_ble_evt->evt.gatts_evt.conn_handle,
     BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
@@ -275,14 +423,14 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
     break; // BLE_GATTS_EVT_TIMEOUT
 
   case BLE_EVT_USER_MEM_REQUEST:
-    print("on_ble_evt: user mem req\n");
+    log_info("on_ble_evt: user mem req\n");
     err_code = sd_ble_user_mem_reply(p_ble_evt->evt.gattc_evt.conn_handle,
         NULL);
     APP_ERROR_CHECK(err_code);
     break; // BLE_EVT_USER_MEM_REQUEST
 
   case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST: {
-    print("on_ble_evt: auth req\n");
+    log_info("on_ble_evt: auth req\n");
     ble_gatts_evt_rw_authorize_request_t req;
     ble_gatts_rw_authorize_reply_params_t auth_reply;
 
@@ -306,12 +454,17 @@ static void on_ble_evt(ble_evt_t * p_ble_evt) {
   }
     break; // BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST
 
-#if (NRF_SD_BLE_API_VERSION == 3)
+#if (NRF_SD_BLE_API_VERSION >= 3)
     case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
     err_code = sd_ble_gatts_exchange_mtu_reply(p_ble_evt->evt.gatts_evt.conn_handle,
         NRF_BLE_MAX_MTU_SIZE);
     APP_ERROR_CHECK(err_code);
+    on_mtu(p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu);
     break; // BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST
+
+    case BLE_GATTC_EVT_EXCHANGE_MTU_RSP:
+    on_mtu(p_ble_evt->evt.gattc_evt.params.exchange_mtu_rsp.server_rx_mtu);
+    break; // BLE_GATTC_EVT_EXCHANGE_MTU_RSP
 #endif
 
   default:
@@ -335,6 +488,17 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt) {
   ble_advertising_on_ble_evt(p_ble_evt);
 }
 
+/**@brief Function for dispatching a system event to interested modules.
+ *
+ * @details Flash operation results are system events, fstorage needs them to run its queue.
+ *
+ * @param[in] sys_evt  System stack event.
+ */
+static void sys_evt_dispatch(uint32_t sys_evt) {
+  fs_sys_event_handler(sys_evt);
+  ble_advertising_on_sys_evt(sys_evt);
+}
+
 /**@brief Function for the SoftDevice initialization.
  *
  * @details This function initializes the SoftDevice and the BLE event interrupt.
@@ -364,14 +528,39 @@ static void ble_stack_init(void) {
 
   // Enable BLE stack.
 #if (NRF_SD_BLE_API_VERSION == 3)
+  // large MTU is pointless without room for long packets in each event
+  ble_conn_bw_counts_t conn_bw_counts = {
+      .tx_counts = { .high_count = PERIPHERAL_LINK_COUNT },
+      .rx_counts = { .high_count = PERIPHERAL_LINK_COUNT },
+  };
+  ble_enable_params.common_enable_params.p_conn_bw_counts = &conn_bw_counts;
   ble_enable_params.gatt_enable_params.att_mtu = NRF_BLE_MAX_MTU_SIZE;
 #endif
   err_code = softdevice_enable(&ble_enable_params);
   APP_ERROR_CHECK(err_code);
 
+#if (NRF_SD_BLE_API_VERSION == 3)
+  ble_opt_t opt;
+  memset(&opt, 0, sizeof(opt));
+  opt.common_opt.conn_bw.role = BLE_GAP_ROLE_PERIPH;
+  opt.common_opt.conn_bw.conn_bw.conn_bw_tx = BLE_CONN_BW_HIGH;
+  opt.common_opt.conn_bw.conn_bw.conn_bw_rx = BLE_CONN_BW_HIGH;
+  err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_BW, &opt);
+  APP_ERROR_CHECK(err_code);
+  // let connection events run on while there is data to send
+  memset(&opt, 0, sizeof(opt));
+  opt.common_opt.conn_evt_ext.enable = 1;
+  err_code = sd_ble_opt_set(BLE_COMMON_OPT_CONN_EVT_EXT, &opt);
+  APP_ERROR_CHECK(err_code);
+#endif
+
   // Subscribe for BLE events.
   err_code = softdevice_ble_evt_handler_set(ble_evt_dispatch);
   APP_ERROR_CHECK(err_code);
+
+  // Subscribe for system events, flash operations report through these.
+  err_code = softdevice_sys_evt_handler_set(sys_evt_dispatch);
+  APP_ERROR_CHECK(err_code);
 }
 
 /**@brief   Function for handling app_uart events.
@@ -392,7 +581,7 @@ void uart_event_handle(app_uart_evt_t * p_event) {
     UNUSED_VARIABLE(app_uart_get(&data_array[index]));
     index++;
 
-    if ((data_array[index - 1] == '\n') || (index >= (BLE_NUS_MAX_DATA_LEN))) {
+    if ((data_array[index - 1] == '\n') || (index >= m_nus_data_len)) {
       err_code = ble_nus_string_send(&m_nus, data_array, index);
       if (err_code != NRF_ERROR_INVALID_STATE) {
         APP_ERROR_CHECK(err_code);
@@ -483,11 +672,15 @@ void start_softdevice(void) {
   services_init();
   advertising_init();
   conn_params_init();
+  // radio on time is measured per connection mode, see app_on_radio
+  err_code = ble_radio_notification_init(APP_IRQ_PRIORITY_LOW,
+      NRF_RADIO_NOTIFICATION_DISTANCE_800US, app_on_radio);
+  APP_ERROR_CHECK(err_code);
   if (!_app_inited) {
     _app_inited = TRUE;
     app_init();
   }
-  print("main: ALL SET: ble_advertising_start start\n");
+  log_info("main: ALL SET: ble_advertising_start start\n");
   err_code = ble_advertising_start(BLE_ADV_MODE_FAST);
   APP_ERROR_CHECK(err_code);
 
@@ -546,24 +546,62 @@ unsigned short crc_ccitt_16(unsigned short crc, unsigned char data) {
   return crc;
 }
 
-#define TAPMASK       0x80000062U
+// xorshift32
 unsigned int rand(unsigned int seed) {
-  if (seed & 1) {
-    seed = (1 << 31) | ((seed ^ TAPMASK) >> 1);
-  } else {
-    seed >>= 1;
-  }
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
   return seed;
 }
 
-static unsigned int _rand_seed = 0;
+// xoshiro128**, state must not be all zeroes
+static unsigned int _rand_s[4] = { 0x9e3779b9, 0x243f6a88, 0xb7e15162, 0x12312312 };
+
+#define _ROTL(x, k) (((x) << (k)) | ((x) >> (32 - (k))))
+static inline unsigned int _rand_step(unsigned int *s) {
+  unsigned int r = _ROTL(s[1] * 5, 7) * 9;
+  unsigned int t = s[1] << 9;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = _ROTL(s[3], 11);
+  return r;
+}
+
 unsigned int rand_next() {
-  _rand_seed = rand(_rand_seed);
-  return _rand_seed;
+  return _rand_step(_rand_s);
 }
 
+void rand_fill(void *buf, unsigned int n) {
+  unsigned char *d = (unsigned char *)buf;
+  // state in registers for the run
+  unsigned int s[4] = { _rand_s[0], _rand_s[1], _rand_s[2], _rand_s[3] };
+  unsigned int r;
+  if (((unsigned long)d & 3) == 0) {
+    for (; n >= 4; n -= 4, d += 4) *(unsigned int *)d = _rand_step(s);
+  }
+  while (n > 0) {
+    r = _rand_step(s);
+    unsigned int i;
+    for (i = 0; i < 4 && n > 0; i++, n--) {
+      *d++ = r;
+      r >>= 8;
+    }
+  }
+  for (r = 0; r < 4; r++) _rand_s[r] = s[r];
+}
+
+// spreads seed over state by splitmix32, which never yields all zeroes
 void rand_seed(unsigned int seed) {
-  _rand_seed = seed;
+  int i;
+  for (i = 0; i < 4; i++) {
+    unsigned int z = (seed += 0x9e3779b9);
+    z = (z ^ (z >> 16)) * 0x85ebca6b;
+    z = (z ^ (z >> 13)) * 0xc2b2ae35;
+    _rand_s[i] = z ^ (z >> 16);
+  }
 }
 
 void quicksort(int* orders, void** pp, int elements) {
@@ -91,12 +91,14 @@ char* strpbrk(const char* str, const char* key);
 char* strstr(const char* str, const char* sub);
 // calculates 16 bit crc
 unsigned short crc_ccitt_16(unsigned short crc, unsigned char data);
-// calculates pseudo random value given seed
+// calculates pseudo random value given non zero seed, xorshift32
 unsigned int rand(unsigned int seed);
-// seeds common pseudo random generator
+// seeds common pseudo random generator, xoshiro128**
 void rand_seed(unsigned int seed);
 // returns next pseudo random number
 unsigned int rand_next();
+// fills buf with n pseudo random bytes, same stream as rand_next in little endian
+void rand_fill(void *buf, unsigned int n);
 // quicksorts given elements of given orders, both arrays must contain same amount of entries
 void quicksort(int* orders, void** pp, int elements);
 // quicksorts given elements of order given by function, both arrays must contain same amount of entries
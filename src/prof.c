@@ -0,0 +1,61 @@
+/*
+ * prof.c
+ *
+ *  Hot path profiler, see prof.h.
+ */
+
+#include "prof.h"
+#include "miniutils.h"
+#include "app_util_platform.h"
+#ifdef HOST_SIM
+#include <time.h>
+#endif
+
+static prof_stats_t prof[PROF_POINTS];
+
+#ifdef HOST_SIM
+uint32_t prof_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+void prof_init(void) {
+#ifndef HOST_SIM
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+  prof_clear();
+}
+
+void prof_add(uint8_t point, uint32_t t) {
+  uint32_t us = t / (PROF_HZ / 1000000);
+  uint32_t lim = PROF_BUCKET_US;
+  uint8_t b = 0;
+  while (b < PROF_BUCKETS - 1 && us >= lim) {
+    b++;
+    lim <<= 2;
+  }
+  CRITICAL_REGION_ENTER();
+  prof_stats_t *p = &prof[point];
+  if (p->count == 0 || t < p->min) p->min = t;
+  if (t > p->max) p->max = t;
+  p->count++;
+  p->sum += t;
+  p->hist[b]++;
+  CRITICAL_REGION_EXIT();
+}
+
+void prof_stats(uint8_t point, prof_stats_t *stats) {
+  CRITICAL_REGION_ENTER();
+  memcpy(stats, &prof[point], sizeof(prof_stats_t));
+  CRITICAL_REGION_EXIT();
+}
+
+void prof_clear(void) {
+  CRITICAL_REGION_ENTER();
+  memset(prof, 0, sizeof(prof));
+  CRITICAL_REGION_EXIT();
+}
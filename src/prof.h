@@ -0,0 +1,72 @@
+/*
+ * prof.h
+ *
+ * Hot path profiler. Brackets of PROF_START/PROF_END time the code in
+ * between with the DWT cycle counter, on the host with clock_gettime,
+ * and collect count, min, max, sum and a histogram per point. Built with
+ * PROF=0 the brackets compile out.
+ *
+ *   PROF_START(PROF_ANIM);
+ *   ...
+ *   PROF_END(PROF_ANIM);
+ *
+ * Times are in PROF_HZ units, histogram buckets are powers of 4 of
+ * microseconds from PROF_BUCKET_US, the last one taking anything longer.
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+#include "system.h"
+
+#ifndef PROF
+#define PROF                1
+#endif
+
+// profiled points
+#define PROF_WS_ENCODE      0
+#define PROF_ANIM           1
+#define PROF_ON_DATA        2
+#define PROF_TNV_COMMIT     3
+#define PROF_TNV_READ       4
+#define PROF_POINTS         5
+
+#define PROF_BUCKETS        8
+#define PROF_BUCKET_US      16
+
+#ifdef HOST_SIM
+// nanoseconds, see prof.c
+#define PROF_HZ             1000000000
+uint32_t prof_now(void);
+#else
+#include "nrf.h"
+#define PROF_HZ             64000000
+#define prof_now()          (DWT->CYCCNT)
+#endif
+
+#if PROF
+#define PROF_START(_p)      uint32_t _prof_t_##_p = prof_now()
+#define PROF_END(_p)        prof_add((_p), prof_now() - _prof_t_##_p)
+#else
+#define PROF_START(_p)      do { } while (0)
+#define PROF_END(_p)        do { } while (0)
+#endif
+
+typedef struct {
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+  uint32_t hist[PROF_BUCKETS];
+} prof_stats_t;
+
+// starts the cycle counter
+void prof_init(void);
+
+void prof_add(uint8_t point, uint32_t t);
+
+void prof_stats(uint8_t point, prof_stats_t *stats);
+
+void prof_clear(void);
+
+#endif /* PROF_H_ */
@@ -0,0 +1,218 @@
+/*
+ * pvm.c
+ *
+ *  Pixel program virtual machine.
+ */
+
+#include "pvm.h"
+
+// quarter sine wave, amplitude 127
+static const uint8_t SINE_Q[65] = {
+    0,  3,  6,  9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+   49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+   90, 92, 94, 96, 98,100,102,104,106,107,109,111,112,113,115,116,
+  117,118,120,121,122,122,123,124,125,125,126,126,126,127,127,127,
+  127 };
+
+static int32_t _sin8(int32_t x) {
+  uint8_t k = x & 63;
+  switch ((x >> 6) & 3) {
+  case 0: return 128 + SINE_Q[k];
+  case 1: return 128 + SINE_Q[64 - k];
+  case 2: return 128 - SINE_Q[k];
+  default: return 128 - SINE_Q[64 - k];
+  }
+}
+
+static uint32_t _clamp8(int32_t v) {
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static uint16_t _clamp16(int32_t v) {
+  return v < 0 ? 0 : (v > 0xffff ? 0xffff : v);
+}
+
+// operand bytes following each opcode, -1 for illegal opcodes
+static int8_t _operands(uint8_t op) {
+  switch (op) {
+  case PVM_LIT8: case PVM_JMP: case PVM_JZ: return 1;
+  case PVM_LIT16: return 2;
+  case PVM_LIT24: return 3;
+  case PVM_END: case PVM_END16: case PVM_T: case PVM_I: case PVM_N:
+  case PVM_DUP: case PVM_DROP: case PVM_SWAP: case PVM_OVER: case PVM_ROT:
+    return 0;
+  default:
+    return (op >= PVM_ADD && op <= PVM_SCALE) ? 0 : -1;
+  }
+}
+
+static int _validate(pvm_t *vm, const uint8_t *prog, uint16_t len) {
+  uint8_t starts[PVM_MAX_LEN / 8];
+  uint16_t pc, last = 0;
+  if (len <= PVM_HDR_LEN || prog[0] != PVM_MAGIC) return PVM_ERR_MAGIC;
+  if (len > PVM_HDR_LEN + PVM_MAX_LEN) return PVM_ERR_OPERAND;
+  vm->frame_ms = prog[1];
+  vm->code = &prog[PVM_HDR_LEN];
+  vm->len = len - PVM_HDR_LEN;
+  // check once here so the interpreter needs no bounds checks on code
+  memset(starts, 0, sizeof(starts));
+  for (pc = 0; pc < vm->len; ) {
+    uint8_t op = vm->code[pc];
+    int8_t operands = _operands(op);
+    if (operands < 0) return PVM_ERR_OPCODE;
+    if (pc + 1 + operands > vm->len) return PVM_ERR_OPERAND;
+    starts[pc / 8] |= 1 << (pc & 7);
+    last = pc;
+    pc += 1 + operands;
+  }
+  // forward jumps only, so this is always reached
+  if (vm->code[last] != PVM_END && vm->code[last] != PVM_END16) return PVM_ERR_OPCODE;
+  // jumps must land on an instruction
+  for (pc = 0; pc < vm->len; pc += 1 + _operands(vm->code[pc])) {
+    uint8_t op = vm->code[pc];
+    if (op == PVM_JMP || op == PVM_JZ) {
+      uint16_t dst = pc + 2 + vm->code[pc+1];
+      if (dst >= vm->len || (starts[dst / 8] & (1 << (dst & 7))) == 0) {
+        return PVM_ERR_JUMP;
+      }
+    }
+  }
+  return PVM_OK;
+}
+
+int pvm_load(pvm_t *vm, const uint8_t *prog, uint16_t len, px_t *rgb, uint16_t leds) {
+  memset(vm, 0, sizeof(pvm_t));
+  int res = _validate(vm, prog, len);
+  if (res != PVM_OK) {
+    vm->code = 0;
+    return res;
+  }
+  vm->rgb = rgb;
+  vm->leds = leds;
+  return PVM_OK;
+}
+
+#define PUSH(v) do { if (sp >= PVM_STACK) return PVM_ERR_STACK; int32_t _v = (v); st[sp++] = _v; } while (0)
+#define NEED(n) do { if (sp < (n)) return PVM_ERR_STACK; } while (0)
+
+static int _pixel(pvm_t *vm, uint16_t ix, uint32_t *icount) {
+  int32_t st[PVM_STACK];
+  uint8_t sp = 0;
+  uint16_t pc = 0;
+  const uint8_t *c = vm->code;
+  while (1) {
+    uint8_t op = c[pc++];
+    int32_t a, b;
+    (*icount)++;
+    if (op >= PVM_ADD && op <= PVM_EQ) {
+      NEED(2);
+      b = st[--sp];
+      a = st[sp-1];
+      switch (op) {
+      // wrapping, signed overflow is undefined
+      case PVM_ADD: a = (uint32_t)a + (uint32_t)b; break;
+      case PVM_SUB: a = (uint32_t)a - (uint32_t)b; break;
+      case PVM_MUL: a = (uint32_t)a * (uint32_t)b; break;
+      // INT32_MIN / -1 overflows, traps on some hosts
+      case PVM_DIV: a = b == -1 ? -(uint32_t)a : (b ? a / b : 0); break;
+      case PVM_MOD: a = b == -1 ? 0 : (b ? a % b : 0); break;
+      case PVM_AND: a &= b; break;
+      case PVM_OR:  a |= b; break;
+      case PVM_XOR: a ^= b; break;
+      case PVM_SHL: a = (uint32_t)a << (b & 31); break;
+      case PVM_SHR: a = (uint32_t)a >> (b & 31); break;
+      case PVM_LT:  a = a < b; break;
+      case PVM_EQ:  a = a == b; break;
+      }
+      st[sp-1] = a;
+      continue;
+    }
+    switch (op) {
+    case PVM_END:
+      NEED(1);
+      vm->rgb[ix] = px_rgb(st[sp-1]);
+      return PVM_OK;
+    case PVM_END16: {
+      NEED(3);
+      px_t *p = &vm->rgb[ix];
+      p->r = _clamp16(st[sp-3]);
+      p->g = _clamp16(st[sp-2]);
+      p->b = _clamp16(st[sp-1]);
+      return PVM_OK;
+    }
+    case PVM_LIT8:
+      PUSH(c[pc]);
+      pc += 1;
+      break;
+    case PVM_LIT16:
+      PUSH(c[pc] | (c[pc+1] << 8));
+      pc += 2;
+      break;
+    case PVM_LIT24:
+      PUSH(c[pc] | (c[pc+1] << 8) | (c[pc+2] << 16));
+      pc += 3;
+      break;
+    case PVM_T: PUSH(vm->t); break;
+    case PVM_I: PUSH(ix); break;
+    case PVM_N: PUSH(vm->leds); break;
+    case PVM_DUP: NEED(1); PUSH(st[sp-1]); break;
+    case PVM_DROP: NEED(1); sp--; break;
+    case PVM_SWAP:
+      NEED(2);
+      a = st[sp-1]; st[sp-1] = st[sp-2]; st[sp-2] = a;
+      break;
+    case PVM_OVER: NEED(2); PUSH(st[sp-2]); break;
+    case PVM_ROT:
+      NEED(3);
+      a = st[sp-3]; st[sp-3] = st[sp-2]; st[sp-2] = st[sp-1]; st[sp-1] = a;
+      break;
+    case PVM_SEL:
+      NEED(3);
+      sp -= 2;
+      st[sp-1] = st[sp-1] ? st[sp] : st[sp+1];
+      break;
+    case PVM_SIN: NEED(1); st[sp-1] = _sin8(st[sp-1]); break;
+    case PVM_RGB:
+      NEED(3);
+      sp -= 2;
+      st[sp-1] = (_clamp8(st[sp-1]) << 16) | (_clamp8(st[sp]) << 8) | _clamp8(st[sp+1]);
+      break;
+    case PVM_SCALE: {
+      NEED(2);
+      uint32_t k = _clamp8(st[--sp]) + 1;
+      uint32_t rgb = st[sp-1];
+      st[sp-1] = ((((rgb >> 16) & 0xff) * k) >> 8 << 16) |
+                 ((((rgb >> 8) & 0xff) * k) >> 8 << 8) |
+                 (((rgb & 0xff) * k) >> 8);
+      break;
+    }
+    case PVM_JMP:
+      pc += 1 + c[pc];
+      break;
+    case PVM_JZ:
+      NEED(1);
+      pc += 1 + (st[--sp] == 0 ? c[pc] : 0);
+      break;
+    }
+  }
+}
+
+int pvm_frame(pvm_t *vm, uint32_t budget) {
+  uint32_t icount = 0;
+  while (vm->pix < vm->leds) {
+    // a pixel never runs more than the program length, so only start
+    // it if it fits, but always make some progress
+    if (icount > 0 && icount + vm->len > budget) {
+      vm->frame_icount += icount;
+      return 0;
+    }
+    int res = _pixel(vm, vm->pix, &icount);
+    if (res != PVM_OK) return res;
+    vm->pix++;
+  }
+  vm->last_icount = vm->frame_icount + icount;
+  vm->frame_icount = 0;
+  vm->pix = 0;
+  vm->t++;
+  return 1;
+}
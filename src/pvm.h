@@ -0,0 +1,103 @@
+/*
+ * pvm.h
+ *
+ * Pixel program virtual machine. A program is a small stack based
+ * bytecode run once per pixel and frame, computing the pixel colour
+ * from frame number and pixel index. Jumps only go forward, so a pixel
+ * costs at most one pass over the program, and frames are computed
+ * under an instruction budget, spanning several calls if needed.
+ *
+ * Program image:
+ *   [0] PVM_MAGIC
+ *   [1] frame interval in ms
+ *   [2..] code, run for each pixel until PVM_END, top of stack being
+ *         the pixel colour as 0xrrggbb, or until PVM_END16 taking
+ *         channels in 8.8 for fades finer than 8 bit
+ */
+
+#ifndef PVM_H_
+#define PVM_H_
+
+#include "system.h"
+#include "px.h"
+
+#define PVM_MAGIC           0x50
+#define PVM_HDR_LEN         2
+#define PVM_STACK           16
+// max code length
+#define PVM_MAX_LEN         256
+
+#define PVM_OK              0
+#define PVM_ERR_MAGIC       -1
+#define PVM_ERR_OPCODE      -2
+#define PVM_ERR_OPERAND     -3
+#define PVM_ERR_JUMP        -4
+#define PVM_ERR_STACK       -5
+
+// end pixel, top of stack is colour
+#define PVM_END             0x00
+// push literal of 1, 2 or 3 bytes following opcode, little endian
+#define PVM_LIT8            0x01
+#define PVM_LIT16           0x02
+#define PVM_LIT24           0x03
+// push frame number, pixel index and number of pixels
+#define PVM_T               0x04
+#define PVM_I               0x05
+#define PVM_N               0x06
+// r g b -> end pixel, channels in 8.8 clamped to 0..0xffff
+#define PVM_END16           0x07
+// stack ops
+#define PVM_DUP             0x08
+#define PVM_DROP            0x09
+#define PVM_SWAP            0x0a
+#define PVM_OVER            0x0b
+// a b c -> b c a
+#define PVM_ROT             0x0c
+// a b -> a op b, wrapping at 32 bits, division by zero gives 0
+#define PVM_ADD             0x10
+#define PVM_SUB             0x11
+#define PVM_MUL             0x12
+#define PVM_DIV             0x13
+#define PVM_MOD             0x14
+#define PVM_AND             0x15
+#define PVM_OR              0x16
+#define PVM_XOR             0x17
+#define PVM_SHL             0x18
+#define PVM_SHR             0x19
+#define PVM_LT              0x1a
+#define PVM_EQ              0x1b
+// c a b -> c ? a : b
+#define PVM_SEL             0x1c
+// x -> sine of x with period 256, range 1..255
+#define PVM_SIN             0x1d
+// r g b -> 0xrrggbb, channels clamped to 0..255
+#define PVM_RGB             0x1e
+// rgb k -> each channel of rgb times (k+1)/256, k clamped to 0..255 so
+// 255 keeps rgb and 0 leaves 1/256 of it
+#define PVM_SCALE           0x1f
+// jump forward by byte following opcode, JZ pops and jumps if zero
+#define PVM_JMP             0x20
+#define PVM_JZ              0x21
+
+typedef struct {
+  const uint8_t *code;
+  uint16_t len;
+  uint16_t frame_ms;
+  px_t *rgb;
+  uint16_t leds;
+  // next pixel to compute in current frame
+  uint16_t pix;
+  uint32_t t;
+  // instructions run in current and last complete frame
+  uint32_t frame_icount;
+  uint32_t last_icount;
+} pvm_t;
+
+// validates and loads program image, rendering to given pixel buffer
+int pvm_load(pvm_t *vm, const uint8_t *prog, uint16_t len, px_t *rgb, uint16_t leds);
+
+// computes pixels of current frame until done or budget instructions are
+// spent, returns 1 when frame is complete, 0 if not, or negative on error
+int pvm_frame(pvm_t *vm, uint32_t budget);
+
+#endif /* PVM_H_ */
@@ -0,0 +1,32 @@
+/*
+ * px.h
+ *
+ * Pixel working colour, 8.8 fixed point per channel. Colours of 8 bit
+ * per channel come in through px_rgb, fades and wide sources fill in
+ * the fractions, which dithering turns into output levels over frames,
+ * see ws2812b_make_buffer in app.c.
+ */
+
+#ifndef PX_H_
+#define PX_H_
+
+#include "system.h"
+#include <stdbool.h>
+
+typedef struct {
+  uint16_t r;
+  uint16_t g;
+  uint16_t b;
+} px_t;
+
+// 0xrrggbb to pixel without fractions
+static inline px_t px_rgb(uint32_t rgb) {
+  px_t p = { ((rgb >> 16) & 0xff) << 8, ((rgb >> 8) & 0xff) << 8, (rgb & 0xff) << 8 };
+  return p;
+}
+
+static inline bool px_eq(px_t a, px_t b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+#endif /* PX_H_ */
@@ -698,7 +698,7 @@
  
 
 #ifndef PPI_ENABLED
-#define PPI_ENABLED 0
+#define PPI_ENABLED 1
 #endif
 
 // <e> PWM_ENABLED - nrf_drv_pwm - PWM peripheral driver
@@ -1270,7 +1270,7 @@
 // <e> SPI1_ENABLED - Enable SPI1 instance
 //==========================================================
 #ifndef SPI1_ENABLED
-#define SPI1_ENABLED 0
+#define SPI1_ENABLED (WS2812B_STRIPS > 1)
 #endif
 #if  SPI1_ENABLED
 // <q> SPI1_USE_EASY_DMA  - Use EasyDMA
@@ -1286,7 +1286,7 @@
 // <e> SPI2_ENABLED - Enable SPI2 instance
 //==========================================================
 #ifndef SPI2_ENABLED
-#define SPI2_ENABLED 0
+#define SPI2_ENABLED (WS2812B_STRIPS > 2)
 #endif
 #if  SPI2_ENABLED
 // <q> SPI2_USE_EASY_DMA  - Use EasyDMA
@@ -1305,7 +1305,7 @@
 // <e> TIMER_ENABLED - nrf_drv_timer - TIMER periperal driver
 //==========================================================
 #ifndef TIMER_ENABLED
-#define TIMER_ENABLED 0
+#define TIMER_ENABLED 1
 #endif
 #if  TIMER_ENABLED
 // <o> TIMER_DEFAULT_CONFIG_FREQUENCY  - Timer frequency if in Timer mode
@@ -1373,21 +1373,21 @@
  
 
 #ifndef TIMER1_ENABLED
-#define TIMER1_ENABLED 0
+#define TIMER1_ENABLED 1
 #endif
 
 // <q> TIMER2_ENABLED  - Enable TIMER2 instance
  
 
 #ifndef TIMER2_ENABLED
-#define TIMER2_ENABLED 0
+#define TIMER2_ENABLED (WS2812B_STRIPS > 1)
 #endif
 
 // <q> TIMER3_ENABLED  - Enable TIMER3 instance
  
 
 #ifndef TIMER3_ENABLED
-#define TIMER3_ENABLED 0
+#define TIMER3_ENABLED (WS2812B_STRIPS > 2)
 #endif
 
 // <q> TIMER4_ENABLED  - Enable TIMER4 instance
@@ -1892,7 +1892,7 @@
 // <i> @ref FS_ERR_QUEUE_FULL errors when calling @ref fs_store or @ref fs_erase.
 
 #ifndef FS_QUEUE_SIZE
-#define FS_QUEUE_SIZE 4
+#define FS_QUEUE_SIZE 8
 #endif
 
 // <o> FS_OP_MAX_RETRIES - Number attempts to execute an operation if the SoftDevice fails. 
@@ -1900,7 +1900,7 @@
 // <i> error often. The SoftDevice may fail to schedule flash access due to high BLE activity.
 
 #ifndef FS_OP_MAX_RETRIES
-#define FS_OP_MAX_RETRIES 3
+#define FS_OP_MAX_RETRIES 8
 #endif
 
 // <o> FS_MAX_WRITE_SIZE_WORDS - Maximum number of words to be written to flash in a single operation. 
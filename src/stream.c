@@ -0,0 +1,72 @@
+/*
+ * stream.c
+ *
+ *  Live pixel streaming.
+ */
+
+#include "stream.h"
+
+static px_t _px(const uint8_t *p, uint8_t w) {
+  if (w == 3) return px_rgb((p[0] << 16) | (p[1] << 8) | p[2]);
+  px_t x = { (p[0] << 8) | p[1], (p[2] << 8) | p[3], (p[4] << 8) | p[5] };
+  return x;
+}
+
+void stream_init(stream_t *s, px_t *rgb, uint16_t leds) {
+  memset(s, 0, sizeof(stream_t));
+  s->rgb = rgb;
+  s->leds = leds;
+}
+
+void stream_restart(stream_t *s) {
+  s->assembling = FALSE;
+  s->shown = FALSE;
+}
+
+int stream_put(stream_t *s, const uint8_t *chunk, uint8_t len, uint32_t now) {
+  uint8_t seq = chunk[0];
+  uint8_t flags = chunk[1];
+  uint32_t start = (chunk[2] << 8) | chunk[3];
+  // bytes per led
+  uint8_t w = (flags & STREAM_F_WIDE) ? 6 : 3;
+  uint8_t i;
+
+  if ((s->shown && (int8_t)(seq - s->shown_seq) <= 0) ||
+      (s->assembling && (int8_t)(seq - s->seq) < 0)) {
+    s->stats.late++;
+    return STREAM_LATE;
+  }
+  if (!s->assembling || seq != s->seq) {
+    if (s->assembling) s->stats.incomplete++;
+    s->assembling = TRUE;
+    s->seq = seq;
+    s->t_first = now;
+  }
+
+  if (flags & STREAM_F_DELTA) {
+    for (i = STREAM_HDR_LEN; i + 1 + w <= len; i += 1 + w) {
+      uint32_t led = start + chunk[i];
+      if (led < s->leds) {
+        s->rgb[led] = _px(&chunk[i+1], w);
+      }
+    }
+  } else {
+    for (i = STREAM_HDR_LEN; i + w <= len && start < s->leds; i += w) {
+      s->rgb[start++] = _px(&chunk[i], w);
+    }
+  }
+
+  if ((flags & STREAM_F_SHOW) == 0) return STREAM_PARTIAL;
+  s->assembling = FALSE;
+  s->shown = TRUE;
+  s->shown_seq = seq;
+  s->stats.frames++;
+  return STREAM_FRAME;
+}
+
+void stream_shown(stream_t *s, uint32_t latency) {
+  s->stats.latched++;
+  s->stats.latency_last = latency;
+  s->stats.latency_sum += latency;
+  if (latency > s->stats.latency_max) s->stats.latency_max = latency;
+}
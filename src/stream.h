@@ -0,0 +1,75 @@
+/*
+ * stream.h
+ *
+ * Live pixel streaming. Frames are sent as chunks, each carrying the
+ * frame sequence number, flags and a start led, followed either by raw
+ * rgb triplets from start led or, for delta chunks, by pairs of led
+ * offset from start and rgb, touching only the leds that change.
+ *
+ *   [seq] [flags] [start hi] [start lo] [r g b]..
+ *   [seq] [flags|STREAM_F_DELTA] [start hi] [start lo] [offs r g b]..
+ *
+ * With STREAM_F_WIDE each channel is two bytes, big endian 8.8, for
+ * fades finer than 8 bit.
+ *
+ * A frame is shown on its chunk flagged STREAM_F_SHOW. Chunks of frames
+ * older than the last one shown or being assembled are dropped, and a
+ * frame still being assembled when a newer starts is abandoned.
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "system.h"
+#include "px.h"
+#include <stdbool.h>
+
+#define STREAM_HDR_LEN      4
+#define STREAM_F_SHOW       0x01
+#define STREAM_F_DELTA      0x02
+#define STREAM_F_WIDE       0x04
+
+#define STREAM_LATE         -1
+#define STREAM_PARTIAL      0
+#define STREAM_FRAME        1
+
+typedef struct {
+  uint32_t frames;
+  // chunks dropped for being late
+  uint32_t late;
+  // frames abandoned before shown
+  uint32_t incomplete;
+  // frames latched, and their latency from first chunk received, in
+  // caller time units
+  uint32_t latched;
+  uint32_t latency_last;
+  uint32_t latency_max;
+  uint32_t latency_sum;
+} stream_stats_t;
+
+typedef struct {
+  px_t *rgb;
+  uint16_t leds;
+  uint8_t seq;
+  uint8_t shown_seq;
+  bool assembling;
+  bool shown;
+  // time of first chunk of frame being assembled
+  uint32_t t_first;
+  stream_stats_t stats;
+} stream_t;
+
+// initiates stream assembling frames in given buffer
+void stream_init(stream_t *s, px_t *rgb, uint16_t leds);
+
+// forgets sequence numbers, keeping buffer contents and stats
+void stream_restart(stream_t *s);
+
+// handles a chunk received at time now, returns STREAM_FRAME if frame in
+// buffer is complete, STREAM_PARTIAL if not or STREAM_LATE if dropped
+int stream_put(stream_t *s, const uint8_t *chunk, uint8_t len, uint32_t now);
+
+// registers latency of a frame when it is finally shown
+void stream_shown(stream_t *s, uint32_t latency);
+
+#endif /* STREAM_H_ */
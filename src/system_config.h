@@ -17,6 +17,31 @@
 
 #define PIN_MOSI_NUMBER       0
 
+// Led strips, each driven by its own spi instance, at most 3. All
+// strips have the same number of leds and are laid out after each
+// other in the pixel buffer. Override from makefile, see STRIPS and
+// STRIP_LEDS.
+#ifndef WS2812B_STRIPS
+#define WS2812B_STRIPS        1
+#endif
+#ifndef WS2812B_STRIP_LEDS
+#define WS2812B_STRIP_LEDS    16
+#endif
+#if WS2812B_STRIPS < 1 || WS2812B_STRIPS > 3
+#error "WS2812B_STRIPS must be 1 to 3, one spi instance each"
+#endif
+// Mosi pin of each strip. The lf clock runs from the internal rc, see
+// main.c, so P0.00 and P0.01, xl1 and xl2 on boards with a 32 kHz
+// crystal, are free here. With a crystal, move strips off them, e.g.
+// make STRIP1_MOSI=3.
+#ifndef PIN_MOSI_STRIP1
+#define PIN_MOSI_STRIP1       1
+#endif
+#ifndef PIN_MOSI_STRIP2
+#define PIN_MOSI_STRIP2       2
+#endif
+#define PIN_MOSI_STRIPS       { PIN_MOSI_NUMBER, PIN_MOSI_STRIP1, PIN_MOSI_STRIP2 }
+
 #define DEVICE_NAME                     "Pelles BT lampa"                               /**< Name of device. Will be included in the advertising data. */
 
 #define APP_TIMER_PRESCALER             0                                           /**< Value of the RTC1 PRESCALER register. */
@@ -1,55 +1,244 @@
 #include "tnv.h"
 #include "miniutils.h"
+#include "log.h"
+#include "prof.h"
+#include "nrf_error.h"
 
 #define _stream     bitmanio_stream8_t
 #define _strwrite   bitmanio_write_z8
 #define _strread    bitmanio_read_z8
+// fields up to 32 bits
+#define _wr         bitmanio_writew_z8
+#define _rd         bitmanio_readw_z8
+
+// values are stored low byte first, so the low bytes of a value field
+// are in reverse order
+static uint32_t _bytes_rev(uint32_t v, uint8_t bytes) {
+  return bytes ? __builtin_bswap32(v) >> (32 - 8 * bytes) : 0;
+}
+
+static void _value_write(_stream *bs, uint32_t val, uint8_t len) {
+  uint8_t bytes = len / 8;
+  uint8_t rest = len & 7;
+  uint32_t f = _bytes_rev(val, bytes) << rest;
+  if (rest) f |= (val >> (8 * bytes)) & ((1 << rest) - 1);
+  _wr(bs, f, len);
+}
 
 static void _tnv_write(_stream *bs, uint32_t id, uint32_t val, uint8_t len) {
-  uint8_t buf[4];
-  int i;
-  for (i = 0; i < 3; i++) {
-    buf[i] = (val >> (i*8)) & 0xff;
-  }
-  uint8_t *d = buf;
   _strwrite(bs, id, TNV_ID_BITS);
   _strwrite(bs, len - 1, TNV_LEN_BITS);
-  while (len > 0) {
-    uint8_t ch = len > 8 ? 8 : len;
-    _strwrite(bs, *d++, ch);
-    len -= ch;
+  _value_write(bs, val, len);
+}
+
+static uint16_t _crc(uint16_t crc, uint32_t v, uint8_t bytes) {
+  while (bytes--) {
+    crc = crc_ccitt_16(crc, v & 0xff);
+    v >>= 8;
+  }
+  return crc;
+}
+
+static uint16_t _crc_rec(uint16_t crc, uint32_t id, uint32_t val, uint8_t len) {
+  crc = _crc(crc, id, 2);
+  crc = _crc(crc, len, 1);
+  return _crc(crc, val, 4);
+}
+
+// counts from TNV_ID_ESC on follow the escape in TNV_COUNT_BITS
+static uint32_t _count_bits(uint32_t count) {
+  return TNV_ID_BITS + (count >= TNV_ID_ESC ? TNV_COUNT_BITS : 0);
+}
+
+static uint32_t _rec_bits(tnv_t *tnv, uint32_t id) {
+  return TNV_ID_BITS + TNV_LEN_BITS + tnv->cache[id].bits + 1;
+}
+
+static uint8_t *_page(tnv_t *tnv, uint8_t page) {
+  return tnv->buf + page * tnv->size;
+}
+
+static uint8_t *_data(tnv_t *tnv) {
+  return _page(tnv, tnv->page) + TNV_DATA_OFFS;
+}
+
+// blob data already in current page is referred to instead of copied
+static bool _blob_ref(tnv_t *tnv, tnv_ext_t *e) {
+  return tnv->page != TNV_NO_PAGE && e->data >= _data(tnv) &&
+      e->data < _page(tnv, tnv->page) + tnv->size;
+}
+
+// returns stream position after extended record starting at pos
+static uint32_t _ext_bits(tnv_t *tnv, tnv_ext_t *e, uint32_t pos, bool fresh) {
+  pos += TNV_ID_BITS + TNV_XID_BITS + TNV_KIND_BITS;
+  if (!e->blob) return pos + TNV_LEN_BITS + e->len + 1;
+  pos += TNV_BLOB_LEN_BITS;
+  if (!fresh && _blob_ref(tnv, e)) return pos + TNV_REF_BITS;
+  return TNV_ALIGN(TNV_ALIGN(pos) + e->len * 8);
+}
+
+static tnv_ext_t *_ext(tnv_t *tnv, uint16_t id, bool alloc) {
+  tnv_ext_t *free = 0;
+  int i;
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    if (tnv->ext[i].id == id) return &tnv->ext[i];
+    if (tnv->ext[i].id == 0 && free == 0) free = &tnv->ext[i];
+  }
+  if (alloc && free) {
+    memset(free, 0, sizeof(tnv_ext_t));
+    free->id = id;
+    return free;
+  }
+  return 0;
+}
+
+static uint32_t _value_read(_stream *str, uint8_t len) {
+  uint8_t bytes = len / 8;
+  uint8_t rest = len & 7;
+  uint32_t f = _rd(str, len);
+  uint32_t value = _bytes_rev(f >> rest, bytes);
+  if (rest) value |= (f & ((1 << rest) - 1)) << (8 * bytes);
+  return value;
+}
+
+// Reads one commit at stream position, putting its values in cache if
+// apply is set. Returns 1 for a complete commit, 0 at end of data and -1
+// for a broken one. Stream is left after the commit.
+static int _tnv_read_commit(tnv_t *tnv, _stream *str, uint32_t max_bits, bool apply) {
+  uint32_t pos = bitmanio_getpos8(str);
+  if (pos + TNV_ID_BITS > max_bits) return 0;
+  uint32_t count = _strread(str, TNV_ID_BITS);
+  if (count == 0) return 0;
+  if (count == TNV_ID_ESC) {
+    if (pos + _count_bits(count) > max_bits) return -1;
+    count = _strread(str, TNV_COUNT_BITS);
   }
+  pos += _count_bits(count);
+  uint16_t crc = _crc(0xffff, count, 2);
+  while (count--) {
+    if (pos + TNV_ID_BITS + TNV_LEN_BITS > max_bits) return -1;
+    uint32_t id = _strread(str, TNV_ID_BITS);
+    pos += TNV_ID_BITS;
+    if (id == 0) return -1;
+    if (id == TNV_ID_ESC) {
+      if (pos + TNV_XID_BITS + TNV_KIND_BITS + TNV_BLOB_LEN_BITS > max_bits) return -1;
+      id = _rd(str, TNV_XID_BITS);
+      uint8_t kind = _strread(str, TNV_KIND_BITS);
+      pos += TNV_XID_BITS + TNV_KIND_BITS;
+      if (id < TNV_ID_ESC) return -1;
+      uint16_t len;
+      uint32_t value = 0;
+      const uint8_t *data = 0;
+      if (kind == TNV_KIND_VALUE) {
+        len = _strread(str, TNV_LEN_BITS) + 1;
+        pos += TNV_LEN_BITS;
+        if (pos + len > max_bits) return -1;
+        value = _value_read(str, len);
+        pos += len;
+        crc = _crc_rec(crc, id, value, len);
+      } else if (kind == TNV_KIND_BLOB) {
+        len = _rd(str, TNV_BLOB_LEN_BITS);
+        pos = TNV_ALIGN(pos + TNV_BLOB_LEN_BITS);
+        if (pos + len * 8 > max_bits) return -1;
+        data = str->mem + pos / 8;
+        crc = _crc(_crc(crc, id, 2), len, 2);
+        uint32_t i;
+        for (i = 0; i < len; i++) crc = crc_ccitt_16(crc, data[i]);
+        pos = TNV_ALIGN(pos + len * 8);
+        bitmanio_setpos8(str, pos);
+      } else if (kind == TNV_KIND_BLOB_REF) {
+        if (pos + TNV_BLOB_LEN_BITS + TNV_REF_BITS > max_bits) return -1;
+        len = _rd(str, TNV_BLOB_LEN_BITS);
+        uint32_t ref = _rd(str, TNV_REF_BITS);
+        pos += TNV_BLOB_LEN_BITS + TNV_REF_BITS;
+        // only earlier data of this page
+        if (ref * 32 + len * 8 > pos) return -1;
+        data = str->mem + ref * 4;
+        crc = _crc(_crc(_crc(crc, id, 2), len, 2), ref, 2);
+      } else {
+        return -1;
+      }
+      if (apply) {
+        tnv_ext_t *e = _ext(tnv, id, TRUE);
+        if (e == 0) {
+          log_warn("tnv.no room for %i\n", id);
+          continue;
+        }
+        e->blob = kind != TNV_KIND_VALUE;
+        e->len = e->blob ? len : len - 1;
+        e->value = value;
+        e->data = data;
+        e->dirty = 0;
+      }
+      continue;
+    }
+    uint8_t len = _strread(str, TNV_LEN_BITS) + 1;
+    pos += TNV_LEN_BITS;
+    if (pos + len > max_bits) return -1;
+    uint32_t value = _value_read(str, len);
+    pos += len;
+    crc = _crc_rec(crc, id, value, len);
+    if (apply) {
+      tnv->cache[id].bits = len - 1;
+      tnv->cache[id].value = value;
+      tnv->cache[id].defined = 1;
+      tnv->cache[id].dirty = 0;
+    }
+  }
+  if (pos + TNV_CRC_BITS > max_bits) return -1;
+  if (_rd(str, TNV_CRC_BITS) != crc) return -1;
+  bitmanio_setpos8(str, TNV_ALIGN(pos + TNV_CRC_BITS));
+  return 1;
 }
 
-static void _tnv_read(tnv_t *tnv,_stream *str) {
+// Reads all complete commits. A broken commit and anything after it is
+// ignored, and stream is left at page end so next commit moves on.
+static void _tnv_read(tnv_t *tnv, _stream *str, uint32_t max_bits) {
+  uint32_t pos, commits = 0;
+  int res;
+  PROF_START(PROF_TNV_READ);
+  while (1) {
+    pos = bitmanio_getpos8(str);
+    res = _tnv_read_commit(tnv, str, max_bits, FALSE);
+    if (res <= 0) break;
+    bitmanio_setpos8(str, pos);
+    _tnv_read_commit(tnv, str, max_bits, TRUE);
+    commits++;
+  }
+  bitmanio_setpos8(str, pos);
+  if (res == 0) {
+    // end of data, unless something was written after it
+    uint8_t *d = str->mem + pos / 8;
+    uint32_t i;
+    for (i = 0; i < (max_bits - pos) / 8 && d[i] == 0xff; i++);
+    if (i < (max_bits - pos) / 8) res = -1;
+  }
+  if (res < 0) {
+    log_warn("tnv.broken commit at bit %i, rolled back\n", pos);
+    bitmanio_setpos8(str, max_bits);
+  }
+  tnv->tail = commits;
+  PROF_END(PROF_TNV_READ);
+}
+
+// Reads the old single page format without commit framing.
+static void _tnv_read_old(tnv_t *tnv,_stream *str, uint32_t max_bits) {
   const uint8_t end_id = 0;
   uint8_t id;
   uint32_t last_pos = bitmanio_getpos8(str);
   do {
-    if (last_pos + TNV_ID_BITS >= TNV_BUF_SIZE*8) break;
+    if (last_pos + TNV_ID_BITS >= max_bits) break;
     id = _strread(str, TNV_ID_BITS);
     if (id == end_id) {
       break;
     }
-    if (last_pos + TNV_LEN_BITS >= TNV_BUF_SIZE*8) break;
+    if (last_pos + TNV_LEN_BITS >= max_bits) break;
     uint8_t len = _strread(str, TNV_LEN_BITS) + 1;
-    uint8_t len2 = len;
-    if (last_pos + len >= TNV_BUF_SIZE*8) break;
-    tnv->cache[id].bits = len -1;
-    uint32_t value = 0;
-    while (len > 0) {
-      uint8_t ch = len > 8 ? 8 : len;
-      uint8_t d = _strread(str, ch);
-      value |= d << (len2 - len);
-      len -= ch;
-    }
-    tnv->cache[id].value = value;
-    tnv->cache[id].defined = 1;
-    tnv->cache[id].dirty = 0;
-    //print("tnv.rd %i=%08x [%i]\n", id, value, len2);
+    if (last_pos + len >= max_bits) break;
+    // the escape id was a plain one then
+    tnv_set(tnv, id, _value_read(str, len));
     last_pos = bitmanio_getpos8(str);
   } while (id != end_id);
-  bitmanio_setpos8(str, last_pos);
 }
 
 static uint32_t _msb(uint32_t d) {
@@ -58,93 +247,432 @@ static uint32_t _msb(uint32_t d) {
   return b+1;
 }
 
+static uint32_t _page_bits(tnv_t *tnv) {
+  return (tnv->size - TNV_DATA_OFFS) * 8;
+}
+
+static uint32_t _rd32(const uint8_t *b) {
+  return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static bool _blank(tnv_t *tnv, uint8_t page) {
+  uint32_t *w = (uint32_t *)_page(tnv, page);
+  uint32_t i;
+  for (i = 0; i < tnv->size / 4; i++) {
+    if (w[i] != 0xffffffff) return FALSE;
+  }
+  return TRUE;
+}
+
+static void _hdr_make(uint8_t *hdr, uint32_t seq) {
+  uint16_t crc = _crc(0xffff, seq, 4);
+  hdr[0] = TNV_MAGIC & 0xff;
+  hdr[1] = TNV_MAGIC >> 8;
+  hdr[2] = crc;
+  hdr[3] = crc >> 8;
+  hdr[4] = seq;
+  hdr[5] = seq >> 8;
+  hdr[6] = seq >> 16;
+  hdr[7] = seq >> 24;
+}
+
+// Finds the valid page with highest sequence number below given one, a
+// header half written or half erased fails its crc.
+static uint8_t _tnv_scan(tnv_t *tnv, uint32_t below, bool any) {
+  uint8_t p, page = TNV_NO_PAGE;
+  uint32_t max = 0;
+  for (p = 0; p < tnv->pages; p++) {
+    uint8_t hdr[TNV_HDR_LEN];
+    uint32_t seq = _rd32(&_page(tnv, p)[4]);
+    uint8_t i;
+    _hdr_make(hdr, seq);
+    for (i = 0; i < TNV_HDR_LEN && hdr[i] == _page(tnv, p)[i]; i++);
+    if (i < TNV_HDR_LEN) continue;
+    if (!any && (int32_t)(seq - below) >= 0) continue;
+    if (page == TNV_NO_PAGE || (int32_t)(seq - max) > 0) {
+      page = p;
+      max = seq;
+    }
+  }
+  tnv->seq = max;
+  return page;
+}
+
+static uint32_t _slot(uint32_t wix) {
+  return (wix & 0xffff) | ((~wix & 0xffff) << 16);
+}
+
+// Returns bit position of latest checkpoint in index of current page,
+// counting used slots. A half written slot is used but not valid.
+static uint32_t _tnv_index(tnv_t *tnv) {
+  uint8_t *ix = _page(tnv, tnv->page) + TNV_HDR_LEN;
+  uint32_t pos = 0;
+  for (tnv->slots = 0; tnv->slots < TNV_INDEX_SLOTS; tnv->slots++) {
+    uint32_t slot = _rd32(&ix[tnv->slots * 4]);
+    if (slot == 0xffffffff) break;
+    if (slot == _slot(slot)) pos = (slot & 0xffff) * 32;
+  }
+  return pos;
+}
+
+static void _tnv_load(tnv_t *tnv) {
+  memset(tnv->cache, 0, sizeof(tnv->cache));
+  memset(tnv->ext, 0, sizeof(tnv->ext));
+  tnv->tail = 0;
+  tnv->slots = 0;
+  tnv->page = _tnv_scan(tnv, 0, TRUE);
+  while (tnv->page != TNV_NO_PAGE) {
+    // replay from latest checkpoint
+    uint32_t pos = _tnv_index(tnv);
+    bitmanio_init_stream8(&tnv->str, _page(tnv, tnv->page) + TNV_DATA_OFFS);
+    bitmanio_setpos8(&tnv->str, pos);
+    _tnv_read(tnv, &tnv->str, _page_bits(tnv));
+    if (tnv->tail == 0 && pos) {
+      // index pointing at garbage, replay all
+      memset(tnv->cache, 0, sizeof(tnv->cache));
+      memset(tnv->ext, 0, sizeof(tnv->ext));
+      bitmanio_setpos8(&tnv->str, 0);
+      _tnv_read(tnv, &tnv->str, _page_bits(tnv));
+    }
+    log_info("tnv.page %i seq %i, checkpoint %i, %i commits, %i bits\n", tnv->page, tnv->seq, pos,
+        tnv->tail, bitmanio_getpos8(&tnv->str));
+    if (tnv->tail) return;
+    // nothing usable, older page then, next commit moves on from it
+    uint8_t page = _tnv_scan(tnv, tnv->seq, FALSE);
+    if (page == TNV_NO_PAGE) {
+      // keep sequence going
+      tnv->seq = _rd32(&_page(tnv, tnv->page)[4]);
+      tnv->slots = TNV_INDEX_SLOTS;
+      bitmanio_setpos8(&tnv->str, _page_bits(tnv));
+      return;
+    }
+    tnv->page = page;
+  }
+  if (tnv->pages > 1 && _page(tnv, tnv->pages - 1)[0] != 0xff) {
+    // values of the old single page store, without header, in last page
+    // of the ring. They are moved to first page on next commit.
+    bitmanio_init_stream8(&tnv->str, _page(tnv, tnv->pages - 1));
+    _tnv_read_old(tnv, &tnv->str, 512*8);
+    log_info("tnv.old page read\n");
+  }
+}
+
 void tnv_init(tnv_t *tnv,
               uint8_t *buf,
+              uint32_t size,
+              uint8_t pages,
               tnv_buf_write_fn_t write,
               tnv_buf_erase_fn_t erase) {
   tnv->write = write;
   tnv->erase = erase;
   tnv->buf = buf;
-  memset(tnv->cache, 0, sizeof(tnv->cache));
-  bitmanio_init_stream8(&tnv->str, tnv->buf);
-  _tnv_read(tnv, &tnv->str);
+  tnv->size = size;
+  tnv->pages = pages;
+  tnv->checkpoint = TNV_CHECKPOINT;
+  tnv->blob_max = (1<<TNV_BLOB_LEN_BITS) - 1;
+  _tnv_load(tnv);
 }
 
 void tnv_reload(tnv_t *tnv) {
-  print("tnv.reload\n");
-  bitmanio_init_stream8(&tnv->str, tnv->buf);
-  _tnv_read(tnv, &tnv->str);
+  log_info("tnv.reload\n");
+  _tnv_load(tnv);
 }
 
-void tnv_set(tnv_t *tnv, uint8_t id, uint32_t value) {
+void tnv_recover(tnv_t *tnv) {
+  int i;
+  tnv_t ram = *tnv;
+  log_warn("tnv.recover\n");
+  _tnv_load(tnv);
+  for (i = 1; i < TNV_ID_ESC; i++) {
+    if (ram.cache[i].defined) tnv_set(tnv, i, ram.cache[i].value);
+  }
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    if (ram.ext[i].id && !ram.ext[i].blob) tnv_set(tnv, ram.ext[i].id, ram.ext[i].value);
+  }
+  // failed writes may have left anything after the loaded commits
+  if (tnv->page != TNV_NO_PAGE) bitmanio_setpos8(&tnv->str, _page_bits(tnv));
+}
+
+uint32_t tnv_format(tnv_t *tnv) {
+  uint32_t res = 0;
+  uint8_t p;
+  for (p = 0; p < tnv->pages && res == 0; p++) {
+    if (!_blank(tnv, p)) res = tnv->erase(_page(tnv, p));
+  }
+  memset(tnv->cache, 0, sizeof(tnv->cache));
+  memset(tnv->ext, 0, sizeof(tnv->ext));
+  tnv->page = TNV_NO_PAGE;
+  tnv->seq = 0;
+  return res;
+}
+
+uint32_t tnv_set(tnv_t *tnv, uint16_t id, uint32_t value) {
+  if (id >= TNV_ID_ESC) {
+    if (id > TNV_ID_MAX) return NRF_ERROR_INVALID_PARAM;
+    tnv_ext_t *e = _ext(tnv, id, TRUE);
+    if (e == 0) return NRF_ERROR_NO_MEM;
+    e->blob = 0;
+    e->len = _msb(value) - 1;
+    e->value = value;
+    e->dirty = 1;
+    return 0;
+  }
   tnv->cache[id].bits = _msb(value) - 1;
   tnv->cache[id].value = value;
   tnv->cache[id].defined = 1;
   tnv->cache[id].dirty = 1;
+  return 0;
 }
 
-uint32_t tnv_get(tnv_t *tnv, uint8_t id, uint32_t def) {
-  if (tnv->cache[id].defined) {
+uint32_t tnv_get(tnv_t *tnv, uint16_t id, uint32_t def) {
+  if (id >= TNV_ID_ESC) {
+    tnv_ext_t *e = _ext(tnv, id, FALSE);
+    if (e && !e->blob) return e->value;
+    // a blob is not replaced by the default
+    if (e) return def;
+  } else if (tnv->cache[id].defined) {
     return tnv->cache[id].value;
   }
   tnv_set(tnv, id, def);
   return def;
 }
 
-uint32_t tnv_commit(tnv_t *tnv) {
-  // calculate needed bits for this commit
+uint32_t tnv_set_blob(tnv_t *tnv, uint16_t id, const uint8_t *data, uint32_t len) {
+  if (id < TNV_ID_ESC || id > TNV_ID_MAX || len >= 1<<TNV_BLOB_LEN_BITS) {
+    return NRF_ERROR_INVALID_PARAM;
+  }
+  uint32_t total = len;
   int i;
-  uint32_t bits_needed = 0;
-  for (i = 1; i < 1<<TNV_ID_BITS; i++) {
-    if (tnv->cache[i].defined && tnv->cache[i].dirty) {
-      bits_needed += TNV_ID_BITS + TNV_LEN_BITS + tnv->cache[i].bits + 1;
-      print("tnv:%i dirty, %i bits needed\n", i, bits_needed);
-    }
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id && e->id != id && e->blob) total += e->len;
+  }
+  if (total > tnv->blob_max) return NRF_ERROR_NO_MEM;
+  bool had = _ext(tnv, id, FALSE) != 0;
+  tnv_ext_t *e = _ext(tnv, id, TRUE);
+  if (e == 0) return NRF_ERROR_NO_MEM;
+  tnv_ext_t old = *e;
+  e->blob = 1;
+  e->len = len;
+  e->data = data;
+  e->dirty = 1;
+  uint32_t res = tnv_commit(tnv);
+  if (res) {
+    // caller data is not kept beyond this call
+    if (had) *e = old;
+    else e->id = 0;
   }
-  if (bits_needed == 0) {
+  return res;
+}
+
+const uint8_t *tnv_get_blob(tnv_t *tnv, uint16_t id, uint32_t *len) {
+  tnv_ext_t *e = _ext(tnv, id, FALSE);
+  if (e == 0 || !e->blob || e->len == 0) return 0;
+  *len = e->len;
+  return e->data;
+}
+
+// Counts records and bits of dirty values, or of all values for a
+// checkpoint. Removed blobs are left out of checkpoints.
+static uint32_t _commit_bits(tnv_t *tnv, bool all, bool fresh, uint32_t *count) {
+  int i;
+  uint32_t bits;
+  for (*count = 0, i = 1; i < TNV_ID_ESC; i++) {
+    if (tnv->cache[i].defined && (all || tnv->cache[i].dirty)) (*count)++;
+  }
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id == 0 || !(all || e->dirty)) continue;
+    if (all && e->blob && e->len == 0) continue;
+    (*count)++;
+  }
+  // blob data alignment depends on position, count comes first
+  bits = _count_bits(*count);
+  for (i = 1; i < TNV_ID_ESC; i++) {
+    if (tnv->cache[i].defined && (all || tnv->cache[i].dirty)) bits += _rec_bits(tnv, i);
+  }
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id == 0 || !(all || e->dirty)) continue;
+    if (all && e->blob && e->len == 0) continue;
+    bits = _ext_bits(tnv, e, bits, fresh);
+  }
+  return bits + TNV_CRC_BITS;
+}
+
+// Sets written once writing to the page has started.
+static uint32_t _tnv_commit(tnv_t *tnv, bool *written) {
+  // calculate needed bits for this commit
+  int i;
+  uint32_t count;
+  uint32_t bits_needed = _commit_bits(tnv, FALSE, FALSE, &count);
+  if (count == 0) {
     return 0;
   }
+  log_dbg("tnv:%i dirty, %i bits needed\n", count, bits_needed);
 
   // calculate bits left in page
-  uint32_t bits_left = TNV_BUF_SIZE*8 - bitmanio_getpos8(&tnv->str);
-  if (bits_needed > bits_left) {
-    print("tnv:%i bits needed, have %i - erase\n", bits_needed, bits_left);
-    // need more bits than we have, dirtify all defined values and recalc needed bits..
-    bits_needed = 0;
-    for (i = 1; i < 1<<TNV_ID_BITS; i++) {
-      if (tnv->cache[i].defined) {
-        tnv->cache[i].dirty = 1;
-        bits_needed += TNV_ID_BITS + TNV_LEN_BITS + tnv->cache[i].bits + 1;
-      }
+  uint32_t bits_left = tnv->page == TNV_NO_PAGE ? 0 :
+      _page_bits(tnv) - bitmanio_getpos8(&tnv->str);
+  bool checkpoint = tnv->checkpoint && tnv->tail >= tnv->checkpoint;
+  bool move = bits_needed > bits_left || (checkpoint && tnv->slots >= TNV_INDEX_SLOTS);
+  if (checkpoint && !move) {
+    // all defined values go into this commit, recalc needed bits..
+    bits_needed = _commit_bits(tnv, TRUE, FALSE, &count);
+    move = bits_needed > bits_left;
+  }
+  if (move) {
+    // .. also when moving, now with all blobs copied
+    bits_needed = _commit_bits(tnv, TRUE, TRUE, &count);
+    if (bits_needed > _page_bits(tnv)) return NRF_ERROR_NO_MEM;
+    // .. erase next page, current one keeps all values until this is done ..
+    uint8_t next = tnv->page == TNV_NO_PAGE ? 0 : (tnv->page + 1) % tnv->pages;
+    log_info("tnv:%i bits needed, have %i - move to page %i\n", bits_needed, bits_left, next);
+    if (!_blank(tnv, next)) {
+      uint32_t res = tnv->erase(_page(tnv, next));
+      if (res) return res;
     }
-    // .. erase page ..
-    tnv->erase(tnv->buf);
-    // .. and reset stream
-    bitmanio_setpos8(&tnv->str, 0);
+    // .. and start stream there
+    tnv->page = next;
+    tnv->seq++;
+    tnv->slots = 0;
+    // first commit of a page is a checkpoint, not needing the index
+    checkpoint = FALSE;
+    tnv->tail = 0;
+    bitmanio_init_stream8(&tnv->str, _data(tnv));
   }
+  bool all = checkpoint || move;
+  *written = TRUE;
 
-  // make a ram buffer to write dirty values to
+  // make a ram buffer to write the commit to, commits start word aligned
+  // so earlier ones are never written again. Blob data is written from
+  // where it is, the buffer is written before each blob and at the end.
+  uint32_t res = 0;
   uint32_t bitpos = bitmanio_getpos8(&tnv->str);
-  uint32_t wbuf_len = ((bitpos & 7) + bits_needed + 7) / 8;
+  uint32_t wbuf_len = (bits_needed + 7) / 8;
+  for (i = 0; i < TNV_EXT_ENTRIES; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id && (all || e->dirty) && e->blob && (move || !_blob_ref(tnv, e))) {
+      wbuf_len -= e->len;
+    }
+  }
   uint8_t wrbuf[wbuf_len];
   memset(wrbuf, 0xff, wbuf_len);
-  // initiate first byte with real content
-  wrbuf[0] = tnv->buf[bitpos / 8];
-  // make stream and position it properly
   _stream wrstr;
   bitmanio_init_stream8(&wrstr, wrbuf);
-  bitmanio_setpos8(&wrstr, bitpos & 7);
+  // commit position where buffer starts
+  uint32_t seg = 0;
 
-  // dump all dirty stuff to buffer
-  for (i = 1; i < 1<<TNV_ID_BITS; i++) {
-    if (tnv->cache[i].defined && tnv->cache[i].dirty) {
+  // dump count, all dirty stuff and crc to buffer
+  uint16_t crc = _crc(0xffff, count, 2);
+  if (count >= TNV_ID_ESC) {
+    _strwrite(&wrstr, TNV_ID_ESC, TNV_ID_BITS);
+    _strwrite(&wrstr, count, TNV_COUNT_BITS);
+  } else {
+    _strwrite(&wrstr, count, TNV_ID_BITS);
+  }
+  for (i = 1; i < TNV_ID_ESC; i++) {
+    if (tnv->cache[i].defined && (all || tnv->cache[i].dirty)) {
       _tnv_write(&wrstr, i, tnv->cache[i].value, tnv->cache[i].bits+1);
+      crc = _crc_rec(crc, i, tnv->cache[i].value, tnv->cache[i].bits+1);
       tnv->cache[i].dirty = 0;
-      print("tnv:dump %i, bitpos %i\n", i, bitmanio_getpos8(&wrstr));
     }
   }
+  for (i = 0; i < TNV_EXT_ENTRIES && res == 0; i++) {
+    tnv_ext_t *e = &tnv->ext[i];
+    if (e->id == 0 || !(all || e->dirty)) continue;
+    e->dirty = 0;
+    if (all && e->blob && e->len == 0) {
+      // removed blob, forget it
+      e->id = 0;
+      continue;
+    }
+    _strwrite(&wrstr, TNV_ID_ESC, TNV_ID_BITS);
+    _wr(&wrstr, e->id, TNV_XID_BITS);
+    if (!e->blob) {
+      _strwrite(&wrstr, TNV_KIND_VALUE, TNV_KIND_BITS);
+      _strwrite(&wrstr, e->len, TNV_LEN_BITS);
+      _value_write(&wrstr, e->value, e->len + 1);
+      crc = _crc_rec(crc, e->id, e->value, e->len + 1);
+    } else if (!move && _blob_ref(tnv, e)) {
+      uint32_t ref = (e->data - _data(tnv)) / 4;
+      _strwrite(&wrstr, TNV_KIND_BLOB_REF, TNV_KIND_BITS);
+      _wr(&wrstr, e->len, TNV_BLOB_LEN_BITS);
+      _wr(&wrstr, ref, TNV_REF_BITS);
+      crc = _crc(_crc(_crc(crc, e->id, 2), e->len, 2), ref, 2);
+    } else {
+      _strwrite(&wrstr, TNV_KIND_BLOB, TNV_KIND_BITS);
+      _wr(&wrstr, e->len, TNV_BLOB_LEN_BITS);
+      crc = _crc(_crc(crc, e->id, 2), e->len, 2);
+      uint32_t j;
+      for (j = 0; j < e->len; j++) crc = crc_ccitt_16(crc, e->data[j]);
+      // buffer up to word aligned blob data, then the data itself
+      uint32_t pos = TNV_ALIGN(seg + bitmanio_getpos8(&wrstr));
+      res = tnv->write(_data(tnv), (bitpos + seg) / 8, (pos - seg) / 8, wrbuf);
+      if (res == 0 && e->len) {
+        res = tnv->write(_data(tnv), (bitpos + pos) / 8, e->len, (uint8_t *)e->data);
+      }
+      e->data = _data(tnv) + (bitpos + pos) / 8;
+      seg = TNV_ALIGN(pos + e->len * 8);
+      memset(wrbuf, 0xff, wbuf_len);
+      bitmanio_init_stream8(&wrstr, wrbuf);
+    }
+  }
+  if (res) return res;
+  _wr(&wrstr, crc, TNV_CRC_BITS);
+  log_dbg("tnv:dump %i records, %i bits\n", count, seg + bitmanio_getpos8(&wrstr));
   // update read stream pointer to what we're about to write
-  bitmanio_setpos8(&tnv->str, bitpos + bits_needed);
+  bitmanio_setpos8(&tnv->str, TNV_ALIGN(bitpos + bits_needed));
+  tnv->tail = checkpoint ? 1 : tnv->tail + 1;
   // and write
-  return tnv->write(tnv->buf, bitpos/8, (bitmanio_getpos8(&wrstr) + 7)/8, wrbuf);
+  res = tnv->write(_data(tnv), (bitpos + seg) / 8, (bitmanio_getpos8(&wrstr) + 7) / 8, wrbuf);
+  if (res == 0 && checkpoint) {
+    // checkpoint is in place, index it
+    uint32_t slot = _slot(bitpos / 32);
+    uint8_t sbuf[4] = { slot, slot >> 8, slot >> 16, slot >> 24 };
+    res = tnv->write(_page(tnv, tnv->page), TNV_HDR_LEN + tnv->slots * 4, 4, sbuf);
+    tnv->slots++;
+  }
+  if (res == 0 && move) {
+    // values are in place, header makes the page valid
+    uint8_t hdr[TNV_HDR_LEN];
+    _hdr_make(hdr, tnv->seq);
+    res = tnv->write(_page(tnv, tnv->page), 0, TNV_HDR_LEN, hdr);
+  }
+  return res;
+}
+
+uint32_t tnv_commit(tnv_t *tnv) {
+  PROF_START(PROF_TNV_COMMIT);
+  // a commit clears dirty flags, forgets removed blobs and moves blob
+  // data as it goes, so all that is put back if a write fails
+  uint8_t cache[sizeof(tnv->cache)];
+  tnv_ext_t ext[TNV_EXT_ENTRIES];
+  _stream str = tnv->str;
+  uint8_t page = tnv->page;
+  uint8_t slots = tnv->slots;
+  uint32_t seq = tnv->seq;
+  uint32_t tail = tnv->tail;
+  memcpy(cache, tnv->cache, sizeof(cache));
+  memcpy(ext, tnv->ext, sizeof(ext));
+  bool written = FALSE;
+  uint32_t res = _tnv_commit(tnv, &written);
+  if (res) {
+    log_warn("tnv.commit failed, res %i, undone\n", res);
+    memcpy(tnv->cache, cache, sizeof(cache));
+    memcpy(tnv->ext, ext, sizeof(ext));
+    bool moved = tnv->page != page;
+    tnv->str = str;
+    tnv->page = page;
+    tnv->slots = slots;
+    tnv->seq = seq;
+    tnv->tail = tail;
+    if (written && !moved) {
+      // part of the commit may be in flash, which is not written twice,
+      // and on load it is a broken commit ending the page
+      bitmanio_setpos8(&tnv->str, _page_bits(tnv));
+    }
+  }
+  PROF_END(PROF_TNV_COMMIT);
+  return res;
 }
@@ -15,45 +15,178 @@
 #define BITMANIO_HEADER
 #include BITMANIO_H_WHEREABOUTS
 
-#ifndef TNV_BUF_SIZE
-#define TNV_BUF_SIZE              512
-#endif
 #ifndef TNV_ID_BITS
 #define TNV_ID_BITS               4
 #endif
 #ifndef TNV_LEN_BITS
 #define TNV_LEN_BITS              5
 #endif
+// ids of extended records
+#ifndef TNV_XID_BITS
+#define TNV_XID_BITS              12
+#endif
+#if TNV_XID_BITS < 8 || TNV_XID_BITS > 12
+#error TNV_XID_BITS must be 8 to 12
+#endif
+// extended values and blobs kept track of in ram
+#ifndef TNV_EXT_ENTRIES
+#define TNV_EXT_ENTRIES           16
+#endif
+
+// Values are appended to a bit stream in one of a ring of pages. A page
+// starts with a header of magic and sequence number, written after the
+// values it carries, and the valid page with the highest sequence number
+// is the current one. When it is full, all live values are copied to the
+// next page, whose erase is the only one needed. The full page stays
+// valid until the next page has its header, and erases are spread over
+// all pages.
+//
+// Each commit is framed by a record count and a crc_ccitt_16 over its
+// records, and starts word aligned. A commit cut by power loss fails its
+// crc, and on load everything from it on is ignored, rolling back to the
+// last complete commit. The next commit then goes to a fresh page.
+//
+// Every TNV_CHECKPOINT commits, a commit carries all defined values and
+// its word offset is put in the next free slot of an index after the
+// page header. Loading starts at the latest indexed checkpoint, so at
+// most TNV_CHECKPOINT commits are replayed whatever the page fill. The
+// first commit of a page is a checkpoint too, and when the index is full
+// the next checkpoint moves on to the next page.
+//
+// Page layout:
+//   [0..1] TNV_MAGIC, little endian
+//   [2..3] crc_ccitt_16 of sequence number, little endian
+//   [4..7] sequence number, little endian
+//   [8..]  TNV_INDEX_SLOTS slots of checkpoint word offset in low half
+//          and its inverse in high half, little endian
+//   [TNV_DATA_OFFS..] commits
+//
+// Ids below TNV_ID_ESC are kept in a record of their own, as dense as
+// ever. Larger ids, up to TNV_ID_MAX, go in extended records carrying a
+// value or a blob of bytes. Blob data is word aligned and stored as is,
+// so it is read straight from flash, and checkpoints refer to data
+// already in the page instead of copying it. Blobs need two pages at
+// least, their data is copied from the current page when moving.
+//
+// Commit layout, bits:
+//   count:TNV_ID_BITS, 0 ends the page, TNV_ID_ESC for count:TNV_COUNT_BITS
+//   count * record
+//   crc:TNV_CRC_BITS, over count, ids, lens, values and blob data
+//
+// Record layout, bits:
+//   id:TNV_ID_BITS len-1:TNV_LEN_BITS value:len
+//   TNV_ID_ESC:TNV_ID_BITS id:TNV_XID_BITS kind:TNV_KIND_BITS, then by kind
+//     TNV_KIND_VALUE     len-1:TNV_LEN_BITS value:len
+//     TNV_KIND_BLOB      bytes:TNV_BLOB_LEN_BITS, word aligned data, aligned
+//     TNV_KIND_BLOB_REF  bytes:TNV_BLOB_LEN_BITS word:TNV_REF_BITS, earlier
+//                        data in page
+#define TNV_MAGIC                 0x5654
+#define TNV_HDR_LEN               8
+#ifndef TNV_INDEX_SLOTS
+#define TNV_INDEX_SLOTS           32
+#endif
+#define TNV_DATA_OFFS             (TNV_HDR_LEN + TNV_INDEX_SLOTS * 4)
+// commits between checkpoints, 0 for none
+#ifndef TNV_CHECKPOINT
+#define TNV_CHECKPOINT            32
+#endif
+#define TNV_CRC_BITS              16
+#define TNV_COUNT_BITS            8
+#define TNV_ID_ESC                ((1<<TNV_ID_BITS) - 1)
+#define TNV_ID_MAX                ((1<<TNV_XID_BITS) - 1)
+#define TNV_KIND_BITS             2
+#define TNV_KIND_VALUE            0
+#define TNV_KIND_BLOB             1
+#define TNV_KIND_BLOB_REF         2
+#define TNV_BLOB_LEN_BITS         12
+#define TNV_REF_BITS              16
+#if TNV_ID_ESC - 1 + TNV_EXT_ENTRIES >= 1<<TNV_COUNT_BITS
+#error too many values for a checkpoint
+#endif
+#define TNV_ALIGN(bits)           (((bits) + 31) & ~31)
+#define TNV_NO_PAGE               0xff
 
 typedef uint32_t (* tnv_buf_write_fn_t)(uint8_t *buf, uint32_t offs, uint32_t len, uint8_t *src);
 typedef uint32_t (* tnv_buf_erase_fn_t)(uint8_t *buf);
 
+typedef struct {
+  // 0 when free
+  uint16_t id;
+  // value bits - 1, or blob bytes
+  uint16_t len;
+  uint8_t blob : 1;
+  uint8_t dirty : 1;
+  uint32_t value;
+  const uint8_t *data;
+} tnv_ext_t;
+
 typedef struct tnv_s {
   bitmanio_stream8_t str;
   uint8_t *buf;
+  uint32_t size;
+  uint8_t pages;
+  // current page or TNV_NO_PAGE, and its sequence number
+  uint8_t page;
+  uint32_t seq;
+  // complete commits from latest checkpoint, including it
+  uint32_t tail;
+  // used index slots in current page
+  uint8_t slots;
+  // commits between checkpoints, TNV_CHECKPOINT by tnv_init
+  uint8_t checkpoint;
+  // bytes of all blobs together, a commit moving to the next page writes
+  // them all, (1<<TNV_BLOB_LEN_BITS) - 1 by tnv_init
+  uint32_t blob_max;
   struct {
     uint32_t value  : 32;
     uint32_t bits   : TNV_LEN_BITS;
     uint8_t defined : 1;
     uint8_t dirty :   1;
   } __attribute__(( packed )) cache[1<<TNV_ID_BITS];
+  tnv_ext_t ext[TNV_EXT_ENTRIES];
   tnv_buf_write_fn_t write;
   tnv_buf_erase_fn_t erase;
 } tnv_t;
 
 
+// buf is the first of pages pages of size bytes each
 void tnv_init(tnv_t *tnv,
               uint8_t *buf,
+              uint32_t size,
+              uint8_t pages,
               tnv_buf_write_fn_t write,
               tnv_buf_erase_fn_t erase);
 
-void tnv_set(tnv_t *tnv, uint8_t id, uint32_t value);
+// ids from TNV_ID_ESC need a free extended entry, or NRF_ERROR_NO_MEM,
+// ids beyond TNV_ID_MAX give NRF_ERROR_INVALID_PARAM
+uint32_t tnv_set(tnv_t *tnv, uint16_t id, uint32_t value);
+
+// returns value of id, or sets and returns def if it has none, def is
+// returned but not stored for a blob id
+uint32_t tnv_get(tnv_t *tnv, uint16_t id, uint32_t def);
 
-uint32_t tnv_get(tnv_t *tnv, uint8_t id, uint32_t def);
+// Stores len bytes of data under an id from TNV_ID_ESC and commits, len
+// 0 removes the blob. Data in flash is valid when the writes are done.
+// Blobs beyond blob_max give NRF_ERROR_NO_MEM, and if the commit fails
+// the blob is left as it was.
+uint32_t tnv_set_blob(tnv_t *tnv, uint16_t id, const uint8_t *data, uint32_t len);
 
+// returns blob data in flash and sets its length, or 0 if no blob
+const uint8_t *tnv_get_blob(tnv_t *tnv, uint16_t id, uint32_t *len);
+
+// A failed commit is undone, its values stay dirty for the next one. If
+// the current page was written to, the next one moves on to a new page.
 uint32_t tnv_commit(tnv_t *tnv);
 
 void tnv_reload(tnv_t *tnv);
 
+// After flash writes that failed once queued, goes back to the last
+// commit in flash and sets all values in ram again, dirty, for the next
+// commit to write to a fresh page. Blobs are what was in flash.
+void tnv_recover(tnv_t *tnv);
+
+// erases all pages and forgets all values
+uint32_t tnv_format(tnv_t *tnv);
+
 
 #endif /* TNV_H_ */
@@ -1,6 +1,9 @@
 #ifndef __TYPE_H
 #define __TYPE_H
 
+#ifdef HOST_SIM
+#include <stdint.h>
+#else
 typedef signed long long int64_t;
 typedef signed long  int32_t;
 typedef signed short int16_t;
@@ -10,6 +13,7 @@ typedef unsigned long long uint64_t;
 typedef unsigned long  uint32_t;
 typedef unsigned short uint16_t;
 typedef unsigned char  uint8_t;
+#endif
 
 
 #define U8_MAX     ((u8_t)255)
@@ -49,6 +53,8 @@ typedef u64_t sys_time;
 typedef u32_t sys_time;
 #endif
 
+#ifndef HOST_SIM
 typedef int FILE;
+#endif
 
 #endif /* __TYPE_H */
@@ -0,0 +1,37 @@
+/*
+ * ws2812b.c
+ *
+ * Table driven WS2812B spi encoder. A colour byte is expanded by
+ * looking up its nibbles, giving 20 coded bits each.
+ */
+
+#include "ws2812b.h"
+
+// 0b10000 / 0b11110 per bit, msb first
+static const uint32_t CODED_NIBBLE[16] = {
+  0x84210, 0x8421e, 0x843d0, 0x843de, 0x87a10, 0x87a1e, 0x87bd0, 0x87bde,
+  0xf4210, 0xf421e, 0xf43d0, 0xf43de, 0xf7a10, 0xf7a1e, 0xf7bd0, 0xf7bde };
+
+static inline uint8_t *_encode_byte(uint8_t *dst, uint8_t v) {
+  uint32_t hi = CODED_NIBBLE[v >> 4];
+  uint32_t lo = CODED_NIBBLE[v & 0xf];
+  dst[0] = hi >> 12;
+  dst[1] = hi >> 4;
+  dst[2] = (hi << 4) | (lo >> 16);
+  dst[3] = lo >> 8;
+  dst[4] = lo;
+  return dst + WS2812B_CODED_BYTES_PER_RGB_BYTE;
+}
+
+uint8_t *ws2812b_encode_pixel(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b) {
+  dst = _encode_byte(dst, g);
+  dst = _encode_byte(dst, r);
+  return _encode_byte(dst, b);
+}
+
+void ws2812b_encode(uint8_t *dst, const uint32_t *rgb, uint32_t leds) {
+  while (leds--) {
+    uint32_t d = *rgb++;
+    dst = ws2812b_encode_pixel(dst, (d>>16)&0xff, (d>>8)&0xff, d&0xff);
+  }
+}
@@ -0,0 +1,42 @@
+/*
+ * ws2812b.h
+ *
+ * WS2812B encoding for spi. Each data bit is sent as five spi bits at
+ * 4 MHz, 0b10000 for a zero and 0b11110 for a one. Thus, every colour
+ * byte becomes five coded bytes.
+ */
+
+#ifndef WS2812B_H_
+#define WS2812B_H_
+
+#include "system.h"
+
+#define WS2812B_CODED_BYTES_PER_RGB_BYTE  5
+#define WS2812B_CODED_LEN(leds) \
+  (3 * (leds) * WS2812B_CODED_BYTES_PER_RGB_BYTE)
+// leds latch data after line is low for more than 50 us, which is
+// appended to each frame as zero bytes, 64 us at 4 MHz
+#define WS2812B_RESET_BYTES               32
+#define WS2812B_FRAME_LEN(leds) \
+  (WS2812B_CODED_LEN(leds) + WS2812B_RESET_BYTES)
+// easydma count is 8 bits, longer frames go out as a list of equal
+// chunks chained in hardware, the frame padded with zero bytes to fill
+// the last one. Chunks are a multiple of coded bytes per rgb byte so line
+// is never paused in the middle of a bit.
+#define WS2812B_SPI_MAX_CHUNK             255
+#define WS2812B_SPI_CHUNKS(len) \
+  (((len) + WS2812B_SPI_MAX_CHUNK - 1) / WS2812B_SPI_MAX_CHUNK)
+#define WS2812B_SPI_CHUNK(len) \
+  ((((len) + WS2812B_SPI_CHUNKS(len) - 1) / WS2812B_SPI_CHUNKS(len) + \
+    WS2812B_CODED_BYTES_PER_RGB_BYTE - 1) / \
+   WS2812B_CODED_BYTES_PER_RGB_BYTE * WS2812B_CODED_BYTES_PER_RGB_BYTE)
+#define WS2812B_SPI_LEN(len) \
+  (WS2812B_SPI_CHUNKS(len) * WS2812B_SPI_CHUNK(len))
+
+// encodes one pixel in wire order (grb) to dst, returns dst of next pixel
+uint8_t *ws2812b_encode_pixel(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b);
+
+// encodes given number of 0xrrggbb pixels to dst
+void ws2812b_encode(uint8_t *dst, const uint32_t *rgb, uint32_t leds);
+
+#endif /* WS2812B_H_ */